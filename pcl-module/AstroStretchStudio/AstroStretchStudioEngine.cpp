@@ -0,0 +1,3311 @@
+// ----------------------------------------------------------------------------
+// AstroStretchStudio Engine Implementation
+// ----------------------------------------------------------------------------
+
+#include "AstroStretchStudioEngine.h"
+#include "AstroStretchStudioParallel.h"
+
+#include <pcl/Math.h>
+#include <pcl/Sort.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#ifdef __F16C__
+#  include <immintrin.h>
+#endif
+
+#if defined( __PCL_LINUX ) || defined( __PCL_FREEBSD )
+#  include <unistd.h>
+#endif
+#ifdef __PCL_MACOSX
+#  include <mach/mach.h>
+#  include <unistd.h>
+#endif
+#ifdef __PCL_WINDOWS
+#  include <windows.h>
+#endif
+
+namespace pcl
+{
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Pixel loops run row by row within their row bands. Vectorized loops leave
+ * their last pixels to scalar code, and the vector and scalar versions of
+ * math functions may round differently, so a loop over a whole band would
+ * make results depend on where bands end, i.e. on the number of threads.
+ * Row by row, the split only depends on the image width.
+ */
+
+// Row range of band b when h rows are split into n bands.
+static inline void BandRows( int b, int n, int h, int& y0, int& y1 )
+{
+   y0 = int( int64( b )*h/n );
+   y1 = int( int64( b+1 )*h/n );
+}
+
+// Calls f( rect ) for the tiles of a width x height image, row by row.
+template <class F>
+static void ForEachTile( int width, int height, int tileSize, F f )
+{
+   for ( int y = 0; y < height; y += tileSize )
+      for ( int x = 0; x < width; x += tileSize )
+         f( Rect( x, y, Min( x + tileSize, width ), Min( y + tileSize, height ) ) );
+}
+
+// Memory of a width x height plane of 32-bit floats.
+static inline size_type PlaneBytes( int width, int height )
+{
+   return size_type( width )*size_type( height )*sizeof( float );
+}
+
+// ----------------------------------------------------------------------------
+
+ScratchArena::ScratchArena( size_type maxBytes )
+   : m_maxBytes( maxBytes )
+{
+}
+
+// ----------------------------------------------------------------------------
+
+ScratchArena::~ScratchArena()
+{
+   Clear();
+   for ( const Buffer& b : m_acquired )
+      FreeBuffer( b.data );
+}
+
+// ----------------------------------------------------------------------------
+
+ScratchArena& ScratchArena::Default()
+{
+   static ScratchArena arena;
+   return arena;
+}
+
+// ----------------------------------------------------------------------------
+
+void ScratchArena::Acquire( Image& image, int width, int height, int numberOfChannels )
+{
+   if ( !image.IsEmpty() && image.IsUnique()
+     && image.Width() == width && image.Height() == height && image.NumberOfChannels() == numberOfChannels )
+      return;
+
+   Release( image );
+
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+
+      // Most recently released first: its pages are the likeliest to be
+      // resident.
+      for ( size_type i = m_images.Length(); i > 0; --i )
+      {
+         const Image& p = m_images[i-1].image;
+         if ( p.Width() == width && p.Height() == height && p.NumberOfChannels() == numberOfChannels )
+         {
+            image = p;
+            m_bytes -= p.ImageSize();
+            m_images.Remove( m_images.At( i-1 ) );
+            return;
+         }
+      }
+      ++m_allocations;
+   }
+
+   image.AllocateData( width, height, numberOfChannels, (numberOfChannels >= 3) ? ColorSpace::RGB : ColorSpace::Gray );
+}
+
+// ----------------------------------------------------------------------------
+
+void ScratchArena::Release( Image& image )
+{
+   if ( !image.IsEmpty() && image.IsUnique() && image.ImageSize() <= m_maxBytes )
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_images.Add( PooledImage{ image, ++m_releaseCount } );
+      m_bytes += image.ImageSize();
+      Trim();
+   }
+   image = Image();
+}
+
+// ----------------------------------------------------------------------------
+
+void ScratchArena::Release( Array<Image>& images )
+{
+   for ( Image& image : images )
+      Release( image );
+   images.Clear();
+}
+
+// ----------------------------------------------------------------------------
+
+float* ScratchArena::AcquireBuffer( size_type count )
+{
+   count = Max( count, size_type( 1 ) );
+
+   std::lock_guard<std::mutex> lock( m_mutex );
+
+   // Smallest pooled buffer that is large enough
+   size_type best = m_buffers.Length();
+   for ( size_type i = 0; i < m_buffers.Length(); ++i )
+      if ( m_buffers[i].count >= count )
+         if ( best == m_buffers.Length() || m_buffers[i].count < m_buffers[best].count )
+            best = i;
+
+   Buffer b;
+   if ( best < m_buffers.Length() )
+   {
+      b = m_buffers[best];
+      m_bytes -= b.count*sizeof( float );
+      m_buffers.Remove( m_buffers.At( best ) );
+   }
+   else
+   {
+      b = Buffer{ AllocateBuffer( count ), count, 0 };
+      ++m_allocations;
+   }
+   m_acquired.Add( b );
+   return b.data;
+}
+
+// ----------------------------------------------------------------------------
+
+void ScratchArena::ReleaseBuffer( float* data )
+{
+   if ( data == nullptr )
+      return;
+
+   std::lock_guard<std::mutex> lock( m_mutex );
+   for ( size_type i = 0; i < m_acquired.Length(); ++i )
+      if ( m_acquired[i].data == data )
+      {
+         Buffer b = m_acquired[i];
+         m_acquired.Remove( m_acquired.At( i ) );
+         b.released = ++m_releaseCount;
+         m_buffers.Add( b );
+         m_bytes += b.count*sizeof( float );
+         Trim();
+         return;
+      }
+}
+
+// ----------------------------------------------------------------------------
+
+size_type ScratchArena::MaxBytes() const
+{
+   std::lock_guard<std::mutex> lock( m_mutex );
+   return m_maxBytes;
+}
+
+// ----------------------------------------------------------------------------
+
+void ScratchArena::SetMaxBytes( size_type maxBytes )
+{
+   std::lock_guard<std::mutex> lock( m_mutex );
+   m_maxBytes = maxBytes;
+   Trim();
+}
+
+// ----------------------------------------------------------------------------
+
+size_type ScratchArena::PooledBytes() const
+{
+   std::lock_guard<std::mutex> lock( m_mutex );
+   return m_bytes;
+}
+
+// ----------------------------------------------------------------------------
+
+size_type ScratchArena::Allocations() const
+{
+   std::lock_guard<std::mutex> lock( m_mutex );
+   return m_allocations;
+}
+
+// ----------------------------------------------------------------------------
+
+void ScratchArena::Clear()
+{
+   std::lock_guard<std::mutex> lock( m_mutex );
+   m_images.Clear();
+   for ( const Buffer& b : m_buffers )
+      FreeBuffer( b.data );
+   m_buffers.Clear();
+   m_bytes = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+// Frees the least recently released items until the pool fits the cap.
+// The caller holds the mutex.
+void ScratchArena::Trim()
+{
+   while ( m_bytes > m_maxBytes )
+   {
+      size_type image = m_images.Length();
+      for ( size_type i = 0; i < m_images.Length(); ++i )
+         if ( image == m_images.Length() || m_images[i].released < m_images[image].released )
+            image = i;
+      size_type buffer = m_buffers.Length();
+      for ( size_type i = 0; i < m_buffers.Length(); ++i )
+         if ( buffer == m_buffers.Length() || m_buffers[i].released < m_buffers[buffer].released )
+            buffer = i;
+
+      if ( image < m_images.Length()
+        && (buffer == m_buffers.Length() || m_images[image].released < m_buffers[buffer].released) )
+      {
+         m_bytes -= m_images[image].image.ImageSize();
+         m_images.Remove( m_images.At( image ) );
+      }
+      else if ( buffer < m_buffers.Length() )
+      {
+         m_bytes -= m_buffers[buffer].count*sizeof( float );
+         FreeBuffer( m_buffers[buffer].data );
+         m_buffers.Remove( m_buffers.At( buffer ) );
+      }
+      else
+         break;
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+float* ScratchArena::AllocateBuffer( size_type count )
+{
+   return static_cast<float*>( ::operator new( count*sizeof( float ), std::align_val_t( Alignment ) ) );
+}
+
+// ----------------------------------------------------------------------------
+
+void ScratchArena::FreeBuffer( float* data )
+{
+   ::operator delete( data, std::align_val_t( Alignment ) );
+}
+
+// ----------------------------------------------------------------------------
+
+static inline uint16 FloatToHalf( float x )
+{
+   uint32 u;
+   std::memcpy( &u, &x, sizeof( u ) );
+   const uint16 sign = uint16( (u >> 16) & 0x8000 );
+   const uint32 a = u & 0x7fffffff;
+   if ( a >= 0x7f800000 )                      // infinity or NaN
+      return sign | 0x7c00 | ((a > 0x7f800000) ? 0x200 : 0);
+   if ( a >= 0x477ff000 )                      // rounds beyond 65504
+      return sign | 0x7c00;
+   if ( a >= 0x38800000 )                      // normal: rebias, round to nearest even
+   {
+      uint32 r = a - 0x38000000;
+      r += 0xfff + ((r >> 13) & 1);
+      return sign | uint16( r >> 13 );
+   }
+   // Subnormal or zero: units of 2^-24; 1024 units carry into the smallest
+   // normal number.
+   float m;
+   std::memcpy( &m, &a, sizeof( m ) );
+   return sign | uint16( std::lrint( m*16777216.0f ) );
+}
+
+static inline float HalfToFloat( uint16 h )
+{
+   const uint32 sign = uint32( h & 0x8000 ) << 16;
+   const uint32 e = (h >> 10) & 0x1f;
+   const uint32 m = h & 0x3ff;
+   uint32 u;
+   if ( e == 0 )
+   {
+      float f = m*(1.0f/16777216);
+      std::memcpy( &u, &f, sizeof( u ) );
+      u |= sign;
+   }
+   else if ( e == 31 )
+      u = sign | 0x7f800000 | (m << 13);
+   else
+      u = sign | ((e + 112) << 23) | (m << 13);
+   float f;
+   std::memcpy( &f, &u, sizeof( f ) );
+   return f;
+}
+
+void HalfPlane::ToHalf( uint16* h, const float* f, size_type n )
+{
+   size_type i = 0;
+#ifdef __F16C__
+   for ( ; i + 8 <= n; i += 8 )
+      _mm_storeu_si128( reinterpret_cast<__m128i*>( h + i ),
+                        _mm256_cvtps_ph( _mm256_loadu_ps( f + i ), _MM_FROUND_TO_NEAREST_INT ) );
+#endif
+   for ( ; i < n; ++i )
+      h[i] = FloatToHalf( f[i] );
+}
+
+void HalfPlane::ToFloat( float* f, const uint16* h, size_type n )
+{
+   size_type i = 0;
+#ifdef __F16C__
+   for ( ; i + 8 <= n; i += 8 )
+      _mm256_storeu_ps( f + i, _mm256_cvtph_ps( _mm_loadu_si128( reinterpret_cast<const __m128i*>( h + i ) ) ) );
+#endif
+   for ( ; i < n; ++i )
+      f[i] = HalfToFloat( h[i] );
+}
+
+// ----------------------------------------------------------------------------
+
+void HalfPlane::Encode( const Image& plane, int numberOfThreads )
+{
+   const int w = m_width = plane.Width();
+   m_height = plane.Height();
+   m_data = Array<uint16>( plane.NumberOfPixels() );
+   const float* f = plane.PixelData();
+   uint16* h = m_data.Begin();
+   ParallelBands( m_height, numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         ToHalf( h + size_type( y0 )*w, f + size_type( y0 )*w, size_type( y1 - y0 )*w );
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+void HalfPlane::Decode( Image& plane, int numberOfThreads ) const
+{
+   const int w = m_width;
+   const uint16* h = m_data.Begin();
+   float* f = plane.PixelData();
+   ParallelBands( m_height, numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         ToFloat( f + size_type( y0 )*w, h + size_type( y0 )*w, size_type( y1 - y0 )*w );
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+StretchCurve::StretchCurve( const FVector& table )
+   : m_table( table )
+   , m_envelope( table.Length() )
+{
+   float y = m_table[0];
+   for ( int i = 0; i < m_table.Length(); ++i )
+      m_envelope[i] = y = Max( y, m_table[i] );
+}
+
+// ----------------------------------------------------------------------------
+
+double StretchCurve::Inverse( double y ) const
+{
+   const int n = m_envelope.Length();
+   int lo = 0, hi = n;
+   while ( lo < hi )
+   {
+      int mid = ( lo + hi ) / 2;
+      if ( m_envelope[mid] < y )
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return (lo < n) ? double( lo )/(n - 1) : 1.0;
+}
+
+// ----------------------------------------------------------------------------
+
+double StretchCurve::Derivative( double x ) const
+{
+   const int n = m_table.Length();
+   const int i = Index( x );
+   const int i0 = Max( i - 1, 0 );
+   const int i1 = Min( i + 1, n - 1 );
+   return (double( m_table[i1] ) - m_table[i0]) * (n - 1)/(i1 - i0);
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchCurve::TransformHistogram( UI64Vector& output, const UI64Vector& input ) const
+{
+   StretchEngine::TransformHistogram( output, input, m_table );
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchCache::SetSource( const IsoString& sourceId )
+{
+   if ( sourceId != m_sourceId )
+   {
+      Clear();
+      m_sourceId = sourceId;
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchCache::Clear()
+{
+   m_sourceId.Clear();
+   m_L.FreeData();
+   m_hasL = false;
+   InvalidateLuminance();
+   m_channels.Clear();
+}
+
+// ----------------------------------------------------------------------------
+
+// Drops everything derived from the luminance plane.
+void StretchCache::InvalidateLuminance()
+{
+   m_srcCDF = FVector();
+   m_transportMap = FVector();
+   m_otsCurve = StretchCurve();
+   m_scales.Clear();
+   m_halfScales.Clear();
+   m_numScales = -1;
+   m_noiseSigma = -1;
+   m_smooth.Clear();
+   m_smoothSigma.Clear();
+   m_reconstruction.FreeData();
+   m_hasReconstruction = false;
+   m_backgroundLevel = -1;
+   m_sasBackground = DVector();
+   m_LHistogram = UI64Vector();
+   m_reconstructionHistogram = UI64Vector();
+   m_reconstructionMin = 0;
+   m_reconstructionMax = 1;
+}
+
+// ----------------------------------------------------------------------------
+
+StretchEngine::StretchEngine( const StretchParameters& params, int numberOfThreads )
+   : m_params( params )
+   , m_numberOfThreads( Max( 1, numberOfThreads ) )
+   , m_arena( &ScratchArena::Default() )
+{
+}
+
+// ----------------------------------------------------------------------------
+
+template <class P>
+void StretchEngine::UpdateLuminance( StretchCache& cache, const GenericImage<P>& image, bool useLuminance ) const
+{
+   if ( !cache.m_hasL || cache.m_luminance != useLuminance
+     || cache.m_L.Width() != image.Width() || cache.m_L.Height() != image.Height() )
+   {
+      ExtractLuminance( cache.m_L, image, useLuminance );
+      cache.m_hasL = true;
+      cache.m_luminance = useLuminance;
+      cache.InvalidateLuminance();
+   }
+   cache.m_numberOfChannels = image.NumberOfChannels();
+}
+
+// ----------------------------------------------------------------------------
+
+template <class P>
+void StretchEngine::UpdateChannel( StretchCache& cache, const GenericImage<P>& image, int channel ) const
+{
+   if ( !cache.m_hasL || cache.m_channel != channel
+     || cache.m_L.Width() != image.Width() || cache.m_L.Height() != image.Height() )
+   {
+      ExtractChannel( cache.m_L, image, channel );
+      cache.m_hasL = true;
+      cache.m_luminance = false;
+      cache.m_channel = channel;
+      cache.InvalidateLuminance();
+   }
+   cache.m_numberOfChannels = 1;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Gaussian-smoothed luminance for SAS highlight modulation. Planes are kept
+ * by filter size when keep is true; otherwise only the last one is.
+ */
+const Image& StretchEngine::SmoothedLuminance( StretchCache& cache, double sigma, bool keep ) const
+{
+   for ( size_type i = 0; i < cache.m_smoothSigma.Length(); ++i )
+      if ( cache.m_smoothSigma[i] == sigma )
+         return cache.m_smooth[i];
+
+   if ( !keep )
+   {
+      m_arena->Release( cache.m_smooth );
+      cache.m_smoothSigma.Clear();
+   }
+
+   Image smooth;
+   m_arena->Acquire( smooth, cache.m_L.Width(), cache.m_L.Height() );
+   CopyPlane( smooth, cache.m_L );
+   GaussianSmooth( smooth, sigma );
+   cache.m_smooth.Add( smooth );
+   cache.m_smoothSigma.Add( sigma );
+   return cache.m_smooth[cache.m_smooth.Length()-1];
+}
+
+// ----------------------------------------------------------------------------
+
+// Raw OTS transport map from a source CDF to the target of the object type.
+const FVector& StretchEngine::UpdateTransportMap( StretchCache& cache, const FVector& srcCDF, bool fromStats ) const
+{
+   if ( cache.m_transportMap.IsEmpty() || cache.m_transportFromStats != fromStats
+     || cache.m_objectType != m_params.otsObjectType || cache.m_otsBackgroundTarget != m_params.otsBackgroundTarget )
+   {
+      FVector tgtCDF( srcCDF.Length() );
+      GenerateTargetCDF( tgtCDF, m_params.otsObjectType, m_params.otsBackgroundTarget );
+      cache.m_transportMap = FVector( srcCDF.Length() );
+      ComputeTransportMap( cache.m_transportMap, srcCDF, tgtCDF );
+      cache.m_transportFromStats = fromStats;
+      cache.m_objectType = m_params.otsObjectType;
+      cache.m_otsBackgroundTarget = m_params.otsBackgroundTarget;
+      cache.m_otsCurve = StretchCurve();
+   }
+   return cache.m_transportMap;
+}
+
+// ----------------------------------------------------------------------------
+
+// OTS curve for the current parameters, compiled from the transport map.
+const StretchCurve& StretchEngine::UpdateOTSCurve( StretchCache& cache, const FVector& srcCDF, bool fromStats ) const
+{
+   const FVector& transportMap = UpdateTransportMap( cache, srcCDF, fromStats );
+   if ( cache.m_otsCurve.IsEmpty() || cache.m_otsProtectHighlights != m_params.otsProtectHighlights
+     || cache.m_otsStretchIntensity != m_params.otsStretchIntensity )
+   {
+      CompileOTSCurve( cache.m_otsCurve, transportMap );
+      cache.m_otsProtectHighlights = m_params.otsProtectHighlights;
+      cache.m_otsStretchIntensity = m_params.otsStretchIntensity;
+   }
+   return cache.m_otsCurve;
+}
+
+// ----------------------------------------------------------------------------
+
+// Whether the cached SAS reconstruction was made with the current parameters.
+bool StretchEngine::SameReconstructionParameters( const StretchParameters& p ) const
+{
+   return p.sasNumScales == m_params.sasNumScales
+       && p.sasNoiseThreshold == m_params.sasNoiseThreshold
+       && p.sasFineScaleGain == m_params.sasFineScaleGain
+       && p.sasMidScaleGain == m_params.sasMidScaleGain
+       && p.sasCoarseScaleGain == m_params.sasCoarseScaleGain
+       && p.sasHighlightProtection == m_params.sasHighlightProtection
+       && p.sasFlattenBackground == m_params.sasFlattenBackground
+       && (!p.sasFlattenBackground || p.sasBackgroundTarget == m_params.sasBackgroundTarget);
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchEngine::Apply( ImageVariant& image, const StretchStatistics* stats, double reduction,
+                           StretchCache* cache ) const
+{
+   if ( image.IsComplexSample() )
+      return;
+
+   if ( m_params.algorithm == ASSAlgorithm::OTS )
+   {
+      if ( image.IsFloatSample() )
+         switch ( image.BitsPerSample() )
+         {
+         case 32: ApplyOTS( static_cast<Image&>( *image ), stats, cache ); break;
+         case 64: ApplyOTS( static_cast<DImage&>( *image ), stats, cache ); break;
+         }
+      else
+         switch ( image.BitsPerSample() )
+         {
+         case  8: ApplyOTS( static_cast<UInt8Image&>( *image ), stats, cache ); break;
+         case 16: ApplyOTS( static_cast<UInt16Image&>( *image ), stats, cache ); break;
+         case 32: ApplyOTS( static_cast<UInt32Image&>( *image ), stats, cache ); break;
+         }
+   }
+   else // SAS
+   {
+      if ( image.IsFloatSample() )
+         switch ( image.BitsPerSample() )
+         {
+         case 32: ApplySAS( static_cast<Image&>( *image ), stats, reduction, cache ); break;
+         case 64: ApplySAS( static_cast<DImage&>( *image ), stats, reduction, cache ); break;
+         }
+      else
+         switch ( image.BitsPerSample() )
+         {
+         case  8: ApplySAS( static_cast<UInt8Image&>( *image ), stats, reduction, cache ); break;
+         case 16: ApplySAS( static_cast<UInt16Image&>( *image ), stats, reduction, cache ); break;
+         case 32: ApplySAS( static_cast<UInt32Image&>( *image ), stats, reduction, cache ); break;
+         }
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+bool StretchEngine::UsesLuminance( int numberOfChannels ) const
+{
+   return numberOfChannels >= 3 && ((m_params.algorithm == ASSAlgorithm::OTS) ? m_params.otsPreserveColor
+                                                                              : m_params.sasPreserveColor);
+}
+
+// ----------------------------------------------------------------------------
+
+bool StretchEngine::SASPerChannel( int numberOfChannels ) const
+{
+   return numberOfChannels >= 3 && m_params.algorithm == ASSAlgorithm::SAS && !m_params.sasPreserveColor;
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchEngine::ComputeStatistics( StretchStatistics& stats, const ImageVariant& image ) const
+{
+   stats.Invalidate();
+
+   if ( image.IsComplexSample() )
+      return;
+
+   if ( image.IsFloatSample() )
+      switch ( image.BitsPerSample() )
+      {
+      case 32: ComputeStatistics( stats, static_cast<const Image&>( *image ) ); break;
+      case 64: ComputeStatistics( stats, static_cast<const DImage&>( *image ) ); break;
+      }
+   else
+      switch ( image.BitsPerSample() )
+      {
+      case  8: ComputeStatistics( stats, static_cast<const UInt8Image&>( *image ) ); break;
+      case 16: ComputeStatistics( stats, static_cast<const UInt16Image&>( *image ) ); break;
+      case 32: ComputeStatistics( stats, static_cast<const UInt32Image&>( *image ) ); break;
+      }
+}
+
+// ----------------------------------------------------------------------------
+
+template <class P>
+void StretchEngine::ComputeStatistics( StretchStatistics& stats, const GenericImage<P>& image ) const
+{
+   const int resolution = 65536;
+
+   stats.Invalidate();
+   stats.luminance = UsesLuminance( image.NumberOfChannels() );
+
+   Image L;
+   ExtractLuminance( L, image, stats.luminance );
+   CheckCancel();
+
+   // OTS source distribution and SAS background reference
+   stats.srcCDF = FVector( resolution );
+   ComputeHistogramCDF( L, stats.srcCDF );
+   stats.backgroundLevel = CDFPercentile( stats.srcCDF, 0.05 );
+   CheckCancel();
+
+   // SAS noise estimate, as measured by ApplySAS at full resolution
+   Array<Image> scales;
+   StarletDecompose( L, scales, 1 );
+   stats.noiseSigma = EstimateNoise( scales[0] );
+   m_arena->Release( scales );
+
+   // The same for each channel of a color image, for SAS per channel
+   stats.channelNoiseSigma = DVector();
+   stats.channelBackgroundLevel = DVector();
+   if ( !stats.luminance && image.NumberOfChannels() >= 3 )
+   {
+      const int n = image.NumberOfNominalChannels();
+      stats.channelNoiseSigma = DVector( n );
+      stats.channelBackgroundLevel = DVector( n );
+      stats.channelNoiseSigma[0] = stats.noiseSigma;
+      stats.channelBackgroundLevel[0] = stats.backgroundLevel;
+      FVector cdf( resolution );
+      for ( int c = 1; c < n; ++c )
+      {
+         CheckCancel();
+         ExtractChannel( L, image, c );
+         ComputeHistogramCDF( L, cdf );
+         stats.channelBackgroundLevel[c] = CDFPercentile( cdf, 0.05 );
+         StarletDecompose( L, scales, 1 );
+         stats.channelNoiseSigma[c] = EstimateNoise( scales[0] );
+         m_arena->Release( scales );
+      }
+   }
+   m_arena->Release( L );
+
+   stats.valid = true;
+}
+
+// ----------------------------------------------------------------------------
+// Execution Planning
+// ----------------------------------------------------------------------------
+
+IsoString ExecutionPlan::ToString() const
+{
+   IsoString s;
+   switch ( strategy )
+   {
+   default:
+   case ExecutionStrategy::WholeImage:
+      s = "whole image";
+      break;
+   case ExecutionStrategy::StreamingScales:
+      s = "streaming scales";
+      break;
+   case ExecutionStrategy::Tiled:
+      s.Format( "tiled, %dx%d tiles with a %d-pixel halo", tileSize, tileSize, halo );
+      break;
+   }
+
+   s += IsoString().Format( ", predicted peak %.1f MiB", peakBytes/1048576.0 );
+   if ( budget < ~size_type( 0 ) )
+      s += IsoString().Format( ", budget %.1f MiB", budget/1048576.0 );
+   if ( !fits )
+      s += " (over budget)";
+   return s;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Whole-image SAS holds the luminance, every starlet scale, the
+ * reconstruction and two planes for the highlight blur. Streaming keeps only
+ * the scale being consumed besides the luminance and the reconstruction:
+ * seven planes whatever the number of scales. Tiled SAS keeps the compressed
+ * luminance as a full plane and the streaming working set of one tile with
+ * its halo, plus the histograms of the noise estimate.
+ *
+ * SAS per channel holds the whole image planes of every channel at once.
+ * Streaming and tiles go through the channels in turn; linked channels keep
+ * the compressed plane of each channel until their background is known.
+ */
+size_type StretchEngine::PeakMemory( ExecutionStrategy::value_type strategy, int width, int height, int tileSize,
+                                     int numberOfChannels ) const
+{
+   const size_type plane = PlaneBytes( width, height );
+   const size_type histograms = size_type( 65536 )*sizeof( uint64 )*(m_numberOfThreads + 2);
+   const int channels = SASPerChannel( numberOfChannels ) ? Min( numberOfChannels, 3 ) : 1;
+   const int keptPlanes = (channels > 1 && m_params.sasLinkChannels) ? channels : 1;
+
+   if ( strategy == ExecutionStrategy::Tiled )
+   {
+      if ( m_params.algorithm == ASSAlgorithm::OTS )
+         return PlaneBytes( Min( tileSize, width ), Min( tileSize, height ) ) + histograms;
+
+      const int size = tileSize + 2*TileHalo();
+      return keptPlanes*plane + 7*PlaneBytes( Min( size, width ), Min( size, height ) )
+           + 2*size_type( NoiseHistogramBins )*sizeof( uint64 ) + histograms;
+   }
+
+   if ( m_params.algorithm == ASSAlgorithm::OTS )
+      return plane + histograms;
+   if ( strategy == ExecutionStrategy::StreamingScales )
+      return (6 + keptPlanes)*plane;
+   return channels*size_type( m_params.sasNumScales + 5 )*plane;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * A pixel of the last starlet scale depends on pixels up to 2*(2^n - 1)
+ * away, and the highlight blur on pixels within three times its largest
+ * sigma. Tile interiors at least that far from the tile edges are computed
+ * exactly as on the whole image.
+ */
+int StretchEngine::TileHalo() const
+{
+   if ( m_params.algorithm == ASSAlgorithm::OTS )
+      return 0;
+   const int n = m_params.sasNumScales;
+   int halo = 2*((1 << n) - 1);
+   if ( m_params.sasHighlightProtection > 0 )
+      halo = Max( halo, Max( 1, int( Ceil( 3*HighlightSigma( n - 1, 1 ) ) ) ) );
+   return halo;
+}
+
+// ----------------------------------------------------------------------------
+
+ExecutionPlan StretchEngine::Plan( int width, int height, size_type budget, int numberOfChannels ) const
+{
+   ExecutionPlan plan;
+   plan.budget = budget;
+
+   plan.strategy = ExecutionStrategy::WholeImage;
+   plan.peakBytes = PeakMemory( plan.strategy, width, height, 0, numberOfChannels );
+   if ( plan.peakBytes <= budget )
+      return plan;
+
+   if ( m_params.algorithm == ASSAlgorithm::SAS )
+   {
+      plan.strategy = ExecutionStrategy::StreamingScales;
+      plan.peakBytes = PeakMemory( plan.strategy, width, height, 0, numberOfChannels );
+      if ( plan.peakBytes <= budget )
+         return plan;
+   }
+
+   // The largest tiles that fit, in steps of 64 pixels
+   plan.strategy = ExecutionStrategy::Tiled;
+   plan.halo = TileHalo();
+   plan.tileSize = MinTileSize;
+   for ( int size = (Max( width, height ) + 63) & ~63; size >= MinTileSize; size -= 64 )
+      if ( PeakMemory( plan.strategy, width, height, size, numberOfChannels ) <= budget )
+      {
+         plan.tileSize = size;
+         break;
+      }
+   plan.peakBytes = PeakMemory( plan.strategy, width, height, plan.tileSize, numberOfChannels );
+   plan.fits = plan.peakBytes <= budget;
+   return plan;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Cancellation checks of a full-resolution execution: one per stage, per
+ * starlet scale and per tile of each tiled pass. They are not equally long,
+ * but finely enough spread to tell progress.
+ */
+uint32 StretchEngine::Checkpoints( const ExecutionPlan& plan, int width, int height, int numberOfChannels ) const
+{
+   const uint32 S = uint32( Max( 0, m_params.sasNumScales ) );
+   const bool perChannel = SASPerChannel( numberOfChannels );
+   const uint32 n = perChannel ? uint32( Min( numberOfChannels, 3 ) ) : 1;
+
+   if ( plan.strategy == ExecutionStrategy::Tiled )
+   {
+      const int tileSize = Max( 64, plan.tileSize );
+      const uint32 T = uint32( (width + tileSize - 1)/tileSize )*uint32( (height + tileSize - 1)/tileSize );
+      if ( m_params.algorithm == ASSAlgorithm::OTS )
+         return (numberOfChannels >= 3 && m_params.otsPreserveColor) ? 2*T : T;
+      // Noise, reconstruction with its scales, background and normalization
+      return n*(T*(S + 4) + 1);
+   }
+
+   if ( m_params.algorithm == ASSAlgorithm::OTS )
+      return 2;
+
+   if ( plan.strategy == ExecutionStrategy::StreamingScales )
+   {
+      if ( perChannel )
+         return n*(S + 2) + (m_params.sasLinkChannels ? 2*n : 0);
+      return S + 3;
+   }
+
+   if ( perChannel )
+      return n*(2*S + 2) + 1;
+   return 2*S + 3;
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchEngine::Apply( ImageVariant& image, const ExecutionPlan& plan ) const
+{
+   if ( image.IsComplexSample() )
+      return;
+
+   if ( plan.strategy == ExecutionStrategy::Tiled )
+   {
+      if ( image.IsFloatSample() )
+         switch ( image.BitsPerSample() )
+         {
+         case 32: ApplyTiled( static_cast<Image&>( *image ), plan.tileSize ); break;
+         case 64: ApplyTiled( static_cast<DImage&>( *image ), plan.tileSize ); break;
+         }
+      else
+         switch ( image.BitsPerSample() )
+         {
+         case  8: ApplyTiled( static_cast<UInt8Image&>( *image ), plan.tileSize ); break;
+         case 16: ApplyTiled( static_cast<UInt16Image&>( *image ), plan.tileSize ); break;
+         case 32: ApplyTiled( static_cast<UInt32Image&>( *image ), plan.tileSize ); break;
+         }
+   }
+   else if ( plan.strategy == ExecutionStrategy::StreamingScales && m_params.algorithm == ASSAlgorithm::SAS )
+   {
+      if ( image.IsFloatSample() )
+         switch ( image.BitsPerSample() )
+         {
+         case 32: ApplySASStreaming( static_cast<Image&>( *image ) ); break;
+         case 64: ApplySASStreaming( static_cast<DImage&>( *image ) ); break;
+         }
+      else
+         switch ( image.BitsPerSample() )
+         {
+         case  8: ApplySASStreaming( static_cast<UInt8Image&>( *image ) ); break;
+         case 16: ApplySASStreaming( static_cast<UInt16Image&>( *image ) ); break;
+         case 32: ApplySASStreaming( static_cast<UInt32Image&>( *image ) ); break;
+         }
+   }
+   else
+      Apply( image );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Full-resolution SAS with the starlet scales consumed as they are
+ * computed. The result is the same as that of ApplySAS().
+ */
+template <class P>
+void StretchEngine::ApplySASStreaming( GenericImage<P>& image ) const
+{
+   if ( SASPerChannel( image.NumberOfChannels() ) )
+   {
+      // One channel at a time. Linked channels need the noise of all of
+      // them first, and keep their compressed planes for the background.
+      const int n = image.NumberOfNominalChannels();
+      const bool linked = m_params.sasLinkChannels;
+      Image L_orig;
+      double sigma = -1;
+      if ( linked )
+      {
+         Array<Image> scales;
+         sigma = 0;
+         for ( int c = 0; c < n; ++c )
+         {
+            CheckCancel();
+            ExtractChannel( L_orig, image, c );
+            StarletDecompose( L_orig, scales, 1 );
+            sigma += EstimateNoise( scales[0] );
+            m_arena->Release( scales );
+         }
+         sigma /= n;
+      }
+
+      Array<Image> L( n );
+      double background = 0;
+      for ( int c = 0; c < n; ++c )
+      {
+         CheckCancel();
+         ExtractChannel( L_orig, image, c );
+         StreamingReconstruction( L[c], L_orig, sigma );
+         CheckCancel();
+         CompressReconstruction( L[c] );
+         if ( linked )
+            background += Percentile( L[c], 0.05 );
+         else
+         {
+            NormalizeBackground( L[c], Percentile( L[c], 0.05 ) );
+            ApplyChannel( image, c, L[c] );
+            m_arena->Release( L[c] );
+         }
+      }
+      m_arena->Release( L_orig );
+
+      background /= n;
+      if ( linked )
+         for ( int c = 0; c < n; ++c )
+         {
+            NormalizeBackground( L[c], background );
+            ApplyChannel( image, c, L[c] );
+            m_arena->Release( L[c] );
+         }
+      return;
+   }
+
+   bool preserveColor = image.NumberOfChannels() >= 3 && m_params.sasPreserveColor;
+
+   Image L_orig;
+   ExtractLuminance( L_orig, image, preserveColor );
+   CheckCancel();
+
+   Image L;
+   StreamingReconstruction( L, L_orig, -1 );
+   CheckCancel();
+
+   CompressReconstruction( L );
+   NormalizeBackground( L, Percentile( L, 0.05 ) );
+   CheckCancel();
+
+   if ( preserveColor )
+      ReconstructColor( image, L_orig, L );
+   else
+      ApplyLuminance( image, L );
+
+   m_arena->Release( L );
+   m_arena->Release( L_orig );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Full-resolution execution tile by tile.
+ *
+ * OTS accumulates the source histogram over tiles and maps each one in turn.
+ * SAS runs in four passes: the noise of the first starlet scale, from a
+ * histogram of its absolute values; the compressed reconstruction of each
+ * tile with its halo, of which the interior is kept in a full plane; the
+ * background level of that plane; and background normalization and color
+ * reconstruction tile by tile.
+ */
+template <class P>
+void StretchEngine::ApplyTiled( GenericImage<P>& image, int tileSize ) const
+{
+   const int w = image.Width();
+   const int h = image.Height();
+   tileSize = Max( 64, tileSize );
+
+   if ( m_params.algorithm == ASSAlgorithm::OTS )
+   {
+      const int resolution = 65536;
+      const bool preserveColor = image.NumberOfChannels() >= 3 && m_params.otsPreserveColor;
+
+      UI64Vector hist( resolution ), tileHist( resolution );
+      for ( int i = 0; i < resolution; ++i )
+         hist[i] = 0;
+      Image L;
+      ForEachTile( w, h, tileSize,
+         [&]( const Rect& r )
+         {
+            CheckCancel();
+            ExtractLuminance( L, image, preserveColor, r );
+            ComputeHistogram( L, tileHist );
+            for ( int i = 0; i < resolution; ++i )
+               hist[i] += tileHist[i];
+         } );
+
+      FVector srcCDF( resolution );
+      HistogramToCDF( srcCDF, hist );
+      StretchCache transient;
+      const StretchCurve& curve = UpdateOTSCurve( transient, srcCDF, false );
+
+      if ( preserveColor )
+         ForEachTile( w, h, tileSize,
+            [&]( const Rect& r )
+            {
+               CheckCancel();
+               ExtractLuminance( L, image, true, r );
+               ApplyTransportColor( image, L, curve, r );
+            } );
+      else
+         ApplyLUT( image, curve.Table() );
+
+      m_arena->Release( L );
+      return;
+   }
+
+   const bool preserveColor = image.NumberOfChannels() >= 3 && m_params.sasPreserveColor;
+   const int halo = TileHalo();
+   const Rect bounds = image.Bounds();
+
+   // SAS per channel goes through the channels in turn; n = 1 otherwise.
+   const bool perChannel = SASPerChannel( image.NumberOfChannels() );
+   const int n = perChannel ? image.NumberOfNominalChannels() : 1;
+   const bool linked = perChannel && m_params.sasLinkChannels;
+   auto extract = [&]( Image& L, int c, const Rect& r )
+   {
+      if ( perChannel )
+         ExtractChannel( L, image, c, r );
+      else
+         ExtractLuminance( L, image, preserveColor, r );
+   };
+
+   // Noise: median absolute deviation of the first starlet scale, quantized
+   // to NoiseHistogramBins levels on [0,1]. The first scale needs a two-pixel
+   // halo.
+   const uint64 N = uint64( w )*uint64( h );
+   UI64Vector hist( NoiseHistogramBins ), deviations( NoiseHistogramBins );
+   Image Lt;
+   Array<Image> scales;
+   DVector sigma( n );
+   for ( int c = 0; c < n; ++c )
+   {
+      for ( int i = 0; i < NoiseHistogramBins; ++i )
+         hist[i] = deviations[i] = 0;
+      ForEachTile( w, h, tileSize,
+         [&]( const Rect& r )
+         {
+            CheckCancel();
+            const Rect rt = Rect( r.x0 - 2, r.y0 - 2, r.x1 + 2, r.y1 + 2 ).Intersection( bounds );
+            extract( Lt, c, rt );
+            StarletDecompose( Lt, scales, 1 );
+            const float* s = scales[0].PixelData();
+            const int wt = rt.Width();
+            for ( int y = r.y0; y < r.y1; ++y )
+            {
+               const float* row = s + size_type( y - rt.y0 )*wt - rt.x0;
+               for ( int x = r.x0; x < r.x1; ++x )
+                  ++hist[Min( int( Abs( row[x] )*NoiseHistogramBins ), NoiseHistogramBins-1 )];
+            }
+            m_arena->Release( scales );
+         } );
+      int median = 0;
+      for ( uint64 count = 0; (count += hist[median]) <= N/2; ++median ) {}
+      for ( int i = 0; i < NoiseHistogramBins; ++i )
+         deviations[Abs( i - median )] += hist[i];
+      int mad = 0;
+      for ( uint64 count = 0; (count += deviations[mad]) <= N/2; ++mad ) {}
+      sigma[c] = 1.4826*mad/NoiseHistogramBins;
+   }
+   if ( linked )
+   {
+      const double mean = sigma.Sum()/n;
+      for ( int c = 0; c < n; ++c )
+         sigma[c] = mean;
+   }
+
+   // Compressed reconstruction and background level of each channel, and
+   // the normalized channel (only kept until the last one for linked
+   // channels)
+   Array<Image> Lc( linked ? n : 1 );
+   DVector background( n );
+   Image Lr, Ln;
+   for ( int c = 0; c < n; ++c )
+   {
+      Image& L = Lc[linked ? c : 0];
+      m_arena->Acquire( L, w, h );
+      ForEachTile( w, h, tileSize,
+         [&]( const Rect& r )
+         {
+            CheckCancel();
+            const Rect rt = Rect( r.x0 - halo, r.y0 - halo, r.x1 + halo, r.y1 + halo ).Intersection( bounds );
+            extract( Lt, c, rt );
+            StreamingReconstruction( Lr, Lt, sigma[c] );
+            CompressReconstruction( Lr );
+            const int wt = rt.Width();
+            for ( int y = r.y0; y < r.y1; ++y )
+            {
+               const float* src = Lr.PixelData() + size_type( y - rt.y0 )*wt - rt.x0;
+               float* dst = L.PixelData() + size_type( y )*w;
+               for ( int x = r.x0; x < r.x1; ++x )
+                  dst[x] = src[x];
+            }
+         } );
+      m_arena->Release( Lr );
+
+      CheckCancel();
+      background[c] = SelectSample( L, Min( N - 1, uint64( 0.05*N ) ) );
+      if ( linked && c < n-1 )
+         continue;
+
+      // Background normalization and color
+      const int first = linked ? 0 : c;
+      const double level = linked ? background.Sum()/n : background[c];
+      for ( int k = first; k <= c; ++k )
+      {
+         Image& Lk = Lc[linked ? k : 0];
+         NormalizeBackground( Lk, level );
+         ForEachTile( w, h, tileSize,
+            [&]( const Rect& r )
+            {
+               CheckCancel();
+               m_arena->Acquire( Ln, r.Width(), r.Height() );
+               for ( int y = r.y0; y < r.y1; ++y )
+               {
+                  const float* src = Lk.PixelData() + size_type( y )*w + r.x0;
+                  float* dst = Ln.PixelData() + size_type( y - r.y0 )*r.Width();
+                  for ( int x = 0; x < r.Width(); ++x )
+                     dst[x] = src[x];
+               }
+               if ( preserveColor )
+               {
+                  ExtractLuminance( Lt, image, true, r );
+                  ReconstructColor( image, Lt, Ln, r );
+               }
+               else if ( perChannel )
+                  ApplyChannel( image, k, Ln, r );
+               else
+                  ApplyLuminance( image, Ln, r );
+            } );
+         m_arena->Release( Lk );
+      }
+   }
+
+   m_arena->Release( Ln );
+   m_arena->Release( Lt );
+}
+
+// ----------------------------------------------------------------------------
+
+size_type StretchEngine::AvailablePhysicalMemory()
+{
+#if defined( __PCL_LINUX )
+   // MemAvailable counts reclaimable page cache, unlike sysconf().
+   if ( FILE* f = std::fopen( "/proc/meminfo", "r" ) )
+   {
+      char line[ 256 ];
+      unsigned long long kiB = 0;
+      bool found = false;
+      while ( !found && std::fgets( line, sizeof( line ), f ) != nullptr )
+         found = std::sscanf( line, "MemAvailable: %llu kB", &kiB ) == 1;
+      std::fclose( f );
+      if ( found )
+         return size_type( kiB )*1024;
+   }
+   long pages = sysconf( _SC_AVPHYS_PAGES );
+   long pageSize = sysconf( _SC_PAGESIZE );
+   return (pages > 0 && pageSize > 0) ? size_type( pages )*size_type( pageSize ) : 0;
+#elif defined( __PCL_FREEBSD )
+   long pages = sysconf( _SC_AVPHYS_PAGES );
+   long pageSize = sysconf( _SC_PAGESIZE );
+   return (pages > 0 && pageSize > 0) ? size_type( pages )*size_type( pageSize ) : 0;
+#elif defined( __PCL_MACOSX )
+   vm_statistics64_data_t vm;
+   mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+   if ( host_statistics64( mach_host_self(), HOST_VM_INFO64, host_info64_t( &vm ), &count ) != KERN_SUCCESS )
+      return 0;
+   return size_type( vm.free_count + vm.inactive_count + vm.purgeable_count )*size_type( sysconf( _SC_PAGESIZE ) );
+#elif defined( __PCL_WINDOWS )
+   MEMORYSTATUSEX status;
+   status.dwLength = sizeof( status );
+   if ( !GlobalMemoryStatusEx( &status ) )
+      return 0;
+   return size_type( status.ullAvailPhys );
+#else
+   return 0;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// Automatic Tuning
+// ----------------------------------------------------------------------------
+
+Array<StretchParameters> StretchEngine::AutoTuneCandidates() const
+{
+   Array<StretchParameters> candidates;
+   candidates << m_params;
+
+   if ( m_params.algorithm == ASSAlgorithm::OTS )
+   {
+      const double targets[] = { 0.06, 0.09, 0.12, 0.15, 0.18, 0.22, 0.26 };
+      const double intensities[] = { 0.5, 0.625, 0.75, 0.875, 1.0 };
+      for ( double target : targets )
+         for ( double intensity : intensities )
+         {
+            StretchParameters p = m_params;
+            p.otsBackgroundTarget = target;
+            p.otsStretchIntensity = intensity;
+            candidates << p;
+         }
+   }
+   else
+   {
+      const double fineGains[] = { 0.5, 0.8, 1.2 };
+      const double midGains[] = { 1.5, 2.5, 3.5 };
+      const double coarseGains[] = { 2.0, 4.0, 6.0 };
+      for ( double fine : fineGains )
+         for ( double mid : midGains )
+            for ( double coarse : coarseGains )
+            {
+               StretchParameters p = m_params;
+               p.sasFineScaleGain = fine;
+               p.sasMidScaleGain = mid;
+               p.sasCoarseScaleGain = coarse;
+               candidates << p;
+            }
+   }
+
+   return candidates;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Stretches a copy of image with each parameter set and calls f( i, engine,
+ * result ) with the engine and result for sets[i]. The first set runs alone
+ * on all threads and fills the cache; the others run concurrently on copies
+ * of it, which share its images until written.
+ */
+template <class F>
+void StretchEngine::EvaluateSets( const Array<StretchParameters>& sets, const Image& image,
+                                  const StretchStatistics* stats, double reduction, StretchCache* cache, F f ) const
+{
+   const int n = int( sets.Length() );
+   if ( n == 0 )
+      return;
+
+   StretchCache transient;
+   StretchCache& C = (cache != nullptr) ? *cache : transient;
+
+   auto evaluate = [&]( int i, StretchCache& c, int threads )
+   {
+      StretchEngine engine( *this );
+      engine.m_params = sets[i];
+      engine.m_numberOfThreads = threads;
+      engine.m_progress = nullptr;
+
+      Image work( image );
+      work.EnsureUnique();
+      ImageVariant v( &work );
+      engine.Apply( v, stats, reduction, &c );
+      f( i, engine, work );
+   };
+
+   evaluate( 0, C, m_numberOfThreads );
+
+   if ( n > 1 )
+   {
+      const int threads = Max( 1, m_numberOfThreads/(n - 1) );
+      ParallelBands( n - 1, m_numberOfThreads,
+         [&]( int i0, int i1 )
+         {
+            for ( int i = i0; i < i1; ++i )
+            {
+               StretchCache copy( C );
+               evaluate( i + 1, copy, threads );
+            }
+         } );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+int StretchEngine::AutoTune( const Array<StretchParameters>& candidates, Array<StretchScore>& scores,
+                             const Image& image, const AutoTuneObjective& objective,
+                             const StretchStatistics* stats, double reduction, StretchCache* cache ) const
+{
+   const int n = int( candidates.Length() );
+   scores = Array<StretchScore>( n );
+   if ( n == 0 )
+      return -1;
+
+   // Input noise, measured as on the results
+   double inputNoise;
+   {
+      Image L;
+      ExtractLuminance( L, image, UsesLuminance( image.NumberOfChannels() ) );
+      inputNoise = FineScaleNoise( L );
+      m_arena->Release( L );
+   }
+   CheckCancel();
+
+   EvaluateSets( candidates, image, stats, reduction, cache,
+      [&]( int i, const StretchEngine& engine, Image& result )
+      {
+         scores[i] = engine.ScoreResult( result, inputNoise, objective );
+         m_arena->Release( result );
+      } );
+
+   int best = 0;
+   for ( int i = 1; i < n; ++i )
+      if ( scores[i].cost < scores[best].cost )
+         best = i;
+   return best;
+}
+
+// ----------------------------------------------------------------------------
+
+Array<StretchParameters> StretchEngine::SweepGrid( double StretchParameters::* x, const DVector& xValues,
+                                                   double StretchParameters::* y, const DVector& yValues ) const
+{
+   Array<StretchParameters> sets;
+   for ( int r = 0; r < yValues.Length(); ++r )
+      for ( int c = 0; c < xValues.Length(); ++c )
+      {
+         StretchParameters p = m_params;
+         p.*x = xValues[c];
+         p.*y = yValues[r];
+         sets << p;
+      }
+   return sets;
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchEngine::Sweep( Array<Image>& results, const Array<StretchParameters>& sets, const Image& image,
+                           const StretchStatistics* stats, double reduction, StretchCache* cache ) const
+{
+   results = Array<Image>( sets.Length() );
+   EvaluateSets( sets, image, stats, reduction, cache,
+      [&]( int i, const StretchEngine&, Image& result )
+      {
+         results[i] = result;
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+// Noise of a plane: MAD noise of its finest starlet scale.
+double StretchEngine::FineScaleNoise( const Image& L ) const
+{
+   Array<Image> scales;
+   StarletDecompose( L, scales, 1 );
+   const double sigma = EstimateNoise( scales[0] );
+   m_arena->Release( scales );
+   return sigma;
+}
+
+// ----------------------------------------------------------------------------
+
+StretchScore StretchEngine::ScoreResult( const Image& result, double inputNoise,
+                                         const AutoTuneObjective& objective ) const
+{
+   const int resolution = 65536;
+
+   Image L;
+   ExtractLuminance( L, result, UsesLuminance( result.NumberOfChannels() ) );
+   UI64Vector hist( resolution );
+   ComputeHistogram( L, hist );
+   const size_type N = L.NumberOfPixels();
+
+   StretchScore score;
+   score.background = HistogramPercentile( hist, 0.5 );
+   score.noiseGain = (inputNoise > 0) ? FineScaleNoise( L )/inputNoise : 1.0;
+   score.clipped = (N > 0) ? double( hist[0] + hist[resolution-1] )/N : 0.0;
+   score.cost = Abs( score.background - objective.background )/Max( objective.background, 1.0e-3 )
+              + objective.noiseWeight*Log2( Max( 1.0, score.noiseGain ) )
+              + objective.clippingWeight*score.clipped;
+
+   m_arena->Release( L );
+   return score;
+}
+
+// ----------------------------------------------------------------------------
+// Luminance and Color
+// ----------------------------------------------------------------------------
+
+template <class P>
+void StretchEngine::ExtractLuminance( Image& L, const GenericImage<P>& image, bool useLuminance,
+                                      const Rect& rect ) const
+{
+   typedef typename P::sample sample;
+
+   const Rect r = rect.IsRect() ? rect.Intersection( image.Bounds() ) : image.Bounds();
+   const int W = image.Width();
+   const int w = r.Width();
+   const int h = r.Height();
+
+   m_arena->Acquire( L, w, h );
+   float* l = L.PixelData();
+
+   const size_type origin = size_type( r.y0 )*W + r.x0;
+   const sample* R = image.PixelData( 0 ) + origin;
+   const sample* G = useLuminance ? image.PixelData( 1 ) + origin : nullptr;
+   const sample* B = useLuminance ? image.PixelData( 2 ) + origin : nullptr;
+
+   ParallelBands( h, m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+         {
+            float* row = l + size_type( y )*w;
+            const size_type j = size_type( y )*W;
+            if ( useLuminance )
+            {
+               // CIE luminance
+               for ( int x = 0; x < w; ++x )
+                  row[x] = float( 0.2126*P::ToDouble( R[j+x] ) + 0.7152*P::ToDouble( G[j+x] ) + 0.0722*P::ToDouble( B[j+x] ) );
+            }
+            else
+            {
+               // First channel or grayscale
+               for ( int x = 0; x < w; ++x )
+                  row[x] = P::ToFloat( R[j+x] );
+            }
+         }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+template <class P>
+void StretchEngine::ReconstructColor( GenericImage<P>& image, const Image& L_orig, const Image& L,
+                                      const Rect& rect ) const
+{
+   typedef typename P::sample sample;
+
+   const Rect r = rect.IsRect() ? rect.Intersection( image.Bounds() ) : image.Bounds();
+   const int W = image.Width();
+   const int w = r.Width();
+   const int h = r.Height();
+   const int nc = image.NumberOfChannels();
+
+   Array<sample*> channels;
+   for ( int c = 0; c < nc; ++c )
+      channels.Add( image.PixelData( c ) + size_type( r.y0 )*W + r.x0 );
+
+   const float* lo = L_orig.PixelData();
+   const float* ln = L.PixelData();
+
+   ParallelBands( h, m_numberOfThreads,
+      [=, &channels]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+         {
+            const size_type i0 = size_type( y )*w;
+            const size_type j0 = size_type( y )*W;
+            for ( int x = 0; x < w; ++x )
+            {
+               double origLum = lo[i0+x];
+               if ( origLum > 1e-10 )
+               {
+                  double s = ln[i0+x] / origLum;
+                  for ( int c = 0; c < nc; ++c )
+                     channels[c][j0+x] = P::ToSample( Range( P::ToDouble( channels[c][j0+x] ) * s, 0.0, 1.0 ) );
+               }
+            }
+         }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+template <class P>
+void StretchEngine::ApplyLuminance( GenericImage<P>& image, const Image& L, const Rect& rect ) const
+{
+   typedef typename P::sample sample;
+
+   const Rect r = rect.IsRect() ? rect.Intersection( image.Bounds() ) : image.Bounds();
+   const int W = image.Width();
+   const int w = r.Width();
+   const int h = r.Height();
+   const int nc = image.NumberOfChannels();
+
+   Array<sample*> channels;
+   for ( int c = 0; c < nc; ++c )
+      channels.Add( image.PixelData( c ) + size_type( r.y0 )*W + r.x0 );
+
+   const float* l = L.PixelData();
+
+   ParallelBands( h, m_numberOfThreads,
+      [=, &channels]( int y0, int y1 )
+      {
+         for ( int c = 0; c < nc; ++c )
+            for ( int y = y0; y < y1; ++y )
+            {
+               const float* row = l + size_type( y )*w;
+               sample* out = channels[c] + size_type( y )*W;
+               for ( int x = 0; x < w; ++x )
+                  out[x] = P::ToSample( row[x] );
+            }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+template <class P>
+void StretchEngine::ExtractChannel( Image& L, const GenericImage<P>& image, int channel, const Rect& rect ) const
+{
+   typedef typename P::sample sample;
+
+   const Rect r = rect.IsRect() ? rect.Intersection( image.Bounds() ) : image.Bounds();
+   const int W = image.Width();
+   const int w = r.Width();
+   const int h = r.Height();
+
+   m_arena->Acquire( L, w, h );
+   float* l = L.PixelData();
+   const sample* s = image.PixelData( channel ) + size_type( r.y0 )*W + r.x0;
+
+   ParallelBands( h, m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+         {
+            float* row = l + size_type( y )*w;
+            const sample* in = s + size_type( y )*W;
+            for ( int x = 0; x < w; ++x )
+               row[x] = P::ToFloat( in[x] );
+         }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+template <class P>
+void StretchEngine::ApplyChannel( GenericImage<P>& image, int channel, const Image& L, const Rect& rect ) const
+{
+   typedef typename P::sample sample;
+
+   const Rect r = rect.IsRect() ? rect.Intersection( image.Bounds() ) : image.Bounds();
+   const int W = image.Width();
+   const int w = r.Width();
+   const int h = r.Height();
+
+   sample* s = image.PixelData( channel ) + size_type( r.y0 )*W + r.x0;
+   const float* l = L.PixelData();
+
+   ParallelBands( h, m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+         {
+            const float* row = l + size_type( y )*w;
+            sample* out = s + size_type( y )*W;
+            for ( int x = 0; x < w; ++x )
+               out[x] = P::ToSample( row[x] );
+         }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+// OTS Implementation
+// ----------------------------------------------------------------------------
+
+template <class P>
+void StretchEngine::ApplyOTS( GenericImage<P>& image, const StretchStatistics* stats, StretchCache* cache ) const
+{
+   const int resolution = 65536;
+
+   bool preserveColor = image.NumberOfChannels() >= 3 && m_params.otsPreserveColor;
+
+   StretchCache transient;
+   StretchCache& C = (cache != nullptr) ? *cache : transient;
+
+   // Extract luminance, or use the first channel
+   UpdateLuminance( C, image, preserveColor );
+   const Image& L = C.m_L;
+   CheckCancel();
+
+   // Source CDF: from the full-resolution statistics for previews, otherwise
+   // from the histogram of this image.
+   const bool useStats = stats != nullptr && stats->IsValid() && stats->luminance == preserveColor
+                      && stats->srcCDF.Length() == resolution;
+   if ( !useStats && C.m_srcCDF.IsEmpty() )
+   {
+      C.m_srcCDF = FVector( resolution );
+      ComputeHistogramCDF( L, C.m_srcCDF );
+   }
+   const FVector& srcCDF = useStats ? stats->srcCDF : C.m_srcCDF;
+
+   // Optimal transport map to the target CDF of the object type, shaped by
+   // highlight protection and stretch intensity
+   const StretchCurve& curve = UpdateOTSCurve( C, srcCDF, useStats );
+   CheckCancel();
+
+   if ( preserveColor )
+   {
+      // Map luminance and rescale color channels by the luminance ratio
+      ApplyTransportColor( image, L, curve );
+   }
+   else
+   {
+      // Apply the curve to every channel
+      ApplyLUT( image, curve.Table() );
+   }
+
+   if ( cache == nullptr )
+      m_arena->Release( C.m_L );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Multiplies the color channels of each pixel by the ratio of its mapped to
+ * its original luminance L. If rect is not empty, L covers that region of
+ * the image only.
+ */
+template <class P>
+void StretchEngine::ApplyTransportColor( GenericImage<P>& image, const Image& L, const StretchCurve& curve,
+                                         const Rect& rect ) const
+{
+   typedef typename P::sample sample;
+
+   const Rect r = rect.IsRect() ? rect.Intersection( image.Bounds() ) : image.Bounds();
+   const int W = image.Width();
+   const int w = r.Width();
+   const int h = r.Height();
+   const int nc = image.NumberOfChannels();
+
+   Array<sample*> channels;
+   for ( int c = 0; c < nc; ++c )
+      channels.Add( image.PixelData( c ) + size_type( r.y0 )*W + r.x0 );
+   const float* l = L.PixelData();
+
+   ParallelBands( h, m_numberOfThreads,
+      [=, &channels, &curve]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+         {
+            const size_type i0 = size_type( y )*w;
+            const size_type j0 = size_type( y )*W;
+            for ( int x = 0; x < w; ++x )
+            {
+               double origLum = l[i0+x];
+               if ( origLum > 1e-10 )
+               {
+                  double scale = curve( origLum ) / origLum;
+                  for ( int c = 0; c < nc; ++c )
+                     channels[c][j0+x] = P::ToSample( Range( P::ToDouble( channels[c][j0+x] ) * scale, 0.0, 1.0 ) );
+               }
+            }
+         }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Composes the point-wise OTS stages into one curve: the transport map,
+ * highlight protection (a blend toward the identity above 0.7) and stretch
+ * intensity (a blend of the result with the identity).
+ */
+void StretchEngine::CompileOTSCurve( StretchCurve& curve, const FVector& transportMap ) const
+{
+   const int n = transportMap.Length();
+   const double protection = m_params.otsProtectHighlights;
+   const double intensity = m_params.otsStretchIntensity;
+
+   FVector lut( n );
+   for ( int i = 0; i < n; ++i )
+   {
+      double x = double( i ) / ( n - 1 );
+      float y = transportMap[i];
+      if ( protection > 0 )
+      {
+         double t = ( x - 0.7 ) / 0.25;
+         t = Max( 0.0, Min( 1.0, t ) );
+         double blend = t * t * ( 3 - 2 * t ) * protection;
+         y = ( 1 - blend ) * y + blend * x;
+      }
+      lut[i] = ( 1 - intensity ) * x + intensity * y;
+   }
+   curve = StretchCurve( lut );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * The count of input bin i goes to the output bin of lut(i/(n-1)). This is
+ * exact for a LUT applied as ApplyLUT does when the input histogram has as
+ * many bins as the LUT has entries.
+ */
+void StretchEngine::TransformHistogram( UI64Vector& output, const UI64Vector& input, const FVector& lut )
+{
+   const int n = input.Length();
+   const int m = lut.Length();
+   const int k = output.Length();
+
+   for ( int i = 0; i < k; ++i )
+      output[i] = 0;
+
+   for ( int i = 0; i < n; ++i )
+      if ( input[i] != 0 )
+      {
+         float y = lut[(n == m) ? i : Range( RoundInt( double( i )/(n - 1) * (m - 1) ), 0, m - 1 )];
+         output[Range( RoundInt( y * ( k - 1 ) ), 0, k - 1 )] += input[i];
+      }
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchEngine::GenerateTargetCDF( FVector& cdf, int objectType, double bgTarget )
+{
+   const int n = cdf.Length();
+   FVector pdf( n );
+
+   for ( int i = 0; i < n; ++i )
+   {
+      double x = double( i ) / ( n - 1 );
+
+      switch ( objectType )
+      {
+      case ASSOTSObjectType::Nebula:
+         // Background peak
+         pdf[i] = 0.3 * Exp( -0.5 * Pow( ( x - bgTarget ) / 0.03, 2 ) );
+         // Nebula body
+         if ( x >= bgTarget && x <= 0.7 )
+            pdf[i] += 0.5 * Pow( x - bgTarget, 1.0 ) * Pow( 0.7 - x, 2.0 );
+         // Highlights
+         if ( x >= 0.6 && x <= 0.95 )
+            pdf[i] += 0.2 * Pow( x - 0.6, 0.5 ) * Pow( 0.95 - x, 3.0 );
+         break;
+
+      case ASSOTSObjectType::Galaxy:
+         pdf[i] = 0.25 * Exp( -0.5 * Pow( ( x - bgTarget ) / 0.025, 2 ) );
+         if ( x >= bgTarget && x <= 0.5 )
+            pdf[i] += 0.35 * Pow( x - bgTarget, 1.5 ) * Pow( 0.5 - x, 1.5 );
+         if ( x >= 0.4 && x <= 0.75 )
+            pdf[i] += 0.25 * Pow( x - 0.4, 2.0 ) * Pow( 0.75 - x, 1.0 );
+         if ( x >= 0.7 && x <= 0.9 )
+            pdf[i] += 0.15;
+         break;
+
+      case ASSOTSObjectType::StarCluster:
+         pdf[i] = 0.20 * Exp( -0.5 * Pow( ( x - bgTarget * 0.8 ) / 0.02, 2 ) );
+         if ( x >= 0.15 && x <= 0.70 )
+            pdf[i] += 0.50 * Pow( x - 0.15, 0.5 ) * Pow( 0.70 - x, 1.0 );
+         if ( x >= 0.60 && x <= 0.95 )
+            pdf[i] += 0.30 * Pow( x - 0.60, 1.0 ) * Pow( 0.95 - x, 4.0 );
+         break;
+
+      case ASSOTSObjectType::DarkNebula:
+         pdf[i] = 0.15 * Exp( -0.5 * Pow( ( x - bgTarget * 1.3 ) / 0.04, 2 ) );
+         if ( x >= 0.05 && x <= bgTarget )
+            pdf[i] += 0.40 * Pow( x - 0.05, 2.0 ) * Pow( bgTarget - x, 1.0 );
+         if ( x >= bgTarget && x <= 0.55 )
+            pdf[i] += 0.30 * Pow( x - bgTarget, 1.0 ) * Pow( 0.55 - x, 1.5 );
+         if ( x >= 0.5 && x <= 0.85 )
+            pdf[i] += 0.15;
+         break;
+
+      default:
+         pdf[i] = 1.0;
+      }
+   }
+
+   // Normalize PDF and compute CDF
+   double sum = 0;
+   for ( int i = 0; i < n; ++i )
+      sum += pdf[i];
+   if ( sum > 0 )
+      for ( int i = 0; i < n; ++i )
+         pdf[i] /= sum;
+
+   cdf[0] = pdf[0];
+   for ( int i = 1; i < n; ++i )
+      cdf[i] = cdf[i-1] + pdf[i];
+
+   // Ensure ends are 0 and 1
+   if ( cdf[n-1] > 0 )
+      for ( int i = 0; i < n; ++i )
+         cdf[i] /= cdf[n-1];
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchEngine::ComputeHistogram( const Image& image, UI64Vector& hist ) const
+{
+   ComputeHistogram( image, 0, hist );
+}
+
+// ----------------------------------------------------------------------------
+
+template <class P>
+void StretchEngine::ComputeHistogram( const GenericImage<P>& image, int channel, UI64Vector& hist ) const
+{
+   typedef typename P::sample sample;
+
+   const int n = hist.Length();
+   const int w = image.Width();
+   const int h = image.Height();
+   const sample* v = image.PixelData( channel );
+
+   // One integer histogram per band, merged afterwards
+   const int numberOfBands = Max( 1, Min( m_numberOfThreads, h ) );
+   Array<uint64> bandHist( size_type( n )*numberOfBands, uint64( 0 ) );
+   uint64* H = bandHist.Begin();
+
+   ParallelBands( numberOfBands, numberOfBands,
+      [=]( int b0, int b1 )
+      {
+         for ( int b = b0; b < b1; ++b )
+         {
+            int y0, y1;
+            BandRows( b, numberOfBands, h, y0, y1 );
+            uint64* bh = H + size_type( b )*n;
+            for ( size_type i = size_type( y0 )*w, end = size_type( y1 )*w; i < end; ++i )
+               ++bh[Range( RoundInt( P::ToFloat( v[i] ) * ( n - 1 ) ), 0, n - 1 )];
+         }
+      } );
+
+   for ( int i = 0; i < n; ++i )
+   {
+      uint64 count = 0;
+      for ( int b = 0; b < numberOfBands; ++b )
+         count += H[size_type( b )*n + i];
+      hist[i] = count;
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchEngine::ComputeHistograms( Array<UI64Vector>& hists, const ImageVariant& image, int bins ) const
+{
+   hists.Clear();
+
+   if ( image.IsComplexSample() || bins < 2 )
+      return;
+
+   const int nc = (image.NumberOfNominalChannels() >= 3) ? 3 : 1;
+   for ( int c = 0; c < nc; ++c )
+   {
+      UI64Vector hist( bins );
+      if ( image.IsFloatSample() )
+         switch ( image.BitsPerSample() )
+         {
+         case 32: ComputeHistogram( static_cast<const Image&>( *image ), c, hist ); break;
+         case 64: ComputeHistogram( static_cast<const DImage&>( *image ), c, hist ); break;
+         }
+      else
+         switch ( image.BitsPerSample() )
+         {
+         case  8: ComputeHistogram( static_cast<const UInt8Image&>( *image ), c, hist ); break;
+         case 16: ComputeHistogram( static_cast<const UInt16Image&>( *image ), c, hist ); break;
+         case 32: ComputeHistogram( static_cast<const UInt32Image&>( *image ), c, hist ); break;
+         }
+      hists.Add( hist );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+bool StretchEngine::PredictHistogram( UI64Vector& hist, const StretchStatistics* stats, StretchCache& cache ) const
+{
+   const int resolution = 65536;
+
+   StretchCache& C = cache;
+   if ( !C.m_hasL || hist.Length() < 2 || C.m_luminance != UsesLuminance( C.m_numberOfChannels )
+     || SASPerChannel( C.m_numberOfChannels ) )
+      return false;
+
+   if ( C.m_LHistogram.IsEmpty() )
+   {
+      C.m_LHistogram = UI64Vector( resolution );
+      ComputeHistogram( C.m_L, C.m_LHistogram );
+   }
+
+   const bool useStats = stats != nullptr && stats->IsValid() && stats->luminance == C.m_luminance;
+
+   if ( m_params.algorithm == ASSAlgorithm::OTS )
+   {
+      // The curve applied to the luminance, as ApplyOTS does
+      const bool useSrcStats = useStats && stats->srcCDF.Length() == resolution;
+      if ( !useSrcStats && C.m_srcCDF.IsEmpty() )
+      {
+         C.m_srcCDF = FVector( resolution );
+         HistogramToCDF( C.m_srcCDF, C.m_LHistogram );
+      }
+      UpdateOTSCurve( C, useSrcStats ? stats->srcCDF : C.m_srcCDF, useSrcStats ).TransformHistogram( hist, C.m_LHistogram );
+      return true;
+   }
+
+   // SAS: only compression and normalization follow the reconstruction.
+   if ( !C.m_hasReconstruction || C.m_reconstruction.IsEmpty() || C.m_numScales != m_params.sasNumScales
+     || !SameReconstructionParameters( C.m_reconstructionParams )
+     || C.m_reconstructionNoise != (useStats ? stats->noiseSigma : C.m_noiseSigma) )
+      return false;
+
+   // The reconstruction is binned finer than the output: arctangent
+   // compression is steep near the background.
+   const int reconstructionResolution = 1 << 20;
+   if ( C.m_reconstructionHistogram.IsEmpty() )
+   {
+      C.m_reconstructionHistogram = UI64Vector( reconstructionResolution );
+      ComputeRangeHistogram( C.m_reconstruction, C.m_reconstructionHistogram,
+                             C.m_reconstructionMin, C.m_reconstructionMax );
+   }
+
+   // Background rank as in ApplySAS, from the luminance histogram if it has
+   // not been measured yet.
+   double backgroundRank = 0.05;
+   if ( useStats && C.m_backgroundLevel == stats->backgroundLevel )
+      backgroundRank = C.m_backgroundRank;
+   else if ( useStats )
+   {
+      uint64 below = 0, total = 0;
+      for ( int i = 0; i < resolution; ++i )
+      {
+         if ( double( i )/(resolution - 1) <= stats->backgroundLevel )
+            below += C.m_LHistogram[i];
+         total += C.m_LHistogram[i];
+      }
+      backgroundRank = (total > 0) ? double( below )/total : 0.05;
+   }
+
+   // Compression is monotonic, so the background level of the compressed
+   // reconstruction is that of the reconstruction, compressed.
+   const double lo = C.m_reconstructionMin;
+   const double hi = C.m_reconstructionMax;
+   FVector lut( reconstructionResolution );
+   SASTransferFunction( lut, lo + HistogramPercentile( C.m_reconstructionHistogram, backgroundRank )*(hi - lo), lo, hi );
+   TransformHistogram( hist, C.m_reconstructionHistogram, lut );
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchEngine::HistogramToCDF( FVector& cdf, const UI64Vector& hist )
+{
+   const int n = cdf.Length();
+
+   double sum = 0;
+   for ( int i = 0; i < n; ++i )
+      sum += hist[i];
+   if ( sum == 0 )
+      sum = 1;
+
+   double acc = 0;
+   for ( int i = 0; i < n; ++i )
+   {
+      acc += hist[i];
+      cdf[i] = acc / sum;
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+double StretchEngine::CDFPercentile( const FVector& cdf, double p )
+{
+   const int n = cdf.Length();
+   int lo = 0, hi = n - 1;
+   while ( lo < hi )
+   {
+      int mid = ( lo + hi ) / 2;
+      if ( cdf[mid] < p )
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return double( lo ) / ( n - 1 );
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchEngine::ComputeHistogramCDF( const Image& image, FVector& cdf ) const
+{
+   UI64Vector hist( cdf.Length() );
+   ComputeHistogram( image, hist );
+   HistogramToCDF( cdf, hist );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Histogram of a plane over its own range [lo,hi], which is returned: bin i
+ * counts the samples that round to lo + i*(hi - lo)/(n-1). Unlike
+ * ComputeHistogram(), samples outside [0,1] are not clipped.
+ */
+void StretchEngine::ComputeRangeHistogram( const Image& image, UI64Vector& hist, double& lo, double& hi ) const
+{
+   const int n = hist.Length();
+   const int w = image.Width();
+   const int h = image.Height();
+   const float* v = image.PixelData();
+
+   const int numberOfBands = Max( 1, Min( m_numberOfThreads, h ) );
+   Array<float> bandMin( numberOfBands, 0.0f ), bandMax( numberOfBands, 0.0f );
+   float* m0 = bandMin.Begin();
+   float* m1 = bandMax.Begin();
+   ParallelBands( numberOfBands, numberOfBands,
+      [=]( int b0, int b1 )
+      {
+         for ( int b = b0; b < b1; ++b )
+         {
+            int y0, y1;
+            BandRows( b, numberOfBands, h, y0, y1 );
+            float a = v[0], z = v[0];
+            for ( size_type i = size_type( y0 )*w, end = size_type( y1 )*w; i < end; ++i )
+            {
+               a = Min( a, v[i] );
+               z = Max( z, v[i] );
+            }
+            m0[b] = a;
+            m1[b] = z;
+         }
+      } );
+   lo = m0[0];
+   hi = m1[0];
+   for ( int b = 1; b < numberOfBands; ++b )
+   {
+      lo = Min( lo, double( m0[b] ) );
+      hi = Max( hi, double( m1[b] ) );
+   }
+
+   const double scale = (hi > lo) ? (n - 1)/(hi - lo) : 0.0;
+   const double origin = lo;
+   Array<uint64> bandHist( size_type( n )*numberOfBands, uint64( 0 ) );
+   uint64* H = bandHist.Begin();
+   ParallelBands( numberOfBands, numberOfBands,
+      [=]( int b0, int b1 )
+      {
+         for ( int b = b0; b < b1; ++b )
+         {
+            int y0, y1;
+            BandRows( b, numberOfBands, h, y0, y1 );
+            uint64* bh = H + size_type( b )*n;
+            for ( size_type i = size_type( y0 )*w, end = size_type( y1 )*w; i < end; ++i )
+               ++bh[Range( RoundInt( (v[i] - origin)*scale ), 0, n - 1 )];
+         }
+      } );
+
+   for ( int i = 0; i < n; ++i )
+   {
+      uint64 count = 0;
+      for ( int b = 0; b < numberOfBands; ++b )
+         count += H[size_type( b )*n + i];
+      hist[i] = count;
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchEngine::ComputeTransportMap( FVector& tmap, const FVector& srcCDF, const FVector& tgtCDF )
+{
+   const int n = tmap.Length();
+
+   for ( int i = 0; i < n; ++i )
+   {
+      double quantile = srcCDF[i];
+
+      // Binary search for inverse CDF
+      int lo = 0, hi = n - 1;
+      while ( lo < hi )
+      {
+         int mid = ( lo + hi ) / 2;
+         if ( tgtCDF[mid] < quantile )
+            lo = mid + 1;
+         else
+            hi = mid;
+      }
+
+      tmap[i] = double( lo ) / ( n - 1 );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+template <class P>
+void StretchEngine::ApplyLUT( GenericImage<P>& image, const FVector& lut ) const
+{
+   typedef typename P::sample sample;
+
+   const int w = image.Width();
+   const int h = image.Height();
+   const int n = lut.Length();
+   const float* map = lut.Begin();
+
+   for ( int c = 0; c < image.NumberOfChannels(); ++c )
+   {
+      sample* v = image.PixelData( c );
+      ParallelBands( h, m_numberOfThreads,
+         [=]( int y0, int y1 )
+         {
+            for ( int y = y0; y < y1; ++y )
+               for ( size_type i = size_type( y )*w, end = i + w; i < end; ++i )
+                  v[i] = P::ToSample( map[Range( RoundInt( P::ToDouble( v[i] ) * ( n - 1 ) ), 0, n - 1 )] );
+         } );
+   }
+}
+
+// ----------------------------------------------------------------------------
+// SAS Implementation
+// ----------------------------------------------------------------------------
+
+// Arctangent compression of the values above the background target.
+static inline double SASCompress( double x, double bgTarget, double alpha )
+{
+   if ( x > bgTarget )
+   {
+      double normalized = ( x - bgTarget ) / ( 1.0 - bgTarget );
+      double compressed = ( 2.0 / Pi() ) * ArcTan( alpha * normalized );
+      return bgTarget + compressed * ( 1.0 - bgTarget );
+   }
+   return x;
+}
+
+// Moves the current background level to the target; scale = target/current.
+static inline double SASNormalize( double v, double currentBg, double bgTarget, double scale )
+{
+   if ( v <= currentBg )
+      return v * scale;
+   return bgTarget + ( v - currentBg ) / ( 1.0 - currentBg ) * ( 1.0 - bgTarget );
+}
+
+template <class P>
+void StretchEngine::ApplySAS( GenericImage<P>& image, const StretchStatistics* stats, double reduction,
+                              StretchCache* cache ) const
+{
+   if ( SASPerChannel( image.NumberOfChannels() ) )
+   {
+      ApplySASChannels( image, stats, reduction, cache );
+      return;
+   }
+
+   bool preserveColor = image.NumberOfChannels() >= 3 && m_params.sasPreserveColor;
+   const bool useStats = stats != nullptr && stats->IsValid() && stats->luminance == preserveColor;
+
+   // On a reduced image, scales finer than one pixel are not represented.
+   reduction = Max( 1.0, reduction );
+
+   StretchCache transient;
+   StretchCache& C = (cache != nullptr) ? *cache : transient;
+
+   // Extract luminance, or use the first channel
+   UpdateLuminance( C, image, preserveColor );
+   const Image& L_orig = C.m_L;
+   CheckCancel();
+
+   // Starlet decomposition and noise estimate from the finest scale
+   SASDecomposition( C, reduction );
+   const double sigma_noise = useStats ? stats->noiseSigma : SASNoiseEstimate( C, reduction );
+
+   Image L;
+   SASCompressedReconstruction( L, C, sigma_noise, reduction, cache != nullptr );
+
+   // Normalize background. For previews, the reference is the rank that the
+   // full-resolution 5% level has in this image, which compensates for the
+   // noise averaged out by downsampling. Tiles are given the level.
+   double background;
+   if ( useStats && stats->sasBackground.Length() == 1 )
+      background = stats->sasBackground[0];
+   else
+      background = Percentile( L, useStats ? SASBackgroundRank( C, stats->backgroundLevel ) : 0.05 );
+   NormalizeBackground( L, background );
+   C.m_sasBackground = DVector( background, 1 );
+
+   CheckCancel();
+
+   // Reconstruct color
+   if ( preserveColor )
+      ReconstructColor( image, L_orig, L );
+   else
+      ApplyLuminance( image, L );
+
+   m_arena->Release( L );
+   if ( cache == nullptr )
+      m_arena->Release( C.m_L );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * SAS on each nominal channel of a color image, in three stages separated by
+ * the statistics that linked channels share: decomposition and noise,
+ * compressed reconstruction and background level, and normalization. The
+ * channels of a stage run concurrently on engines with a share of the
+ * threads; their caches are kept in cache->m_channels.
+ */
+template <class P>
+void StretchEngine::ApplySASChannels( GenericImage<P>& image, const StretchStatistics* stats, double reduction,
+                                      StretchCache* cache ) const
+{
+   const int n = image.NumberOfNominalChannels();
+   const bool useStats = stats != nullptr && stats->IsValid() && !stats->luminance
+                      && stats->channelNoiseSigma.Length() == n && stats->channelBackgroundLevel.Length() == n;
+   reduction = Max( 1.0, reduction );
+
+   Array<StretchCache> transient;
+   Array<StretchCache>& caches = (cache != nullptr) ? cache->m_channels : transient;
+   if ( caches.Length() != size_type( n ) )
+   {
+      caches.Clear();
+      for ( int c = 0; c < n; ++c )
+         caches.Add( StretchCache() );
+   }
+   if ( cache != nullptr )
+      cache->m_numberOfChannels = image.NumberOfChannels();
+
+   StretchEngine engine( *this );
+   engine.m_numberOfThreads = Max( 1, m_numberOfThreads/n );
+
+   // Means of the channel statistics, for linked channels
+   auto link = [=]( DVector& v )
+   {
+      if ( m_params.sasLinkChannels )
+      {
+         double mean = v.Sum()/n;
+         for ( int c = 0; c < n; ++c )
+            v[c] = mean;
+      }
+   };
+
+   DVector sigma( n );
+   ParallelBands( n, m_numberOfThreads,
+      [&]( int c0, int c1 )
+      {
+         for ( int c = c0; c < c1; ++c )
+         {
+            engine.UpdateChannel( caches[c], image, c );
+            engine.CheckCancel();
+            engine.SASDecomposition( caches[c], reduction );
+            sigma[c] = useStats ? stats->channelNoiseSigma[c] : engine.SASNoiseEstimate( caches[c], reduction );
+         }
+      } );
+   link( sigma );
+
+   Array<Image> L( n );
+   const bool fixedBackground = useStats && stats->sasBackground.Length() == n;
+   DVector background = fixedBackground ? stats->sasBackground : DVector( n );
+   ParallelBands( n, m_numberOfThreads,
+      [&]( int c0, int c1 )
+      {
+         for ( int c = c0; c < c1; ++c )
+         {
+            engine.SASCompressedReconstruction( L[c], caches[c], sigma[c], reduction, cache != nullptr );
+            if ( !fixedBackground )
+            {
+               const double rank = useStats ? engine.SASBackgroundRank( caches[c], stats->channelBackgroundLevel[c] ) : 0.05;
+               background[c] = engine.Percentile( L[c], rank );
+            }
+         }
+      } );
+   if ( !fixedBackground )
+      link( background );
+   if ( cache != nullptr )
+      cache->m_sasBackground = background;
+   CheckCancel();
+
+   ParallelBands( n, m_numberOfThreads,
+      [&]( int c0, int c1 )
+      {
+         for ( int c = c0; c < c1; ++c )
+         {
+            engine.NormalizeBackground( L[c], background[c] );
+            engine.ApplyChannel( image, c, L[c] );
+            m_arena->Release( L[c] );
+            if ( cache == nullptr )
+               m_arena->Release( caches[c].m_L );
+         }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+// Starlet decomposition of cache.m_L, unless cached.
+void StretchEngine::SASDecomposition( StretchCache& cache, double reduction ) const
+{
+   StretchCache& C = cache;
+   if ( C.m_numScales != m_params.sasNumScales || C.m_reduction != reduction || C.m_scaleStorage != m_scaleStorage )
+   {
+      C.m_numScales = -1;
+      C.m_hasReconstruction = false;
+      StarletDecompose( C.m_L, C.m_scales, m_params.sasNumScales, reduction, &C.m_halfScales );
+      C.m_numScales = m_params.sasNumScales;
+      C.m_scaleStorage = m_scaleStorage;
+      C.m_reduction = reduction;
+      C.m_noiseSigma = -1;
+      C.m_hasReconstruction = false;
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+// Noise of the decomposition in cache, from its finest scale.
+double StretchEngine::SASNoiseEstimate( StretchCache& cache, double reduction ) const
+{
+   if ( cache.m_noiseSigma < 0 )
+   {
+      const int numScales = Max( 0, m_params.sasNumScales - FirstStarletScale( reduction ) );
+      cache.m_noiseSigma = (numScales > 0) ? EstimateNoise( cache.m_scales[0] ) : 0.0;
+   }
+   return cache.m_noiseSigma;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Reconstruction of the decomposition in cache with the scale gains, and its
+ * arctangent compression in L. If keep is false, cache is transient and
+ * gives up its planes.
+ */
+void StretchEngine::SASCompressedReconstruction( Image& L, StretchCache& cache, double sigmaNoise, double reduction,
+                                                 bool keep ) const
+{
+   StretchCache& C = cache;
+   const int w = C.m_L.Width();
+   const int h = C.m_L.Height();
+
+   // scales[k] is full-resolution scale k + firstScale.
+   const int firstScale = FirstStarletScale( reduction );
+   const int numScales = Max( 0, m_params.sasNumScales - firstScale );
+
+   // Process each scale and accumulate the reconstruction. The cached scales
+   // are left untouched, so that only this and the following stages depend
+   // on the gain, threshold and flattening parameters.
+   if ( !C.m_hasReconstruction || !SameReconstructionParameters( C.m_reconstructionParams )
+     || C.m_reconstructionNoise != sigmaNoise )
+   {
+      C.m_hasReconstruction = false;
+
+      m_arena->Acquire( C.m_reconstruction, w, h );
+      ZeroPlane( C.m_reconstruction );
+
+      for ( int k = 0; k < numScales; ++k )
+      {
+         CheckCancel();
+         const int j = k + firstScale;
+         const Image* ls = nullptr;
+         if ( m_params.sasHighlightProtection > 0 )
+            ls = &SmoothedLuminance( C, HighlightSigma( j, reduction ), keep );
+         if ( !C.m_halfScales[k].IsEmpty() )
+            AccumulateScale( C.m_reconstruction, C.m_halfScales[k], j, sigmaNoise, ls );
+         else
+            AccumulateScale( C.m_reconstruction, C.m_scales[k], j, sigmaNoise, ls );
+      }
+
+      AccumulateResidual( C.m_reconstruction, C.m_scales[numScales] );
+
+      C.m_hasReconstruction = true;
+      C.m_reconstructionParams = m_params;
+      C.m_reconstructionNoise = sigmaNoise;
+      C.m_reconstructionHistogram = UI64Vector();
+   }
+
+   // Compression and normalization work on a copy of the reconstruction if it
+   // is to be kept; a transient one is taken over along with its memory.
+   if ( !keep )
+   {
+      L = C.m_reconstruction;
+      C.m_reconstruction = Image();
+      m_arena->Release( C.m_scales );
+      C.m_halfScales.Clear();
+      m_arena->Release( C.m_smooth );
+   }
+   else
+   {
+      m_arena->Acquire( L, w, h );
+      CopyPlane( L, C.m_reconstruction );
+   }
+
+   CheckCancel();
+
+   CompressReconstruction( L );
+}
+
+// ----------------------------------------------------------------------------
+
+// Rank of a full-resolution background level in cache.m_L.
+double StretchEngine::SASBackgroundRank( StretchCache& cache, double backgroundLevel ) const
+{
+   StretchCache& C = cache;
+   if ( C.m_backgroundLevel == backgroundLevel )
+      return C.m_backgroundRank;
+
+   const int w = C.m_L.Width();
+   const int h = C.m_L.Height();
+   const float level = float( backgroundLevel );
+   const float* lo = C.m_L.PixelData();
+   const int numberOfBands = Max( 1, Min( m_numberOfThreads, h ) );
+   Array<size_type> counts( numberOfBands, size_type( 0 ) );
+   size_type* bandCounts = counts.Begin();
+   ParallelBands( numberOfBands, numberOfBands,
+      [=]( int b0, int b1 )
+      {
+         for ( int b = b0; b < b1; ++b )
+         {
+            int y0, y1;
+            BandRows( b, numberOfBands, h, y0, y1 );
+            size_type n = 0;
+            for ( size_type i = size_type( y0 )*w, end = size_type( y1 )*w; i < end; ++i )
+               if ( lo[i] <= level )
+                  ++n;
+            bandCounts[b] = n;
+         }
+      } );
+   size_type below = 0;
+   for ( size_type n : counts )
+      below += n;
+   C.m_backgroundLevel = backgroundLevel;
+   C.m_backgroundRank = double( below )/C.m_L.NumberOfPixels();
+   return C.m_backgroundRank;
+}
+
+// ----------------------------------------------------------------------------
+
+// Blur of the luminance that modulates the gain of scale j.
+double StretchEngine::HighlightSigma( int j, double reduction )
+{
+   return Min( Pow2( double( j + 1 ) ), 16.0 )/Max( 1.0, reduction );
+}
+
+// ----------------------------------------------------------------------------
+
+// Accumulation of n coefficients of a scale into o, for AccumulateScale().
+static inline void AccumulateCoefficients( float* o, const float* s, const float* l, size_type n,
+                                           float gain, bool denoise, float threshold, double protection )
+{
+   if ( l != nullptr )
+   {
+      for ( size_type i = 0; i < n; ++i )
+      {
+         float c = s[i];
+         if ( denoise )
+            c = (Abs( c ) <= threshold) ? 0.0f : ((c > 0) ? (c - threshold) : (c + threshold));
+         double sigmoid = 1.0 / ( 1.0 + Exp( -8.0 * ( l[i] - 0.5 ) ) );
+         double mod = Max( 1.0 - protection * sigmoid, 0.2 );
+         c *= float( gain * mod );
+         o[i] += c;
+      }
+   }
+   else
+   {
+      for ( size_type i = 0; i < n; ++i )
+      {
+         float c = s[i];
+         if ( denoise )
+            c = (Abs( c ) <= threshold) ? 0.0f : ((c > 0) ? (c - threshold) : (c + threshold));
+         c *= gain;
+         o[i] += c;
+      }
+   }
+}
+
+/*
+ * Adds full-resolution starlet scale j, soft-thresholded if it is a fine
+ * scale and multiplied by its gain, to the reconstruction out. ls is the
+ * blurred luminance that modulates the gain for highlight protection, or
+ * nullptr if protection is disabled.
+ */
+void StretchEngine::AccumulateScale( Image& out, const Image& scale, int j, double sigmaNoise, const Image* ls ) const
+{
+   const int w = out.Width();
+   const float gain = float( ComputeScaleGain( j ) );
+   const float* s = scale.PixelData();
+   const float* l = (ls != nullptr) ? ls->PixelData() : nullptr;
+   const double protection = m_params.sasHighlightProtection;
+   float* o = out.PixelData();
+
+   // Noise thresholding for fine scales
+   const bool denoise = j <= 1;
+   const float threshold = float( m_params.sasNoiseThreshold * sigmaNoise * 5 );
+
+   ParallelBands( out.Height(), m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+         {
+            const size_type i = size_type( y )*w;
+            AccumulateCoefficients( o + i, s + i, (l != nullptr) ? l + i : nullptr, w,
+                                    gain, denoise, threshold, protection );
+         }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+// As above for a scale stored as half floats, converted row by row.
+void StretchEngine::AccumulateScale( Image& out, const HalfPlane& scale, int j, double sigmaNoise, const Image* ls ) const
+{
+   const int w = out.Width();
+   const float gain = float( ComputeScaleGain( j ) );
+   const uint16* s = scale.Data();
+   const float* l = (ls != nullptr) ? ls->PixelData() : nullptr;
+   const double protection = m_params.sasHighlightProtection;
+   float* o = out.PixelData();
+
+   const bool denoise = j <= 1;
+   const float threshold = float( m_params.sasNoiseThreshold * sigmaNoise * 5 );
+
+   ParallelBands( out.Height(), m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         Array<float> row( w );
+         for ( int y = y0; y < y1; ++y )
+         {
+            const size_type i = size_type( y )*w;
+            HalfPlane::ToFloat( row.Begin(), s + i, w );
+            AccumulateCoefficients( o + i, row.Begin(), (l != nullptr) ? l + i : nullptr, w,
+                                    gain, denoise, threshold, protection );
+         }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+// Adds the coarsest (residual) scale to the reconstruction out.
+void StretchEngine::AccumulateResidual( Image& out, const Image& residual ) const
+{
+   const int w = out.Width();
+   const bool flatten = m_params.sasFlattenBackground;
+   const float coarseTarget = float( m_params.sasBackgroundTarget * 0.5 );
+   const float* s = residual.PixelData();
+   float* o = out.PixelData();
+   ParallelBands( out.Height(), m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+            for ( size_type i = size_type( y )*w, end = i + w; i < end; ++i )
+            {
+               float c = s[i];
+               if ( flatten )
+                  c = 0.2f * c + 0.8f * coarseTarget;
+               o[i] += c;
+            }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+// Arctangent compression of a reconstruction above the background target.
+void StretchEngine::CompressReconstruction( Image& L ) const
+{
+   const int w = L.Width();
+   const double bgTarget = m_params.sasBackgroundTarget;
+   const double alpha = m_params.sasCompressionAlpha;
+   float* l = L.PixelData();
+   ParallelBands( L.Height(), m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+            for ( size_type i = size_type( y )*w, end = i + w; i < end; ++i )
+               if ( l[i] > bgTarget )
+                  l[i] = float( SASCompress( l[i], bgTarget, alpha ) );
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+// Moves the background level currentBg of a compressed reconstruction to
+// the target and clips the result to [0,1].
+void StretchEngine::NormalizeBackground( Image& L, double currentBg ) const
+{
+   const int w = L.Width();
+   const double bgTarget = m_params.sasBackgroundTarget;
+   const bool normalize = currentBg > 0 && currentBg != bgTarget;
+   const double scale = normalize ? bgTarget / currentBg : 1.0;
+   float* l = L.PixelData();
+   ParallelBands( L.Height(), m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+            for ( size_type i = size_type( y )*w, end = i + w; i < end; ++i )
+            {
+               double v = l[i];
+               if ( normalize )
+                  v = SASNormalize( v, currentBg, bgTarget, scale );
+               l[i] = float( Range( v, 0.0, 1.0 ) );
+            }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+int StretchEngine::FirstStarletScale( double reduction )
+{
+   int j = 0;
+   while ( Pow2( double( j ) ) < reduction - 1.0e-6 )
+      ++j;
+   return j;
+}
+
+// ----------------------------------------------------------------------------
+
+int StretchEngine::StarletSpacing( int scale, double reduction )
+{
+   return Max( 1, RoundInt( Pow2( double( scale ) )/Max( 1.0, reduction ) ) );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Starlet scales of image, finest first, followed by the residual. If
+ * halfScales is not null, detail scales that the scale storage policy keeps
+ * as half floats are stored there at the same index, as soon as they are
+ * computed, and left empty in scales.
+ */
+void StretchEngine::StarletDecompose( const Image& image, Array<Image>& scales, int numScales, double reduction,
+                                      Array<HalfPlane>* halfScales ) const
+{
+   m_arena->Release( scales );
+   if ( halfScales != nullptr )
+      halfScales->Clear();
+
+   const int w = image.Width();
+   const int h = image.Height();
+
+   // current is the input image until the first smoothed plane replaces it.
+   Image current( image );
+   Image temp;
+   m_arena->Acquire( temp, w, h );
+
+   // Full-resolution scales finer than a reduced pixel are skipped.
+   for ( int j = FirstStarletScale( reduction ); j < numScales; ++j )
+   {
+      CheckCancel();
+
+      // Separable convolution with spacing (à trous)
+      const int spacing = StarletSpacing( j, reduction );
+      Image smooth, wavelet;
+      m_arena->Acquire( smooth, w, h );
+      m_arena->Acquire( wavelet, w, h );
+      AtrousHorizontal( current, temp, spacing );
+      AtrousVertical( temp, current, smooth, wavelet, spacing );
+
+      if ( halfScales != nullptr )
+      {
+         halfScales->Add( HalfPlane() );
+         if ( m_scaleStorage == ScaleStorage::Float16 && j >= 2 )
+         {
+            (*halfScales)[halfScales->Length()-1].Encode( wavelet, m_numberOfThreads );
+            m_arena->Release( wavelet );
+         }
+      }
+
+      scales.Add( wavelet );
+      m_arena->Release( current );
+      current = smooth;
+   }
+
+   scales.Add( current ); // Residual
+   m_arena->Release( temp );
+}
+
+// ----------------------------------------------------------------------------
+
+// B3-spline kernel [1,4,6,4,1]/16
+static const float s_b3[] = { 1.0f/16, 4.0f/16, 6.0f/16, 4.0f/16, 1.0f/16 };
+
+void StretchEngine::AtrousHorizontal( const Image& input, Image& output, int spacing ) const
+{
+   const int w = input.Width();
+   const int h = input.Height();
+   const float* c = input.PixelData();
+   float* t = output.PixelData();
+
+   ParallelBands( h, m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+         {
+            const float* row = c + size_type( y )*w;
+            float* out = t + size_type( y )*w;
+            for ( int x = 0; x < w; ++x )
+            {
+               float sum = 0;
+               for ( int k = -2; k <= 2; ++k )
+                  sum += s_b3[k+2] * row[Range( x + k*spacing, 0, w - 1 )];
+               out[x] = sum;
+            }
+         }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchEngine::AtrousVertical( const Image& temp, const Image& current,
+                                    Image& smooth, Image& wavelet, int spacing ) const
+{
+   const int w = temp.Width();
+   const int h = temp.Height();
+   const float* t = temp.PixelData();
+   const float* c = current.PixelData();
+   float* s = smooth.PixelData();
+   float* d = wavelet.PixelData();
+
+   // Vertical pass, fused with the wavelet difference
+   ParallelBands( h, m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+         {
+            const float* rows[ 5 ];
+            for ( int k = -2; k <= 2; ++k )
+               rows[k+2] = t + size_type( Range( y + k*spacing, 0, h - 1 ) )*w;
+            const float* in = c + size_type( y )*w;
+            float* out = s + size_type( y )*w;
+            float* dif = d + size_type( y )*w;
+            for ( int x = 0; x < w; ++x )
+            {
+               float sum = s_b3[0]*rows[0][x] + s_b3[1]*rows[1][x] + s_b3[2]*rows[2][x] + s_b3[3]*rows[3][x] + s_b3[4]*rows[4][x];
+               out[x] = sum;
+               dif[x] = in[x] - sum;
+            }
+         }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchEngine::StarletReconstruct( Image& output, const Array<Image>& scales ) const
+{
+   const int w = output.Width();
+   const int h = output.Height();
+
+   Array<const float*> layers;
+   for ( const Image& scale : scales )
+      layers.Add( scale.PixelData() );
+
+   float* out = output.PixelData();
+
+   ParallelBands( h, m_numberOfThreads,
+      [=, &layers]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+         {
+            size_type i0 = size_type( y )*w;
+            size_type i1 = i0 + w;
+            for ( size_type i = i0; i < i1; ++i )
+               out[i] = 0;
+            for ( const float* layer : layers )
+               for ( size_type i = i0; i < i1; ++i )
+                  out[i] += layer[i];
+         }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Full-resolution SAS reconstruction of the luminance L into output, with
+ * each starlet scale accumulated as soon as it is computed. The result is
+ * the same as that of the whole decomposition. If sigmaNoise is negative,
+ * it is measured on the first scale. Returns the noise estimate used.
+ */
+double StretchEngine::StreamingReconstruction( Image& output, const Image& L, double sigmaNoise ) const
+{
+   const int w = L.Width();
+   const int h = L.Height();
+   const int numScales = m_params.sasNumScales;
+
+   m_arena->Acquire( output, w, h );
+   ZeroPlane( output );
+
+   Image current( L );
+   Image blur;
+   double blurSigma = 0;
+   for ( int j = 0; j < numScales; ++j )
+   {
+      CheckCancel();
+
+      const int spacing = StarletSpacing( j, 1 );
+      Image temp, smooth, wavelet;
+      m_arena->Acquire( temp, w, h );
+      m_arena->Acquire( smooth, w, h );
+      m_arena->Acquire( wavelet, w, h );
+      AtrousHorizontal( current, temp, spacing );
+      AtrousVertical( temp, current, smooth, wavelet, spacing );
+      m_arena->Release( temp );
+      m_arena->Release( current );
+      current = smooth;
+      smooth = Image();
+
+      if ( sigmaNoise < 0 )
+         sigmaNoise = EstimateNoise( wavelet );
+
+      // The blur is the same for all scales beyond the third.
+      if ( m_params.sasHighlightProtection > 0 && HighlightSigma( j, 1 ) != blurSigma )
+      {
+         blurSigma = HighlightSigma( j, 1 );
+         m_arena->Acquire( blur, w, h );
+         CopyPlane( blur, L );
+         GaussianSmooth( blur, blurSigma );
+      }
+
+      AccumulateScale( output, wavelet, j, sigmaNoise, blur.IsEmpty() ? nullptr : &blur );
+      m_arena->Release( wavelet );
+   }
+
+   AccumulateResidual( output, current );
+   m_arena->Release( current );
+   m_arena->Release( blur );
+   return Max( 0.0, sigmaNoise );
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchEngine::SoftThreshold( Image& layer, float threshold ) const
+{
+   const int w = layer.Width();
+   float* s = layer.PixelData();
+
+   ParallelBands( layer.Height(), m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+            for ( size_type i = size_type( y )*w, end = i + w; i < end; ++i )
+            {
+               float c = s[i];
+               if ( Abs( c ) <= threshold )
+                  s[i] = 0;
+               else
+                  s[i] = ( c > 0 ) ? ( c - threshold ) : ( c + threshold );
+            }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * The k-th smallest of the N values value( i ), 0 <= i < N. Each pass
+ * histograms the values within [lo,hi] and narrows the range to the bin
+ * holding rank k, until the bin is small enough to be sorted.
+ *
+ * Values are split into contiguous chunks processed in parallel. Chunks only
+ * produce integer bin counts, extremes and the values of the selected bin,
+ * which are merged in chunk order, so the result is exact and does not
+ * depend on the number of threads.
+ */
+template <class F>
+double StretchEngine::SelectRank( size_type N, size_type k, F value ) const
+{
+   const int bins = 65536;
+   const size_type maxSorted = size_type( 1 ) << 20;
+   if ( N == 0 )
+      return 0;
+
+   // At least a few values per bin and chunk, or the histograms cost more
+   // than they save.
+   const int chunks = int( Max( size_type( 1 ), Min( size_type( m_numberOfThreads ), N/(4*bins) ) ) );
+   auto chunkBegin = [=]( int c ) { return N*c/chunks; };
+
+   Array<float> chunkLo( chunks ), chunkHi( chunks );
+   ParallelBands( chunks, chunks,
+      [&]( int c0, int c1 )
+      {
+         for ( int c = c0; c < c1; ++c )
+         {
+            float lo = value( chunkBegin( c ) ), hi = lo;
+            for ( size_type i = chunkBegin( c ) + 1, end = chunkBegin( c+1 ); i < end; ++i )
+            {
+               const float x = value( i );
+               if ( x < lo )
+                  lo = x;
+               else if ( x > hi )
+                  hi = x;
+            }
+            chunkLo[c] = lo;
+            chunkHi[c] = hi;
+         }
+      } );
+   float lo = chunkLo[0], hi = chunkHi[0];
+   for ( int c = 1; c < chunks; ++c )
+   {
+      lo = Min( lo, chunkLo[c] );
+      hi = Max( hi, chunkHi[c] );
+   }
+
+   Array<size_type> hist( size_type( chunks )*bins ); // bins of chunk c at c*bins
+   size_type below = 0; // values smaller than lo
+   for ( ;; )
+   {
+      if ( lo == hi )
+         return lo;
+
+      const double scale = bins/(double( hi ) - lo);
+      auto inBin = [=]( float x, int& b )
+      {
+         if ( x < lo || x > hi )
+            return false;
+         b = Min( int( (x - lo)*scale ), bins-1 );
+         return true;
+      };
+
+      ParallelBands( chunks, chunks,
+         [&]( int c0, int c1 )
+         {
+            for ( int c = c0; c < c1; ++c )
+            {
+               size_type* h = hist.Begin() + size_type( c )*bins;
+               for ( int b = 0; b < bins; ++b )
+                  h[b] = 0;
+               int b;
+               for ( size_type i = chunkBegin( c ), end = chunkBegin( c+1 ); i < end; ++i )
+                  if ( inBin( value( i ), b ) )
+                     ++h[b];
+            }
+         } );
+
+      int b = 0;
+      size_type count;
+      for ( ;; ++b )
+      {
+         count = 0;
+         for ( int c = 0; c < chunks; ++c )
+            count += hist[size_type( c )*bins + b];
+         if ( below + count > k )
+            break;
+         below += count;
+      }
+
+      if ( count <= maxSorted )
+      {
+         // Each chunk copies its values of bin b to its own part of the
+         // buffer.
+         Array<size_type> offset( chunks );
+         offset[0] = 0;
+         for ( int c = 1; c < chunks; ++c )
+            offset[c] = offset[c-1] + hist[size_type( c-1 )*bins + b];
+         ScratchBuffer samples( *m_arena, count );
+         float* s = samples.Begin();
+         ParallelBands( chunks, chunks,
+            [&]( int c0, int c1 )
+            {
+               for ( int c = c0; c < c1; ++c )
+               {
+                  size_type n = offset[c];
+                  int bx;
+                  for ( size_type i = chunkBegin( c ), end = chunkBegin( c+1 ); i < end; ++i )
+                  {
+                     const float x = value( i );
+                     if ( inBin( x, bx ) && bx == b )
+                        s[n++] = x;
+                  }
+               }
+            } );
+         Sort( s, s + count );
+         return s[k - below];
+      }
+
+      // Values of lower bins are below those of bin b, and those of higher
+      // bins above them.
+      ParallelBands( chunks, chunks,
+         [&]( int c0, int c1 )
+         {
+            for ( int c = c0; c < c1; ++c )
+            {
+               float blo = hi, bhi = lo;
+               int bx;
+               for ( size_type i = chunkBegin( c ), end = chunkBegin( c+1 ); i < end; ++i )
+               {
+                  const float x = value( i );
+                  if ( inBin( x, bx ) && bx == b )
+                  {
+                     blo = Min( blo, x );
+                     bhi = Max( bhi, x );
+                  }
+               }
+               chunkLo[c] = blo;
+               chunkHi[c] = bhi;
+            }
+         } );
+      lo = chunkLo[0];
+      hi = chunkHi[0];
+      for ( int c = 1; c < chunks; ++c )
+      {
+         lo = Min( lo, chunkLo[c] );
+         hi = Max( hi, chunkHi[c] );
+      }
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+double StretchEngine::EstimateNoise( const Image& fineScale ) const
+{
+   const float* v = fineScale.PixelData();
+   const size_type N = fineScale.NumberOfPixels();
+   const float median = float( SelectRank( N, N/2, [=]( size_type i ) { return Abs( v[i] ); } ) );
+   const double mad = SelectRank( N, N/2, [=]( size_type i ) { return Abs( Abs( v[i] ) - median ); } );
+   return mad * 1.4826;
+}
+
+// ----------------------------------------------------------------------------
+
+double StretchEngine::Percentile( const Image& image, double p ) const
+{
+   const size_type N = image.NumberOfPixels();
+   return SelectSample( image, Min( N - 1, size_type( p * N ) ) );
+}
+
+// ----------------------------------------------------------------------------
+
+// The k-th smallest pixel of a plane.
+double StretchEngine::SelectSample( const Image& image, size_type k ) const
+{
+   const float* v = image.PixelData();
+   return SelectRank( image.NumberOfPixels(), k, [=]( size_type i ) { return v[i]; } );
+}
+
+// ----------------------------------------------------------------------------
+
+// Percentile as Percentile() defines it, at the resolution of a histogram.
+double StretchEngine::HistogramPercentile( const UI64Vector& hist, double p )
+{
+   const int n = hist.Length();
+   uint64 N = 0;
+   for ( int i = 0; i < n; ++i )
+      N += hist[i];
+   if ( N == 0 )
+      return 0;
+
+   const uint64 rank = Min( N - 1, uint64( p * N ) );
+   uint64 count = 0;
+   for ( int i = 0; i < n; ++i )
+      if ( (count += hist[i]) > rank )
+         return double( i ) / ( n - 1 );
+   return 1;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Compression and background normalization of ApplySAS as a function of the
+ * reconstruction on [lo,hi] (entry i for lo + i*(hi - lo)/(n-1)), for the
+ * background level of the reconstruction before compression.
+ */
+void StretchEngine::SASTransferFunction( FVector& lut, double currentBackground, double lo, double hi ) const
+{
+   const int n = lut.Length();
+   const double bgTarget = m_params.sasBackgroundTarget;
+   const double alpha = m_params.sasCompressionAlpha;
+   const double currentBg = SASCompress( currentBackground, bgTarget, alpha );
+   const bool normalize = currentBg > 0 && currentBg != bgTarget;
+   const double scale = normalize ? bgTarget / currentBg : 1.0;
+
+   float* f = lut.Begin();
+   ParallelBands( n, m_numberOfThreads,
+      [=]( int i0, int i1 )
+      {
+         for ( int i = i0; i < i1; ++i )
+         {
+            double v = SASCompress( lo + (hi - lo)*i/(n - 1), bgTarget, alpha );
+            if ( normalize )
+               v = SASNormalize( v, currentBg, bgTarget, scale );
+            f[i] = float( Range( v, 0.0, 1.0 ) );
+         }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+double StretchEngine::ComputeScaleGain( int j ) const
+{
+   if ( j <= 1 )
+      return m_params.sasFineScaleGain;
+   else if ( j <= 3 )
+   {
+      double t = ( j - 1.5 ) / 2.0;
+      return ( 1 - t ) * m_params.sasFineScaleGain + t * m_params.sasMidScaleGain;
+   }
+   else if ( j <= 5 )
+   {
+      double t = ( j - 3.5 ) / 2.0;
+      return ( 1 - t ) * m_params.sasMidScaleGain + t * m_params.sasCoarseScaleGain;
+   }
+   return m_params.sasCoarseScaleGain;
+}
+
+// ----------------------------------------------------------------------------
+
+void StretchEngine::GaussianSmooth( Image& image, double sigma ) const
+{
+   const int w = image.Width();
+   const int h = image.Height();
+
+   // Normalized 1-D Gaussian truncated at 3 sigma
+   const int radius = Max( 1, int( Ceil( 3 * sigma ) ) );
+   Array<float> kernel( 2*radius + 1 );
+   double sum = 0;
+   for ( int k = -radius; k <= radius; ++k )
+      sum += kernel[k+radius] = float( Exp( -0.5 * k*k / (sigma*sigma) ) );
+   for ( float& k : kernel )
+      k = float( k/sum );
+   const float* g = kernel.Begin();
+
+   Image temp;
+   m_arena->Acquire( temp, w, h );
+   float* v = image.PixelData();
+   float* t = temp.PixelData();
+
+   // Horizontal
+   ParallelBands( h, m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+         {
+            const float* row = v + size_type( y )*w;
+            float* out = t + size_type( y )*w;
+            for ( int x = 0; x < w; ++x )
+            {
+               float acc = 0;
+               for ( int k = -radius; k <= radius; ++k )
+                  acc += g[k+radius] * row[Range( x + k, 0, w - 1 )];
+               out[x] = acc;
+            }
+         }
+      } );
+
+   // Vertical
+   ParallelBands( h, m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( int y = y0; y < y1; ++y )
+         {
+            float* out = v + size_type( y )*w;
+            for ( int x = 0; x < w; ++x )
+               out[x] = 0;
+            for ( int k = -radius; k <= radius; ++k )
+            {
+               const float* row = t + size_type( Range( y + k, 0, h - 1 ) )*w;
+               const float gk = g[k+radius];
+               for ( int x = 0; x < w; ++x )
+                  out[x] += gk * row[x];
+            }
+         }
+      } );
+
+   m_arena->Release( temp );
+}
+
+// ----------------------------------------------------------------------------
+
+// Sets all pixels of a plane to zero.
+void StretchEngine::ZeroPlane( Image& plane ) const
+{
+   const int w = plane.Width();
+   float* p = plane.PixelData();
+   ParallelBands( plane.Height(), m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( size_type i = size_type( y0 )*w, end = size_type( y1 )*w; i < end; ++i )
+            p[i] = 0;
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+// Copies the pixels of a plane into another one of the same size.
+void StretchEngine::CopyPlane( Image& dst, const Image& src ) const
+{
+   const int w = src.Width();
+   const float* s = src.PixelData();
+   float* d = dst.PixelData();
+   ParallelBands( src.Height(), m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( size_type i = size_type( y0 )*w, end = size_type( y1 )*w; i < end; ++i )
+            d[i] = s[i];
+      } );
+}
+
+// ----------------------------------------------------------------------------
+// Explicit instantiations
+// ----------------------------------------------------------------------------
+
+template void StretchEngine::ApplyOTS( Image&, const StretchStatistics*, StretchCache* ) const;
+template void StretchEngine::ApplyOTS( DImage&, const StretchStatistics*, StretchCache* ) const;
+template void StretchEngine::ApplyOTS( UInt8Image&, const StretchStatistics*, StretchCache* ) const;
+template void StretchEngine::ApplyOTS( UInt16Image&, const StretchStatistics*, StretchCache* ) const;
+template void StretchEngine::ApplyOTS( UInt32Image&, const StretchStatistics*, StretchCache* ) const;
+
+template void StretchEngine::ApplySAS( Image&, const StretchStatistics*, double, StretchCache* ) const;
+template void StretchEngine::ApplySAS( DImage&, const StretchStatistics*, double, StretchCache* ) const;
+template void StretchEngine::ApplySAS( UInt8Image&, const StretchStatistics*, double, StretchCache* ) const;
+template void StretchEngine::ApplySAS( UInt16Image&, const StretchStatistics*, double, StretchCache* ) const;
+template void StretchEngine::ApplySAS( UInt32Image&, const StretchStatistics*, double, StretchCache* ) const;
+
+template void StretchEngine::ApplySASStreaming( Image& ) const;
+template void StretchEngine::ApplySASStreaming( DImage& ) const;
+template void StretchEngine::ApplySASStreaming( UInt8Image& ) const;
+template void StretchEngine::ApplySASStreaming( UInt16Image& ) const;
+template void StretchEngine::ApplySASStreaming( UInt32Image& ) const;
+
+template void StretchEngine::ApplyTiled( Image&, int ) const;
+template void StretchEngine::ApplyTiled( DImage&, int ) const;
+template void StretchEngine::ApplyTiled( UInt8Image&, int ) const;
+template void StretchEngine::ApplyTiled( UInt16Image&, int ) const;
+template void StretchEngine::ApplyTiled( UInt32Image&, int ) const;
+
+template void StretchEngine::ComputeStatistics( StretchStatistics&, const Image& ) const;
+template void StretchEngine::ComputeStatistics( StretchStatistics&, const DImage& ) const;
+template void StretchEngine::ComputeStatistics( StretchStatistics&, const UInt8Image& ) const;
+template void StretchEngine::ComputeStatistics( StretchStatistics&, const UInt16Image& ) const;
+template void StretchEngine::ComputeStatistics( StretchStatistics&, const UInt32Image& ) const;
+
+template void StretchEngine::ExtractLuminance( Image&, const Image&, bool, const Rect& ) const;
+template void StretchEngine::ExtractLuminance( Image&, const DImage&, bool, const Rect& ) const;
+template void StretchEngine::ExtractLuminance( Image&, const UInt8Image&, bool, const Rect& ) const;
+template void StretchEngine::ExtractLuminance( Image&, const UInt16Image&, bool, const Rect& ) const;
+template void StretchEngine::ExtractLuminance( Image&, const UInt32Image&, bool, const Rect& ) const;
+
+template void StretchEngine::ExtractChannel( Image&, const Image&, int, const Rect& ) const;
+template void StretchEngine::ExtractChannel( Image&, const DImage&, int, const Rect& ) const;
+template void StretchEngine::ExtractChannel( Image&, const UInt8Image&, int, const Rect& ) const;
+template void StretchEngine::ExtractChannel( Image&, const UInt16Image&, int, const Rect& ) const;
+template void StretchEngine::ExtractChannel( Image&, const UInt32Image&, int, const Rect& ) const;
+
+template void StretchEngine::ApplyChannel( Image&, int, const Image&, const Rect& ) const;
+template void StretchEngine::ApplyChannel( DImage&, int, const Image&, const Rect& ) const;
+template void StretchEngine::ApplyChannel( UInt8Image&, int, const Image&, const Rect& ) const;
+template void StretchEngine::ApplyChannel( UInt16Image&, int, const Image&, const Rect& ) const;
+template void StretchEngine::ApplyChannel( UInt32Image&, int, const Image&, const Rect& ) const;
+
+template void StretchEngine::ReconstructColor( Image&, const Image&, const Image&, const Rect& ) const;
+template void StretchEngine::ReconstructColor( DImage&, const Image&, const Image&, const Rect& ) const;
+template void StretchEngine::ReconstructColor( UInt8Image&, const Image&, const Image&, const Rect& ) const;
+template void StretchEngine::ReconstructColor( UInt16Image&, const Image&, const Image&, const Rect& ) const;
+template void StretchEngine::ReconstructColor( UInt32Image&, const Image&, const Image&, const Rect& ) const;
+
+template void StretchEngine::ApplyLUT( Image&, const FVector& ) const;
+template void StretchEngine::ApplyLUT( DImage&, const FVector& ) const;
+template void StretchEngine::ApplyLUT( UInt8Image&, const FVector& ) const;
+template void StretchEngine::ApplyLUT( UInt16Image&, const FVector& ) const;
+template void StretchEngine::ApplyLUT( UInt32Image&, const FVector& ) const;
+
+template void StretchEngine::ComputeHistogram( const Image&, int, UI64Vector& ) const;
+template void StretchEngine::ComputeHistogram( const DImage&, int, UI64Vector& ) const;
+template void StretchEngine::ComputeHistogram( const UInt8Image&, int, UI64Vector& ) const;
+template void StretchEngine::ComputeHistogram( const UInt16Image&, int, UI64Vector& ) const;
+template void StretchEngine::ComputeHistogram( const UInt32Image&, int, UI64Vector& ) const;
+
+// ----------------------------------------------------------------------------
+
+} // namespace pcl
+
+// ----------------------------------------------------------------------------
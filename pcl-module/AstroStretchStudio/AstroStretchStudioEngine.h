@@ -0,0 +1,831 @@
+// ----------------------------------------------------------------------------
+// AstroStretchStudio Engine Header
+// ----------------------------------------------------------------------------
+
+#ifndef __AstroStretchStudioEngine_h
+#define __AstroStretchStudioEngine_h
+
+#include <pcl/Array.h>
+#include <pcl/Exception.h>
+#include <pcl/Image.h>
+#include <pcl/ImageVariant.h>
+#include <pcl/Rectangle.h>
+#include <pcl/Vector.h>
+
+#include "AstroStretchStudioParameters.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace pcl
+{
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Plain copy of the process parameters. The defaults must match those of the
+ * corresponding MetaParameter classes.
+ */
+struct StretchParameters
+{
+   pcl_enum algorithm = ASSAlgorithm::Default;
+
+   // OTS Parameters
+   pcl_enum otsObjectType = ASSOTSObjectType::Default;
+   double   otsBackgroundTarget = 0.15;
+   double   otsStretchIntensity = 0.75;
+   double   otsProtectHighlights = 0.3;
+   bool     otsPreserveColor = true;
+
+   // SAS Parameters
+   int      sasNumScales = 6;
+   double   sasBackgroundTarget = 0.12;
+   double   sasFineScaleGain = 0.8;
+   double   sasMidScaleGain = 2.5;
+   double   sasCoarseScaleGain = 4.0;
+   double   sasCompressionAlpha = 8.0;
+   double   sasHighlightProtection = 0.5;
+   double   sasNoiseThreshold = 0.001;
+   bool     sasFlattenBackground = true;
+   bool     sasPreserveColor = true;
+   bool     sasLinkChannels = true; // unlinked color: shared noise and background
+};
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Full-resolution image statistics. A preview run on a downsampled rendition
+ * of the same image reuses them instead of measuring the proxy, so that the
+ * preview matches the full-size result.
+ */
+struct StretchStatistics
+{
+   FVector srcCDF;               // CDF of the luminance (or first channel)
+   double  noiseSigma = 0;       // MAD noise of the first starlet scale
+   double  backgroundLevel = 0;  // 5th percentile of the luminance
+   bool    luminance = false;    // computed from CIE luminance
+
+   // Noise and background level of each nominal channel of a color image,
+   // if not computed from luminance
+   DVector channelNoiseSigma;
+   DVector channelBackgroundLevel;
+
+   // SAS background level of the compressed reconstruction (one value, or
+   // one per nominal channel) to normalize to, instead of measuring it on
+   // the image. Unlike the above, it depends on the parameters: tiles of an
+   // image take it from a preview of the whole image (see
+   // StretchCache::SASBackground()), so that they match at the seams.
+   DVector sasBackground;
+
+   bool    valid = false;
+
+   bool IsValid() const
+   {
+      return valid;
+   }
+
+   void Invalidate()
+   {
+      valid = false;
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Reusable memory for the engine's temporaries: float images (luminance,
+ * starlet planes, blurs, working copies) and sample buffers aligned to
+ * Alignment bytes (sorting and selection). Released memory stays pooled
+ * across executions, so repeated runs on images of the same size, such as
+ * previews, allocate nothing once the pool is warm. Beyond maxBytes of
+ * pooled memory, the least recently released items are freed.
+ *
+ * Images are pooled by geometry and handed over by reference count: an
+ * image is only pooled if it is the sole reference to its pixel data, so
+ * images shared with a caller or a StretchCache are never recycled.
+ *
+ * The arena is thread-safe (one mutex guards the pool) and may be used from
+ * scheduler tasks. Most kernels only draw memory on their calling thread,
+ * but the per-channel SAS engines and the concurrent evaluations of
+ * AutoTune() and Sweep() acquire and release arena memory inside tasks.
+ */
+class ScratchArena
+{
+public:
+
+   enum { Alignment = 64 };
+
+   ScratchArena( size_type maxBytes = size_type( 1024 )*1024*1024 );
+
+   ~ScratchArena();
+
+   ScratchArena( const ScratchArena& ) = delete;
+   ScratchArena& operator =( const ScratchArena& ) = delete;
+
+   // The arena shared by all engines that have not been given one.
+   static ScratchArena& Default();
+
+   /*
+    * Makes image a width x height image with the given number of channels
+    * (RGB if three or more), reusing pooled pixel data if possible. Sample
+    * values are undefined. An image that already has this geometry and
+    * owns its data is left as it is; otherwise its data are released first.
+    */
+   void Acquire( Image& image, int width, int height, int numberOfChannels = 1 );
+
+   // Returns the pixel data of image to the pool; image is left empty.
+   void Release( Image& image );
+   void Release( Array<Image>& images );
+
+   // Buffer of at least count floats. Prefer ScratchBuffer.
+   float* AcquireBuffer( size_type count );
+   void ReleaseBuffer( float* data );
+
+   size_type MaxBytes() const;
+   void SetMaxBytes( size_type maxBytes );
+
+   // Memory currently held in the pool, i.e. not acquired.
+   size_type PooledBytes() const;
+
+   // Number of images and buffers allocated since construction, as opposed
+   // to taken from the pool.
+   size_type Allocations() const;
+
+   // Frees all pooled memory.
+   void Clear();
+
+private:
+
+   struct PooledImage
+   {
+      Image  image;
+      uint64 released;
+   };
+
+   struct Buffer
+   {
+      float*    data;
+      size_type count;
+      uint64    released;
+   };
+
+   mutable std::mutex m_mutex;
+   Array<PooledImage> m_images;
+   Array<Buffer>      m_buffers;  // pooled
+   Array<Buffer>      m_acquired; // in use
+   size_type          m_maxBytes;
+   size_type          m_bytes = 0;
+   size_type          m_allocations = 0;
+   uint64             m_releaseCount = 0;
+
+   void Trim();
+   static float* AllocateBuffer( size_type count );
+   static void FreeBuffer( float* data );
+};
+
+/*
+ * Buffer of floats taken from a scratch arena for the lifetime of the
+ * object.
+ */
+class ScratchBuffer
+{
+public:
+
+   ScratchBuffer( ScratchArena& arena, size_type count )
+      : m_arena( arena )
+      , m_data( arena.AcquireBuffer( count ) )
+      , m_count( count )
+   {
+   }
+
+   ~ScratchBuffer()
+   {
+      m_arena.ReleaseBuffer( m_data );
+   }
+
+   ScratchBuffer( const ScratchBuffer& ) = delete;
+   ScratchBuffer& operator =( const ScratchBuffer& ) = delete;
+
+   float* Begin() const
+   {
+      return m_data;
+   }
+
+   float* End() const
+   {
+      return m_data + m_count;
+   }
+
+   size_type Length() const
+   {
+      return m_count;
+   }
+
+   float& operator []( size_type i ) const
+   {
+      return m_data[i];
+   }
+
+private:
+
+   ScratchArena& m_arena;
+   float*        m_data;
+   size_type     m_count;
+};
+
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+
+namespace ScaleStorage
+{
+   enum value_type
+   {
+      Float32, // every starlet scale as 32-bit floats
+      Float16  // scales 2 and up as IEEE half floats; finer ones and the residual as floats
+   };
+}
+
+/*
+ * Starlet scale stored as IEEE 754 half floats (round to nearest even) and
+ * converted back to floats as it is read. Conversions use F16C instructions
+ * where the build enables them, and an equivalent scalar code otherwise.
+ *
+ * A stored coefficient w differs from its float value by at most
+ * 2^-11 |w| when |w| >= 2^-14, and by at most 2^-25 below (half subnormals).
+ * A reconstruction with gains g_j therefore errs by at most the sum of
+ * g_j (2^-11 |w_j| + 2^-25) over the scales stored as half floats.
+ */
+class HalfPlane
+{
+public:
+
+   HalfPlane() = default;
+
+   void Encode( const Image& plane, int numberOfThreads );
+   void Decode( Image& plane, int numberOfThreads ) const;
+
+   void Clear()
+   {
+      m_data.Clear();
+      m_width = m_height = 0;
+   }
+
+   bool IsEmpty() const
+   {
+      return m_data.IsEmpty();
+   }
+
+   int Width() const
+   {
+      return m_width;
+   }
+
+   int Height() const
+   {
+      return m_height;
+   }
+
+   const uint16* Data() const
+   {
+      return m_data.Begin();
+   }
+
+   size_type Bytes() const
+   {
+      return m_data.Length()*sizeof( uint16 );
+   }
+
+   static void ToHalf( uint16* h, const float* f, size_type n );
+   static void ToFloat( float* f, const uint16* h, size_type n );
+
+private:
+
+   Array<uint16> m_data;
+   int           m_width = 0;
+   int           m_height = 0;
+};
+
+// ----------------------------------------------------------------------------
+
+/*
+ * A chain of point-wise transforms compiled into one lookup table. Entry i
+ * is the output for the input i/(n-1); inputs are rounded to the nearest
+ * entry, exactly as the kernels apply the table, so evaluating the curve
+ * gives the values that the image receives.
+ *
+ * Stretch curves are nondecreasing; should rounding or blending make a
+ * table dip locally, Inverse() follows its running maximum.
+ */
+class StretchCurve
+{
+public:
+
+   StretchCurve() = default;
+
+   // Takes a table of at least two entries.
+   explicit StretchCurve( const FVector& table );
+
+   bool IsEmpty() const
+   {
+      return m_table.IsEmpty();
+   }
+
+   int Length() const
+   {
+      return m_table.Length();
+   }
+
+   const FVector& Table() const
+   {
+      return m_table;
+   }
+
+   // Table entry of an input value.
+   int Index( double x ) const
+   {
+      const int n = m_table.Length();
+      return Range( RoundInt( x*(n - 1) ), 0, n - 1 );
+   }
+
+   float operator ()( double x ) const
+   {
+      return m_table[Index( x )];
+   }
+
+   // Smallest input whose output reaches y; one if no output does.
+   double Inverse( double y ) const;
+
+   // Slope at x, by central differences between neighboring entries.
+   double Derivative( double x ) const;
+
+   // Output histogram for an input histogram; see
+   // StretchEngine::TransformHistogram().
+   void TransformHistogram( UI64Vector& output, const UI64Vector& input ) const;
+
+private:
+
+   FVector m_table;
+   FVector m_envelope; // running maximum of m_table
+};
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Intermediate products of a stretch, kept between runs on the same source
+ * image. Each product records the parameters it was computed with and is
+ * rebuilt only when one of them changes, so that a parameter edit reruns just
+ * the downstream stages: e.g. a new compression alpha reuses the starlet
+ * reconstruction, and a new OTS intensity reuses the transport map.
+ *
+ * The caller identifies the source image (view, revision, preview zoom...);
+ * setting a different source drops everything.
+ */
+class StretchCache
+{
+public:
+
+   StretchCache() = default;
+
+   void SetSource( const IsoString& sourceId );
+
+   void Clear();
+
+   // Background level that the last SAS stretch through this cache
+   // normalized to the target, as in StretchStatistics::sasBackground.
+   const DVector& SASBackground() const
+   {
+      return m_sasBackground;
+   }
+
+private:
+
+   IsoString     m_sourceId;
+
+   // Luminance (or first channel) of the source image
+   Image         m_L;
+   bool          m_hasL = false;
+   bool          m_luminance = false;
+   int           m_numberOfChannels = 0;
+
+   // OTS: source CDF, raw transport map and the compiled curve (transport
+   // map, highlight protection and intensity)
+   FVector       m_srcCDF;
+   FVector       m_transportMap;
+   pcl_enum      m_objectType = -1;
+   double        m_otsBackgroundTarget = -1;
+   bool          m_transportFromStats = false;
+   StretchCurve  m_otsCurve;
+   double        m_otsProtectHighlights = -1;
+   double        m_otsStretchIntensity = -1;
+
+   // SAS: starlet scales, thresholded fine scales, highlight-protection
+   // blurs and the reconstruction before arctangent compression
+   Array<Image>  m_scales;         // empty where kept in m_halfScales
+   Array<HalfPlane> m_halfScales;
+   int           m_scaleStorage = ScaleStorage::Float32;
+   int           m_numScales = -1;
+   double        m_reduction = 0;
+   double        m_noiseSigma = -1;
+   Array<Image>  m_smooth;
+   Array<double> m_smoothSigma;
+   Image         m_reconstruction;
+   bool          m_hasReconstruction = false;
+   StretchParameters m_reconstructionParams;
+   double        m_reconstructionNoise = -1;
+   double        m_backgroundLevel = -1;
+   double        m_backgroundRank = 0.05;
+   DVector       m_sasBackground;
+
+   // Histograms of m_L and of the reconstruction, built on demand to
+   // predict output histograms
+   UI64Vector    m_LHistogram;
+   UI64Vector    m_reconstructionHistogram; // over [m_reconstructionMin,m_reconstructionMax]
+   double        m_reconstructionMin = 0;
+   double        m_reconstructionMax = 1;
+
+   // SAS per channel: one cache for each nominal channel, with the channel
+   // in m_L
+   Array<StretchCache> m_channels;
+   int           m_channel = -1;
+
+   void InvalidateLuminance();
+
+   friend class StretchEngine;
+};
+
+// ----------------------------------------------------------------------------
+
+namespace ExecutionStrategy
+{
+   enum value_type
+   {
+      WholeImage,      // every intermediate plane at once; fastest
+      StreamingScales, // SAS: each starlet scale is consumed as it is computed
+      Tiled            // tiles with a halo that covers the filter supports
+   };
+}
+
+/*
+ * How a full-resolution execution runs, as chosen by StretchEngine::Plan().
+ * Memory figures exclude the image being processed.
+ */
+struct ExecutionPlan
+{
+   ExecutionStrategy::value_type strategy = ExecutionStrategy::WholeImage;
+   size_type peakBytes = 0;  // predicted peak memory of the temporaries
+   size_type budget = 0;     // memory available to them
+   int       tileSize = 0;   // Tiled: tile size, excluding the halo
+   int       halo = 0;       // Tiled: halo on each side of a tile
+   bool      fits = true;    // false if even the smallest tiles exceed the budget
+
+   IsoString ToString() const;
+};
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Objective measures of a stretched image, for automatic tuning. They are
+ * taken on the luminance (or first channel) of the result.
+ */
+struct StretchScore
+{
+   double background = 0;  // median, i.e. the sky level of most deep-sky images
+   double noiseGain = 0;   // output over input noise, MAD of the finest starlet scale
+   double clipped = 0;     // fraction of samples at zero or one
+   double cost = 0;        // see AutoTuneObjective; lower is better
+};
+
+/*
+ * What automatic tuning aims at: the cost of a result is its relative
+ * background error, plus noiseWeight times the base-2 logarithm of its noise
+ * gain, plus clippingWeight times its clipped fraction.
+ */
+struct AutoTuneObjective
+{
+   double background = 0.15;
+   double noiseWeight = 0.05;
+   double clippingWeight = 10;
+};
+
+// ----------------------------------------------------------------------------
+
+/*
+ * OTS and SAS stretch kernels.
+ *
+ * The engine only depends on PCL's image and container classes, so it can be
+ * linked into standalone executables as well as into the module.
+ */
+class StretchEngine
+{
+public:
+
+   StretchEngine( const StretchParameters& params, int numberOfThreads = 1 );
+
+   const StretchParameters& Parameters() const
+   {
+      return m_params;
+   }
+
+   int NumberOfThreads() const
+   {
+      return m_numberOfThreads;
+   }
+
+   /*
+    * Cooperative cancellation. If flag is not null, stretches and statistics
+    * check it between stages (and between starlet scales) and throw
+    * ProcessAborted once it is set. A cache used by a cancelled run remains
+    * consistent: products that were being rebuilt are marked invalid.
+    */
+   void SetCancelFlag( const std::atomic<bool>* flag )
+   {
+      m_cancel = flag;
+   }
+
+   /*
+    * Progress reporting. If counter is not null, it is incremented at every
+    * cancellation check, from whichever thread makes it, so another thread
+    * can follow a run without locking. Checkpoints() is the count reached by
+    * Apply( image, plan ).
+    */
+   void SetProgressCounter( std::atomic<uint32>* counter )
+   {
+      m_progress = counter;
+   }
+
+   // Arena for temporary images and buffers; ScratchArena::Default() unless
+   // set. Must not be null.
+   ScratchArena& Arena() const
+   {
+      return *m_arena;
+   }
+
+   void SetArena( ScratchArena& arena )
+   {
+      m_arena = &arena;
+   }
+
+   /*
+    * How ApplySAS() stores the starlet scales between decomposition and
+    * reconstruction; ScaleStorage::Float32 unless set. Half floats halve the
+    * memory and bandwidth of the coarse scales at a small cost in accuracy
+    * (see HalfPlane), which suits previews kept in a StretchCache.
+    */
+   ScaleStorage::value_type ScaleStoragePolicy() const
+   {
+      return m_scaleStorage;
+   }
+
+   void SetScaleStorage( ScaleStorage::value_type storage )
+   {
+      m_scaleStorage = storage;
+   }
+
+   /*
+    * Applies the selected algorithm to an image of any real sample type.
+    *
+    * If stats is not null, image is a rendition of the image the statistics
+    * were computed for, downsampled by the given reduction factor (>= 1).
+    * The starlet dilations are then scaled to the reduced pixel size.
+    *
+    * If cache is not null, intermediate products are reused from and stored
+    * in it; see StretchCache.
+    */
+   void Apply( ImageVariant& image, const StretchStatistics* stats = nullptr, double reduction = 1,
+               StretchCache* cache = nullptr ) const;
+
+   /*
+    * Memory planning for full-resolution executions. Predicts the peak
+    * memory of each strategy for a width x height image with the current
+    * parameters, and picks the fastest one that fits budget bytes: whole
+    * image, then streaming scales (SAS), then tiles as large as the budget
+    * allows.
+    *
+    * Streaming scales yields the same result as the whole image. Tiled
+    * execution gathers statistics tile by tile: OTS and the SAS background
+    * level are exact, and the SAS noise estimate is quantized to 2^-20.
+    *
+    * With SAS per channel (see SASPerChannel()), the whole image strategy
+    * stretches all channels at once, and the others one channel at a time.
+    */
+   enum { MinTileSize = 256,               // smallest tile of a tiled plan
+          NoiseHistogramBins = 1 << 20 };  // tiled SAS noise estimate
+
+   ExecutionPlan Plan( int width, int height, size_type budget, int numberOfChannels = 1 ) const;
+   size_type PeakMemory( ExecutionStrategy::value_type strategy, int width, int height, int tileSize = 0,
+                         int numberOfChannels = 1 ) const;
+   uint32 Checkpoints( const ExecutionPlan& plan, int width, int height, int numberOfChannels = 1 ) const;
+
+   // Tile halo of the SAS filters for the current parameters, in pixels.
+   int TileHalo() const;
+
+   void Apply( ImageVariant& image, const ExecutionPlan& plan ) const;
+
+   template <class P>
+   void ApplySASStreaming( GenericImage<P>& image ) const;
+   template <class P>
+   void ApplyTiled( GenericImage<P>& image, int tileSize ) const;
+
+   // Physical memory available to the process in bytes, or zero if unknown.
+   static size_type AvailablePhysicalMemory();
+
+   template <class P>
+   void ApplyOTS( GenericImage<P>& image, const StretchStatistics* stats = nullptr,
+                  StretchCache* cache = nullptr ) const;
+   template <class P>
+   void ApplySAS( GenericImage<P>& image, const StretchStatistics* stats = nullptr, double reduction = 1,
+                  StretchCache* cache = nullptr ) const;
+
+   // Full-resolution statistics for preview runs with the current parameters.
+   void ComputeStatistics( StretchStatistics& stats, const ImageVariant& image ) const;
+   template <class P>
+   void ComputeStatistics( StretchStatistics& stats, const GenericImage<P>& image ) const;
+
+   /*
+    * Histograms of the nominal channels (one for grayscale, three for color)
+    * with the given number of bins, computed from the samples at their full
+    * bit depth. Bin i counts the samples that round to i/(bins-1).
+    */
+   void ComputeHistograms( Array<UI64Vector>& hists, const ImageVariant& image, int bins ) const;
+
+   /*
+    * Predicts the histogram of the stretched luminance (or first channel)
+    * for the current parameters without processing pixels, from an earlier
+    * run on the same source kept in cache: the point-wise transfer function
+    * of the last stage (the OTS transport map, or the SAS compression and
+    * background normalization) is applied to the histogram of that stage's
+    * input. The number of bins is hist.Length().
+    *
+    * For OTS the prediction is exact up to color clipping. For SAS, the
+    * reconstruction is binned over its own range, which may exceed [0,1],
+    * so highlights compressed into distinct values stay distinct; the
+    * prediction is exact up to that binning (2^20 bins over the range) and
+    * color clipping. Returns false if the cache does not hold the input of
+    * the last stage for the current parameters; the image must then be
+    * processed again.
+    */
+   bool PredictHistogram( UI64Vector& hist, const StretchStatistics* stats, StretchCache& cache ) const;
+
+   /*
+    * Automatic tuning. AutoTuneCandidates() returns the current parameters
+    * followed by variations of those that decide the stretch: background
+    * target x stretch intensity for OTS, and fine x mid x coarse scale gains
+    * for SAS.
+    *
+    * AutoTune() stretches copies of image with each candidate and scores
+    * them against objective; image, stats, reduction and cache are as for
+    * Apply(). The first candidate runs alone and fills the cache with the
+    * luminance, its histogram, the starlet decomposition and the noise
+    * estimate; the others run concurrently, each on a copy of the cache
+    * (sharing its images until written), so they only redo the stages that
+    * their parameters affect. Returns the index of the candidate with the
+    * lowest cost, the first one on ties, or -1 if there are none; scores
+    * receives the score of every candidate.
+    */
+   Array<StretchParameters> AutoTuneCandidates() const;
+   int AutoTune( const Array<StretchParameters>& candidates, Array<StretchScore>& scores, const Image& image,
+                 const AutoTuneObjective& objective, const StretchStatistics* stats = nullptr,
+                 double reduction = 1, StretchCache* cache = nullptr ) const;
+
+   /*
+    * Parameter sweeps. SweepGrid() returns the current parameters with two
+    * real parameters varied over a grid, row by row: set r*xValues.Length()+c
+    * has x = xValues[c] and y = yValues[r].
+    *
+    * Sweep() stretches copies of image with each parameter set, sharing the
+    * decomposition and statistics as AutoTune() does; results[i] receives the
+    * result for sets[i].
+    */
+   Array<StretchParameters> SweepGrid( double StretchParameters::* x, const DVector& xValues,
+                                       double StretchParameters::* y, const DVector& yValues ) const;
+   void Sweep( Array<Image>& results, const Array<StretchParameters>& sets, const Image& image,
+               const StretchStatistics* stats = nullptr, double reduction = 1,
+               StretchCache* cache = nullptr ) const;
+
+   // Whether the stretch works on CIE luminance for this number of channels.
+   bool UsesLuminance( int numberOfChannels ) const;
+
+   /*
+    * Whether SAS stretches each nominal channel on its own, which it does for
+    * color images when color is not preserved. Channels are decomposed and
+    * stretched concurrently, each on its share of the threads. With linked
+    * channels, they share one noise estimate and one background level (the
+    * means of those of the channels), which keeps the background color;
+    * otherwise each channel's background is moved to the target.
+    */
+   bool SASPerChannel( int numberOfChannels ) const;
+
+   /*
+    * Individual kernels. They are public so that they can be measured in
+    * isolation by the microbenchmarks; all of them run on numberOfThreads.
+    */
+
+   // Luminance and color. If rect is not empty, the planes cover that
+   // region of the image only.
+   template <class P>
+   void ExtractLuminance( Image& L, const GenericImage<P>& image, bool useLuminance,
+                          const Rect& rect = Rect( 0 ) ) const;
+   template <class P>
+   void ReconstructColor( GenericImage<P>& image, const Image& L_orig, const Image& L,
+                          const Rect& rect = Rect( 0 ) ) const;
+   template <class P>
+   void ApplyLuminance( GenericImage<P>& image, const Image& L, const Rect& rect = Rect( 0 ) ) const;
+   template <class P>
+   void ExtractChannel( Image& L, const GenericImage<P>& image, int channel, const Rect& rect = Rect( 0 ) ) const;
+   template <class P>
+   void ApplyChannel( GenericImage<P>& image, int channel, const Image& L, const Rect& rect = Rect( 0 ) ) const;
+
+   // OTS kernels
+   void ComputeHistogram( const Image& image, UI64Vector& hist ) const;
+   template <class P>
+   void ComputeHistogram( const GenericImage<P>& image, int channel, UI64Vector& hist ) const;
+   static void HistogramToCDF( FVector& cdf, const UI64Vector& hist );
+   static double CDFPercentile( const FVector& cdf, double p );
+   void ComputeHistogramCDF( const Image& image, FVector& cdf ) const;
+   void ComputeRangeHistogram( const Image& image, UI64Vector& hist, double& lo, double& hi ) const;
+   static void GenerateTargetCDF( FVector& cdf, int objectType, double bgTarget );
+   static void ComputeTransportMap( FVector& tmap, const FVector& srcCDF, const FVector& tgtCDF );
+   void CompileOTSCurve( StretchCurve& curve, const FVector& transportMap ) const;
+   static void TransformHistogram( UI64Vector& output, const UI64Vector& input, const FVector& lut );
+   template <class P>
+   void ApplyLUT( GenericImage<P>& image, const FVector& lut ) const;
+   template <class P>
+   void ApplyTransportColor( GenericImage<P>& image, const Image& L, const StretchCurve& curve,
+                             const Rect& rect = Rect( 0 ) ) const;
+
+   // SAS kernels
+   void AtrousHorizontal( const Image& input, Image& output, int spacing ) const;
+   void AtrousVertical( const Image& temp, const Image& current, Image& smooth, Image& wavelet, int spacing ) const;
+   void StarletDecompose( const Image& image, Array<Image>& scales, int numScales, double reduction = 1,
+                          Array<HalfPlane>* halfScales = nullptr ) const;
+   static int FirstStarletScale( double reduction );
+   static int StarletSpacing( int scale, double reduction );
+   void StarletReconstruct( Image& output, const Array<Image>& scales ) const;
+   double StreamingReconstruction( Image& output, const Image& L, double sigmaNoise ) const;
+   void SoftThreshold( Image& layer, float threshold ) const;
+   double EstimateNoise( const Image& fineScale ) const;
+   double Percentile( const Image& image, double p ) const;
+   double SelectSample( const Image& image, size_type k ) const;
+   static double HistogramPercentile( const UI64Vector& hist, double p );
+   void SASTransferFunction( FVector& lut, double currentBackground, double lo, double hi ) const;
+   void GaussianSmooth( Image& image, double sigma ) const;
+   double ComputeScaleGain( int scale ) const;
+
+private:
+
+   StretchParameters        m_params;
+   int                      m_numberOfThreads;
+   const std::atomic<bool>* m_cancel = nullptr;
+   std::atomic<uint32>*     m_progress = nullptr;
+   ScratchArena*            m_arena;
+   ScaleStorage::value_type m_scaleStorage = ScaleStorage::Float32;
+
+   void CheckCancel() const
+   {
+      if ( m_progress != nullptr )
+         m_progress->fetch_add( 1, std::memory_order_relaxed );
+      if ( m_cancel != nullptr && m_cancel->load( std::memory_order_relaxed ) )
+         throw ProcessAborted();
+   }
+
+   template <class P>
+   void UpdateLuminance( StretchCache& cache, const GenericImage<P>& image, bool useLuminance ) const;
+   template <class P>
+   void UpdateChannel( StretchCache& cache, const GenericImage<P>& image, int channel ) const;
+   template <class P>
+   void ApplySASChannels( GenericImage<P>& image, const StretchStatistics* stats, double reduction,
+                          StretchCache* cache ) const;
+   void SASDecomposition( StretchCache& cache, double reduction ) const;
+   double SASNoiseEstimate( StretchCache& cache, double reduction ) const;
+   void SASCompressedReconstruction( Image& L, StretchCache& cache, double sigmaNoise, double reduction,
+                                     bool keep ) const;
+   double SASBackgroundRank( StretchCache& cache, double backgroundLevel ) const;
+   const Image& SmoothedLuminance( StretchCache& cache, double sigma, bool keep ) const;
+   const FVector& UpdateTransportMap( StretchCache& cache, const FVector& srcCDF, bool fromStats ) const;
+   const StretchCurve& UpdateOTSCurve( StretchCache& cache, const FVector& srcCDF, bool fromStats ) const;
+   bool SameReconstructionParameters( const StretchParameters& p ) const;
+   void CopyPlane( Image& dst, const Image& src ) const;
+   void ZeroPlane( Image& plane ) const;
+   static double HighlightSigma( int j, double reduction );
+   void AccumulateScale( Image& out, const Image& scale, int j, double sigmaNoise, const Image* ls ) const;
+   void AccumulateScale( Image& out, const HalfPlane& scale, int j, double sigmaNoise, const Image* ls ) const;
+   void AccumulateResidual( Image& out, const Image& residual ) const;
+   void CompressReconstruction( Image& L ) const;
+   void NormalizeBackground( Image& L, double currentBg ) const;
+   template <class F>
+   double SelectRank( size_type N, size_type k, F value ) const;
+   template <class F>
+   void EvaluateSets( const Array<StretchParameters>& sets, const Image& image, const StretchStatistics* stats,
+                      double reduction, StretchCache* cache, F f ) const;
+   double FineScaleNoise( const Image& L ) const;
+   StretchScore ScoreResult( const Image& result, double inputNoise, const AutoTuneObjective& objective ) const;
+};
+
+// ----------------------------------------------------------------------------
+
+} // namespace pcl
+
+#endif // __AstroStretchStudioEngine_h
+
+// ----------------------------------------------------------------------------
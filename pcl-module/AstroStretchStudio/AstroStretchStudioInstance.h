@@ -8,6 +8,7 @@
 #include <pcl/ProcessImplementation.h>
 #include <pcl/MetaParameter.h>
 
+#include "AstroStretchStudioEngine.h"
 #include "AstroStretchStudioParameters.h"
 
 namespace pcl
@@ -27,6 +28,8 @@ public:
    UndoFlags UndoMode( const View& ) const override;
    bool CanExecuteOn( const View&, String& whyNot ) const override;
    bool ExecuteOn( View& ) override;
+   bool CanExecuteGlobal( String& whyNot ) const override;
+   bool ExecuteGlobal() override;
    void* LockParameter( const MetaParameter*, size_type tableRow ) override;
    bool AllocateParameter( size_type sizeOrLength, const MetaParameter* p, size_type tableRow ) override;
    size_type ParameterLength( const MetaParameter* p, size_type tableRow ) const override;
@@ -34,6 +37,52 @@ public:
    // Default initialization
    void SetDefaultParameters();
 
+   // Current parameters as a plain engine parameter set, and the reverse
+   StretchParameters EngineParameters() const;
+   void SetEngineParameters( const StretchParameters& );
+
+   /*
+    * Predicted histogram of the stretched luminance (or first channel) with
+    * the current parameters, from the statistics and intermediate products
+    * of an earlier run on the same image; no pixels are processed. Returns
+    * false if the image has to be processed again. See
+    * StretchEngine::PredictHistogram().
+    */
+   bool PredictOutputHistogram( UI64Vector& hist, const StretchStatistics* stats, StretchCache& cache ) const;
+
+   /*
+    * Memory budget of ExecuteOn() for the engine's temporaries, in bytes;
+    * zero for no limit but the available physical memory.
+    */
+   static size_type MemoryBudget();
+   static void SetMemoryBudget( size_type bytes );
+
+   // Memory available to an execution: free physical memory and the pooled
+   // scratch memory of engine, within MemoryBudget().
+   static size_type ExecutionBudget( const StretchEngine& engine );
+
+   /*
+    * Commits an image stretched on a copy of view, by a global execution or
+    * in the background by the interface, through LaunchOn(): the view gets
+    * a history entry with these parameters and can be undone as after a
+    * regular execution. Returns false if the core did not execute.
+    */
+   bool CommitResult( View& view, const ImageVariant& image );
+
+   // Whether a view handle still refers to an open view. Handles are
+   // compared, not identifiers, so a view renamed meanwhile is still found.
+   static bool IsOpenView( const View& view );
+
+   /*
+    * Global execution stretches the main views of all open image windows.
+    * Views run concurrently under one thread budget: each gets about one
+    * thread per ViewPixelsPerThread pixels, so small images share the
+    * processors view by view and large ones use them all. Results are
+    * computed on copies, as memory allows, and committed to their views
+    * through LaunchOn() to keep their histories.
+    */
+   enum { ViewPixelsPerThread = 1 << 20 };
+
    // Algorithm selection
    pcl_enum p_algorithm;
 
@@ -55,23 +104,7 @@ public:
    double   p_sasNoiseThreshold;
    pcl_bool p_sasFlattenBackground;
    pcl_bool p_sasPreserveColor;
-
-private:
-
-   // Internal processing methods
-   void ApplyOTS( Image& image ) const;
-   void ApplySAS( Image& image ) const;
-
-   // OTS helpers
-   void GenerateTargetCDF( FVector& cdf, int objectType, double bgTarget ) const;
-   void ComputeHistogramCDF( const Image& image, FVector& cdf ) const;
-   void ComputeTransportMap( FVector& tmap, const FVector& srcCDF, const FVector& tgtCDF ) const;
-
-   // SAS helpers
-   void StarletDecompose( const Image& image, Array<Image>& scales, int numScales ) const;
-   void StarletReconstruct( Image& output, const Array<Image>& scales ) const;
-   double EstimateNoise( const Image& fineScale ) const;
-   double ComputeScaleGain( int scale ) const;
+   pcl_bool p_sasLinkChannels;
 };
 
 // ----------------------------------------------------------------------------
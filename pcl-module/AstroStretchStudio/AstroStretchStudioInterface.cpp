@@ -3,16 +3,23 @@
 // ----------------------------------------------------------------------------
 
 #include "AstroStretchStudioInterface.h"
+#include "AstroStretchStudioModule.h"
 #include "AstroStretchStudioProcess.h"
 #include "AstroStretchStudioParameters.h"
 #include "WebViewContent.h"  // Generated file with embedded HTML
 
 #include <pcl/Console.h>
+#include <pcl/ElapsedTime.h>
 #include <pcl/ErrorHandler.h>
 #include <pcl/View.h>
 #include <pcl/ImageWindow.h>
 #include <pcl/JSON.h>
 #include <pcl/Base64.h>
+#include <pcl/Compression.h>
+#include <pcl/RealTimePreview.h>
+#include <pcl/Thread.h>
+
+#include <atomic>
 
 namespace pcl
 {
@@ -23,6 +30,490 @@ AstroStretchStudioInterface* TheAstroStretchStudioInterface = nullptr;
 
 // ----------------------------------------------------------------------------
 
+/*
+ * An image for the page: 16-bit samples, row delta encoded (see
+ * PreviewRenderer::ToUInt16Deltas()) and LZ4 compressed in independent
+ * chunks, so that no script holds the whole image and the page can
+ * decompress chunks as they arrive. Incompressible data are kept as raw
+ * chunks.
+ */
+struct EncodedImage
+{
+   enum { ChunkSize = 1024*1024 };
+
+   int                        width = 0;
+   int                        height = 0;
+   int                        channels = 0;
+   int                        reduction = 1; // relative to the full-resolution image
+   size_type                  size = 0;      // of the uncompressed data
+   Compression::subblock_list chunks;
+   bool                       compressed = false;
+
+   bool IsEmpty() const
+   {
+      return chunks.IsEmpty();
+   }
+
+   void Clear()
+   {
+      chunks.Clear();
+      size = 0;
+   }
+
+   void Encode( const Image& image, int imageReduction, const PreviewRenderer& renderer )
+   {
+      width = image.Width();
+      height = image.Height();
+      channels = image.NumberOfChannels();
+      reduction = imageReduction;
+
+      ByteArray data;
+      renderer.ToUInt16Deltas( data, image );
+      size = data.Length();
+
+      LZ4Compression lz4;
+      lz4.SetSubblockSize( ChunkSize );
+      chunks = lz4.Compress( data.Begin(), data.Length() );
+      compressed = !chunks.IsEmpty();
+      if ( !compressed )
+         for ( size_type offset = 0; offset < data.Length(); offset += ChunkSize )
+         {
+            Compression::Subblock chunk;
+            chunk.uncompressedSize = Min( size_type( ChunkSize ), data.Length() - offset );
+            chunk.compressedData = ByteArray( data.At( offset ), data.At( offset + chunk.uncompressedSize ) );
+            chunks.Add( chunk );
+         }
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+struct RenderedTile
+{
+   PreviewTileKey key;
+   ByteArray      rgba;
+   int            width = 0;
+   int            height = 0;
+};
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Does the pixel work of the WebView off the GUI thread. A run performs, in
+ * this order, the stages it is asked for:
+ *
+ * - builds the proxy of the source image, and encodes it (or the image at
+ *   full resolution) for the page;
+ * - computes the histograms of the source image, kept between runs on the
+ *   same image revision;
+ * - renders pyramid tiles of the source image, stretched with the current
+ *   parameters;
+ * - computes the native preview on one level of the proxy (see
+ *   PreviewLatencyController), and the histograms of the result.
+ *
+ * The thread keeps full-resolution statistics, shared by all levels, and the
+ * intermediate products of each level between runs on the same source; the
+ * interface only accesses its members while it is not running, except for
+ * the cancel flag. A cancelled run stops at the next stage boundary of the
+ * engine and leaves the caches consistent; only the preview is cancelled,
+ * and the stages before it keep their results.
+ */
+class PreviewThread : public Thread
+{
+public:
+
+   enum { SweepGap = 2 }; // pixels between the cells of a contact sheet
+
+   // Input
+   StretchParameters params;
+   uint32            parametersSerial = 0; // see PreviewTileKey
+   View              view;      // of the source image
+   IsoString         viewRevision; // view and image revision
+   IsoString         sourceId;  // view, image revision and proxy reduction
+   ImageVariant      source;    // full-resolution image
+   Image             proxy;     // built by the run if buildProxy is set
+   int               reduction = 1; // of the proxy
+   bool              buildProxy = false;
+   bool              fullResolution = false; // encode the source instead of the proxy
+   int               histogramBins = 0;
+   bool              histogramsOfSource = false;
+   bool              histogramsOfResult = false; // of the last preview if this run renders none
+   Array<PreviewTileKey> tiles;  // of the source image, to be rendered with params
+   bool              render = true; // compute a preview; the following members apply to it
+   int               level = 0;     // the proxy is rendered reduced by 2^level
+   bool              autoTune = false; // tune params on the level, then render the best set
+   AutoTuneObjective objective;
+   Array<StretchParameters> sweep; // if not empty, render a contact sheet of these sets instead
+   int               sweepColumns = 0;
+   IsoString         sweepAxes;     // JSON members describing the sweep, passed through
+   std::atomic<bool> cancel{ false };
+
+   // Output
+   EncodedImage      encoded;   // if buildProxy is set
+   Array<UI64Vector> sourceHistograms;
+   Array<UI64Vector> resultHistograms;
+   Array<RenderedTile> renderedTiles;
+   Image             result;    // stretched level; empty for sweeps
+   ByteArray         rgba;
+   int               width = 0;
+   int               height = 0;
+   double            elapsed = 0;
+   double            renderTime = 0; // elapsed, excluding statistics
+   bool              cancelled = false;
+   String            error;
+   StretchScore      score;          // auto-tune: score of the best set, now in params
+   int               candidates = 0; // auto-tune: number of sets scored
+
+   void Run() override
+   {
+      // The interface is done with the previous result, unless this run
+      // keeps it for its histograms. Its memory and that of the RGBA pixels
+      // are reused, so that runs at a constant level allocate nothing.
+      if ( render || buildProxy )
+         ScratchArena::Default().Release( result );
+      encoded.Clear();
+      sourceHistograms.Clear();
+      resultHistograms.Clear();
+      renderedTiles.Clear();
+      cancelled = false;
+      error.Clear();
+      score = StretchScore();
+      candidates = 0;
+
+      try
+      {
+         const int threads = AstroStretchStudioModule::NumberOfThreads();
+         PreviewRenderer renderer( threads );
+
+         if ( buildProxy )
+         {
+            renderer.Downsample( proxy, source, reduction );
+            if ( fullResolution )
+            {
+               Image image;
+               renderer.Downsample( image, source, 1 );
+               encoded.Encode( image, 1, renderer );
+            }
+            else
+               encoded.Encode( proxy, reduction, renderer );
+         }
+
+         if ( histogramBins > 0 && histogramsOfSource )
+         {
+            IsoString id = IsoString().Format( "%s:%d", viewRevision.c_str(), histogramBins );
+            if ( id != m_sourceHistogramsId )
+            {
+               StretchEngine( params, threads ).ComputeHistograms( m_sourceHistograms, source, histogramBins );
+               m_sourceHistogramsId = id;
+            }
+            sourceHistograms = m_sourceHistograms;
+         }
+
+         if ( !tiles.IsEmpty() )
+            RenderTiles( threads, renderer );
+
+         if ( render )
+            Render( threads, renderer );
+
+         if ( histogramBins > 0 && histogramsOfResult && !result.IsEmpty() )
+            StretchEngine( params, threads ).ComputeHistograms( resultHistograms, ImageVariant( &result ), histogramBins );
+      }
+      catch ( const ProcessAborted& )
+      {
+         cancelled = true;
+      }
+      catch ( const Exception& x )
+      {
+         error = x.Message();
+      }
+      catch ( ... )
+      {
+         error = "Unknown error";
+      }
+
+      if ( cancelled || !error.IsEmpty() )
+         rgba.Clear();
+   }
+
+   // Full-resolution statistics of a view revision, "id:revision", if the
+   // last run has measured them.
+   bool FindStatistics( StretchStatistics& stats, const IsoString& viewRevision ) const
+   {
+      if ( IsActive() || !m_statistics.IsValid() || m_statisticsId != viewRevision )
+         return false;
+      stats = m_statistics;
+      return true;
+   }
+
+   // Histogram of the result for the instance's current parameters,
+   // predicted from the last run.
+   bool PredictHistogram( UI64Vector& hist, const AstroStretchStudioInstance& instance )
+   {
+      return !IsActive() && error.IsEmpty() && !result.IsEmpty()
+          && instance.PredictOutputHistogram( hist, &m_statistics, m_caches[level] );
+   }
+
+private:
+
+   StretchStatistics m_statistics;
+   IsoString         m_statisticsId; // view revision
+   StretchCache      m_caches[ PreviewLatencyController::MaxLevel+1 ];
+   DVector           m_tileBackground; // see RenderTiles()
+   IsoString         m_tileBackgroundId;
+   Array<UI64Vector> m_sourceHistograms;
+   IsoString         m_sourceHistogramsId;
+
+   // Measures the statistics of the source image for the parameters of an
+   // engine, unless they are known already. Returns the time spent.
+   double UpdateStatistics( const StretchEngine& engine )
+   {
+      if ( m_statistics.IsValid() && m_statisticsId == viewRevision
+        && m_statistics.luminance == engine.UsesLuminance( source.NumberOfChannels() ) )
+         return 0;
+      ElapsedTime T;
+      engine.ComputeStatistics( m_statistics, source );
+      m_statisticsId = viewRevision;
+      return T();
+   }
+
+   /*
+    * Tiles are stretched at their level like previews, with the statistics
+    * of the full image. Each one is rendered with a margin of source pixels
+    * around it, as wide as the halo of the SAS filters, and SAS tiles share
+    * the background level of a stretch of the whole proxy, so that tiles
+    * match their neighbors and the preview at the seams.
+    */
+   void RenderTiles( int threads, const PreviewRenderer& renderer )
+   {
+      StretchEngine engine( params, threads );
+      UpdateStatistics( engine );
+      StretchStatistics stats = m_statistics;
+      if ( params.algorithm == ASSAlgorithm::SAS )
+      {
+         IsoString id = IsoString().Format( "%s:%u", sourceId.c_str(), parametersSerial );
+         if ( id != m_tileBackgroundId )
+         {
+            Image image( proxy );
+            image.EnsureUnique();
+            ImageVariant v( &image );
+            StretchCache cache;
+            engine.Apply( v, &m_statistics, reduction, &cache );
+            m_tileBackground = cache.SASBackground();
+            m_tileBackgroundId = id;
+         }
+         stats.sasBackground = m_tileBackground;
+      }
+
+      const int w = source.Width();
+      const int h = source.Height();
+      for ( const PreviewTileKey& key : tiles )
+      {
+         RenderedTile tile;
+         tile.key = key;
+         const Rect r = PreviewRenderer::TileRect( w, h, key.level, key.x, key.y );
+         if ( r.IsRect() )
+         {
+            const int tileReduction = 1 << key.level;
+            const Rect context = PreviewRenderer::TileContextRect( w, h, key.level, key.x, key.y, engine.TileHalo() );
+            Image image;
+            renderer.Downsample( image, source, tileReduction, context );
+            ImageVariant v( &image );
+            engine.Apply( v, &stats, tileReduction );
+            const int x0 = (r.x0 - context.x0)/tileReduction;
+            const int y0 = (r.y0 - context.y0)/tileReduction;
+            image.CropTo( Rect( x0, y0, x0 + PreviewRenderer::ProxySize( r.Width(), tileReduction ),
+                                        y0 + PreviewRenderer::ProxySize( r.Height(), tileReduction ) ) );
+            renderer.ToRGBA( tile.rgba, image );
+            tile.width = image.Width();
+            tile.height = image.Height();
+         }
+         renderedTiles.Add( tile );
+      }
+   }
+
+   void Render( int threads, const PreviewRenderer& renderer )
+   {
+      ElapsedTime T;
+      ScratchArena& arena = ScratchArena::Default();
+      StretchEngine engine( params, threads );
+      engine.SetCancelFlag( &cancel );
+      // The cached scales are read again on every parameter edit.
+      engine.SetScaleStorage( ScaleStorage::Float16 );
+
+      // Statistics are measured once, usually by the coarsest level or by
+      // tiles, and reused by the finer levels.
+      const double statisticsTime = UpdateStatistics( engine );
+      StretchCache& cache = m_caches[level];
+      cache.SetSource( sourceId );
+
+      Image image;
+      if ( level > 0 )
+      {
+         arena.Acquire( image, PreviewRenderer::ProxySize( proxy.Width(), 1 << level ),
+                               PreviewRenderer::ProxySize( proxy.Height(), 1 << level ), proxy.NumberOfChannels() );
+         renderer.Downsample( image, proxy, 1 << level );
+      }
+      else
+      {
+         arena.Acquire( image, proxy.Width(), proxy.Height(), proxy.NumberOfChannels() );
+         for ( int c = 0; c < proxy.NumberOfChannels(); ++c )
+         {
+            const float* s = proxy.PixelData( c );
+            float* d = image.PixelData( c );
+            for ( size_type i = 0, n = proxy.NumberOfPixels(); i < n; ++i )
+               d[i] = s[i];
+         }
+      }
+      if ( autoTune )
+      {
+         Array<StretchParameters> sets = engine.AutoTuneCandidates();
+         Array<StretchScore> scores;
+         int best = engine.AutoTune( sets, scores, image, objective, &m_statistics, reduction << level, &cache );
+         params = sets[best];
+         score = scores[best];
+         candidates = int( sets.Length() );
+         engine = StretchEngine( params, threads );
+         engine.SetCancelFlag( &cancel );
+         engine.SetScaleStorage( ScaleStorage::Float16 );
+      }
+
+      if ( sweep.IsEmpty() )
+      {
+         ImageVariant v( &image );
+         engine.Apply( v, &m_statistics, reduction << level, &cache );
+
+         renderer.ToRGBA( rgba, image );
+         width = image.Width();
+         height = image.Height();
+         result = image;
+      }
+      else
+      {
+         Array<Image> cells;
+         engine.Sweep( cells, sweep, image, &m_statistics, reduction << level, &cache );
+         arena.Release( image );
+         Image sheet;
+         renderer.ContactSheet( sheet, cells, sweepColumns, SweepGap );
+         renderer.ToRGBA( rgba, sheet );
+         width = sheet.Width();
+         height = sheet.Height();
+      }
+      elapsed = T();
+      renderTime = elapsed - statisticsTime;
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Stretches a copy of a view's image at full resolution, so that the
+ * interface stays responsive during long executions. The engine advances
+ * the progress counter, which the interface reads on its timer ticks; all
+ * other members are only accessed while the thread is not running. The
+ * instance is a copy of the parameters at start, which the result is
+ * committed with.
+ */
+class ApplyThread : public Thread
+{
+public:
+
+   ApplyThread()
+      : instance( TheAstroStretchStudioProcess )
+   {
+   }
+
+   // Input
+   AstroStretchStudioInstance instance;
+   View                       view;
+   IsoString                  viewId;
+   ImageVariant               image;     // copy of the view's image; the result
+   ExecutionPlan              plan;
+   int                        threads = 1;
+   uint32                     checkpoints = 0; // see StretchEngine::Checkpoints()
+   std::atomic<uint32>        progress{ 0 };
+   std::atomic<bool>          cancel{ false };
+
+   // Output
+   double                     elapsed = 0;
+   bool                       cancelled = false;
+   String                     error;
+
+   // Fraction of the work done. The last stage runs after the last check,
+   // so it stays below one until the thread finishes.
+   double Progress() const
+   {
+      return double( progress.load( std::memory_order_relaxed ) )/(checkpoints + 1);
+   }
+
+   void Run() override
+   {
+      cancelled = false;
+      error.Clear();
+
+      try
+      {
+         ElapsedTime T;
+         StretchEngine engine( instance.EngineParameters(), threads );
+         engine.SetCancelFlag( &cancel );
+         engine.SetProgressCounter( &progress );
+         engine.Apply( image, plan );
+         elapsed = T();
+      }
+      catch ( const ProcessAborted& )
+      {
+         cancelled = true;
+      }
+      catch ( const Exception& x )
+      {
+         error = x.Message();
+      }
+      catch ( const std::bad_alloc& )
+      {
+         error = "Out of memory";
+      }
+      catch ( ... )
+      {
+         error = "Unknown error";
+      }
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Measures the full-resolution statistics of an image for the real-time
+ * preview, while the interface keeps processing events.
+ */
+class StatisticsThread : public Thread
+{
+public:
+
+   // Input
+   StretchParameters params;
+   ImageVariant      image;
+   std::atomic<bool> cancel{ false };
+
+   // Output
+   StretchStatistics statistics;
+   bool              done = false;
+
+   void Run() override
+   {
+      try
+      {
+         StretchEngine engine( params, AstroStretchStudioModule::NumberOfThreads() );
+         engine.SetCancelFlag( &cancel );
+         engine.ComputeStatistics( statistics, image );
+         done = true;
+      }
+      catch ( ... )
+      {
+      }
+   }
+};
+
+// ----------------------------------------------------------------------------
+
 AstroStretchStudioInterface::AstroStretchStudioInterface()
    : m_instance( TheAstroStretchStudioProcess )
 {
@@ -33,6 +524,18 @@ AstroStretchStudioInterface::AstroStretchStudioInterface()
 
 AstroStretchStudioInterface::~AstroStretchStudioInterface()
 {
+   if ( m_applyThread != nullptr )
+   {
+      CancelApply( true/*wait*/ );
+      if ( m_applyRunning && AstroStretchStudioInstance::IsOpenView( m_applyThread->view ) )
+         m_applyThread->view.UnlockForWrite();
+      delete m_applyThread, m_applyThread = nullptr;
+   }
+   if ( m_previewThread != nullptr )
+   {
+      CancelPreview( true/*wait*/ );
+      delete m_previewThread, m_previewThread = nullptr;
+   }
    if ( GUI != nullptr )
       delete GUI, GUI = nullptr;
 }
@@ -69,7 +572,9 @@ InterfaceFeatures AstroStretchStudioInterface::Features() const
 
 void AstroStretchStudioInterface::ApplyInstance() const
 {
-   m_instance.LaunchOnCurrentView();
+   // Executions run in the background and are committed from the timer;
+   // see StartApply().
+   const_cast<AstroStretchStudioInterface*>( this )->StartApply();
 }
 
 // ----------------------------------------------------------------------------
@@ -77,7 +582,11 @@ void AstroStretchStudioInterface::ApplyInstance() const
 void AstroStretchStudioInterface::ResetInstance()
 {
    m_instance.SetDefaultParameters();
+   ++m_parametersSerial;
    SendParametersToWebView();
+   UpdateRealTimePreview();
+   if ( m_nativePreview )
+      SchedulePreview();
 }
 
 // ----------------------------------------------------------------------------
@@ -131,7 +640,11 @@ bool AstroStretchStudioInterface::RequiresInstanceValidation() const
 bool AstroStretchStudioInterface::ImportProcess( const ProcessImplementation& p )
 {
    m_instance.Assign( p );
+   ++m_parametersSerial;
    SendParametersToWebView();
+   UpdateRealTimePreview();
+   if ( m_nativePreview )
+      SchedulePreview();
    return true;
 }
 
@@ -146,11 +659,20 @@ bool AstroStretchStudioInterface::WantsImageNotifications() const
 
 void AstroStretchStudioInterface::ImageUpdated( const View& view )
 {
-   if ( GUI != nullptr && IsVisible() )
+   if ( view == m_previewStatisticsView )
    {
-      if ( view == m_currentView )
-         SendImageToWebView( view );
+      m_previewStatistics.Invalidate();
+      m_previewCache.Clear();
    }
+
+   m_tileCache.ImageChanged( view.FullId() );
+
+   // Processes may update a view many times in a row; only the last image is
+   // sent, from the scheduler.
+   if ( GUI != nullptr && IsVisible() && view == m_currentView )
+      ScheduleImage();
+   else if ( view == m_proxyView )
+      CancelPreview();
 }
 
 // ----------------------------------------------------------------------------
@@ -160,8 +682,92 @@ void AstroStretchStudioInterface::ImageFocused( const View& view )
    if ( GUI != nullptr && IsVisible() )
    {
       m_currentView = view;
-      SendImageToWebView( view );
+      ScheduleImage();
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void AstroStretchStudioInterface::RealTimePreviewUpdated( bool active )
+{
+   if ( GUI != nullptr )
+      if ( active )
+         RealTimePreview::SetOwner( *this ); // implies UpdateRealTimePreview()
+      else
+         RealTimePreview::SetOwner( ProcessInterface::Null() );
+}
+
+// ----------------------------------------------------------------------------
+
+bool AstroStretchStudioInterface::RequiresRealTimePreviewUpdate( const UInt16Image&, const View&, const Rect&, int ) const
+{
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+
+bool AstroStretchStudioInterface::GenerateRealTimePreview( UInt16Image& image, const View& view, const Rect& rect,
+                                                           int zoomLevel, String& ) const
+{
+   StretchEngine engine( m_instance.EngineParameters(), AstroStretchStudioModule::NumberOfThreads() );
+
+   // The real-time image is a downsampled rendition of the view at negative
+   // zoom levels. Statistics are measured once on the full-resolution image
+   // and reused while only the parameters change.
+   const bool luminance = engine.UsesLuminance( image.NumberOfChannels() );
+   if ( !m_previewStatistics.IsValid()
+     || view != m_previewStatisticsView
+     || m_previewStatistics.luminance != luminance )
+   {
+      // The WebView preview may have measured them for the same revision.
+      // Otherwise they are measured on a worker thread, so the GUI stays
+      // responsive; the preview is dropped if it is closed meanwhile.
+      const IsoString viewRevision = IsoString().Format( "%s:%u", view.FullId().c_str(),
+                                                         m_tileCache.Revision( view.FullId() ) );
+      if ( m_previewThread == nullptr
+        || !m_previewThread->FindStatistics( m_previewStatistics, viewRevision )
+        || m_previewStatistics.luminance != luminance )
+      {
+         m_previewStatistics.Invalidate();
+         StatisticsThread thread;
+         thread.params = m_instance.EngineParameters();
+         thread.image = view.Image();
+         thread.Start();
+         while ( !thread.Wait( 25 ) )
+         {
+            Module->ProcessEvents();
+            if ( !IsRealTimePreviewActive() )
+            {
+               thread.cancel = true;
+               thread.Wait();
+               return false;
+            }
+         }
+         if ( !thread.done )
+            return false;
+         m_previewStatistics = thread.statistics;
+      }
+      m_previewStatisticsView = view;
+      ++m_previewRevision;
    }
+
+   // The same rendition of the same image revision yields the same preview
+   // image, so intermediate products are reused while sliders move.
+   m_previewCache.SetSource( IsoString().Format( "%u:%d:%d,%d,%d,%d:%dx%dx%d", m_previewRevision, zoomLevel,
+                                                 rect.x0, rect.y0, rect.x1, rect.y1,
+                                                 image.Width(), image.Height(), image.NumberOfChannels() ) );
+
+   ImageVariant preview( &image );
+   engine.Apply( preview, &m_previewStatistics, (zoomLevel < 0) ? double( -zoomLevel ) : 1.0, &m_previewCache );
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+
+void AstroStretchStudioInterface::UpdateRealTimePreview()
+{
+   if ( IsRealTimePreviewActive() )
+      RealTimePreview::Update();
 }
 
 // ----------------------------------------------------------------------------
@@ -190,7 +796,7 @@ void AstroStretchStudioInterface::InitializeWebView()
    if ( !w.IsNull() )
    {
       m_currentView = w.CurrentView();
-      SendImageToWebView( m_currentView );
+      ScheduleImage();
    }
 }
 
@@ -223,7 +829,8 @@ void AstroStretchStudioInterface::SendParametersToWebView()
          "\"highlightProtection\":%.3f,"
          "\"noiseThreshold\":%.5f,"
          "\"flattenBackground\":%s,"
-         "\"preserveColor\":%s"
+         "\"preserveColor\":%s,"
+         "\"linkChannels\":%s"
       "}"
       "}",
       ( m_instance.p_algorithm == ASSAlgorithm::OTS ) ? "ots" : "sas",
@@ -241,7 +848,8 @@ void AstroStretchStudioInterface::SendParametersToWebView()
       m_instance.p_sasHighlightProtection,
       m_instance.p_sasNoiseThreshold,
       m_instance.p_sasFlattenBackground ? "true" : "false",
-      m_instance.p_sasPreserveColor ? "true" : "false"
+      m_instance.p_sasPreserveColor ? "true" : "false",
+      m_instance.p_sasLinkChannels ? "true" : "false"
    );
 
    GUI->WebView_Control.EvaluateScript(
@@ -251,66 +859,282 @@ void AstroStretchStudioInterface::SendParametersToWebView()
 
 // ----------------------------------------------------------------------------
 
-void AstroStretchStudioInterface::SendImageToWebView( const View& view )
+// Size of the page's image viewport in device pixels, or of the whole
+// control until the page has reported it.
+void AstroStretchStudioInterface::ViewportSize( int& width, int& height ) const
+{
+   width = m_viewportWidth;
+   height = m_viewportHeight;
+   if ( width <= 0 || height <= 0 )
+   {
+      width = RoundInt( GUI->WebView_Control.Width() * GUI->WebView_Control.DisplayPixelRatio() );
+      height = RoundInt( GUI->WebView_Control.Height() * GUI->WebView_Control.DisplayPixelRatio() );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Reduction of the proxy of a width x height image: it is fitted to the
+ * viewport. The page asks for the full-resolution image explicitly when it
+ * needs it.
+ */
+int AstroStretchStudioInterface::ProxyReduction( int width, int height ) const
+{
+   int vw, vh;
+   ViewportSize( vw, vh );
+   return PreviewRenderer::FitReduction( width, height, vw, vh );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Sends the image encoded by the last run of the preview thread. The header
+ * announces the image; each chunk is a message of its own (see
+ * EncodedImage).
+ */
+void AstroStretchStudioInterface::SendImageToWebView()
 {
-   if ( GUI == nullptr || view.IsNull() )
+   if ( GUI == nullptr || m_previewThread == nullptr || m_previewThread->encoded.IsEmpty() )
       return;
 
-   try
+   const EncodedImage& image = m_previewThread->encoded;
+   const int w = m_previewThread->source.Width();
+   const int h = m_previewThread->source.Height();
+
+   ++m_imageSerial;
+
+   GUI->WebView_Control.EvaluateScript( String( IsoString().Format(
+      "window.postMessage({\"type\":\"setImage\",\"width\":%d,\"height\":%d,\"channels\":%d,"
+      "\"fullWidth\":%d,\"fullHeight\":%d,\"reduction\":%d,"
+      "\"tileSize\":%d,\"levels\":%d,\"revision\":%u,"
+      "\"encoding\":\"uint16-delta\",\"serial\":%u,\"size\":%llu,\"chunks\":%d}, '*')",
+      image.width, image.height, image.channels, w, h, image.reduction,
+      int( PreviewRenderer::TileSize ), PreviewRenderer::NumberOfLevels( w, h ),
+      m_tileCache.Revision( m_previewThread->view.FullId() ),
+      m_imageSerial, (unsigned long long)image.size, int( image.chunks.Length() ) ) ) );
+
+   // The chunk data are appended, not formatted, to avoid copying them
+   // through a format buffer.
+   size_type offset = 0;
+   for ( const Compression::Subblock& chunk : image.chunks )
    {
-      ImageVariant image = view.Image();
-      if ( image.IsComplexSample() )
-         return;
+      IsoString script = IsoString().Format(
+         "window.postMessage({\"type\":\"setImageChunk\",\"serial\":%u,\"offset\":%llu,"
+         "\"size\":%llu,\"compression\":\"%s\",\"data\":\"",
+         m_imageSerial, (unsigned long long)offset, (unsigned long long)chunk.uncompressedSize,
+         image.compressed ? "lz4" : "none" );
+      script.Append( IsoString::ToBase64( chunk.compressedData ) );
+      script.Append( "\"}, '*')" );
+
+      GUI->WebView_Control.EvaluateScript( String( script ) );
+      offset += chunk.uncompressedSize;
+   }
+}
 
-      int w = image.Width();
-      int h = image.Height();
+// ----------------------------------------------------------------------------
+
+/*
+ * Requests the pyramid tiles [x0,x1) x [y0,y1) of a level of the current
+ * view, stretched with the current parameters. Cached tiles are sent at
+ * once; the others are rendered by the next run of the preview thread.
+ *
+ * The page requests the tiles of the visible region at the level closest
+ * to the screen resolution, where a tile pixel spans one to two device
+ * pixels. A request is clipped to what fits in the viewport at that scale,
+ * and so are the tiles waiting to be rendered: the oldest requests, made for
+ * regions that have scrolled out of view, are dropped first.
+ */
+void AstroStretchStudioInterface::RequestTiles( int level, int x0, int y0, int x1, int y1 )
+{
+   if ( GUI == nullptr || m_currentView.IsNull() )
+      return;
 
-      // Create RGBA data for WebView
-      ByteArray rgba( w * h * 4 );
+   const int w = m_currentView.Width();
+   const int h = m_currentView.Height();
+   if ( level < 0 || level >= PreviewRenderer::NumberOfLevels( w, h ) )
+      return;
 
-      if ( image.IsColor() )
+   int vw, vh;
+   ViewportSize( vw, vh );
+   const int maxColumns = 2*vw/PreviewRenderer::TileSize + 2;
+   const int maxRows = 2*vh/PreviewRenderer::TileSize + 2;
+
+   const int span = PreviewRenderer::TileSize << level;
+   x0 = Max( 0, x0 );
+   y0 = Max( 0, y0 );
+   x1 = Min( Min( x1, (w + span - 1)/span ), x0 + maxColumns );
+   y1 = Min( Min( y1, (h + span - 1)/span ), y0 + maxRows );
+
+   PreviewTileKey key;
+   key.viewId = m_currentView.FullId();
+   key.revision = m_tileCache.Revision( key.viewId );
+   key.parameters = m_parametersSerial;
+   key.level = level;
+
+   bool queued = false;
+   for ( key.y = y0; key.y < y1; ++key.y )
+      for ( key.x = x0; key.x < x1; ++key.x )
       {
-         for ( int y = 0; y < h; ++y )
-            for ( int x = 0; x < w; ++x )
-            {
-               size_type idx = ( y * w + x ) * 4;
-               rgba[idx + 0] = uint8( Range( image( x, y, 0 ), 0.0, 1.0 ) * 255 );
-               rgba[idx + 1] = uint8( Range( image( x, y, 1 ), 0.0, 1.0 ) * 255 );
-               rgba[idx + 2] = uint8( Range( image( x, y, 2 ), 0.0, 1.0 ) * 255 );
-               rgba[idx + 3] = 255;
-            }
+         int tw, th;
+         const ByteArray* rgba = m_tileCache.Find( key, tw, th );
+         if ( rgba != nullptr )
+            SendTileToWebView( key, *rgba, tw, th );
+         else if ( !m_tileRequests.Contains( key ) && !m_tilesInFlight.Contains( key ) )
+         {
+            m_tileRequests.Add( key );
+            queued = true;
+         }
       }
-      else
+
+   const size_type maxRequests = size_type( maxColumns )*maxRows;
+   if ( m_tileRequests.Length() > maxRequests )
+      m_tileRequests.Remove( m_tileRequests.Begin(), m_tileRequests.Begin() + (m_tileRequests.Length() - maxRequests) );
+
+   if ( queued && !m_updateTimer.IsRunning() )
+      m_updateTimer.Start();
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Caches the tiles rendered by the last run of the preview thread, and sends
+ * those still current: rendered for the current view and image revision
+ * with the current parameters.
+ */
+void AstroStretchStudioInterface::SendTilesToWebView()
+{
+   m_tilesInFlight.Clear();
+   if ( GUI == nullptr || m_previewThread == nullptr )
+      return;
+
+   const IsoString viewId = m_currentView.IsNull() ? IsoString() : m_currentView.FullId();
+   for ( const RenderedTile& tile : m_previewThread->renderedTiles )
+      if ( !tile.rgba.IsEmpty() )
       {
-         for ( int y = 0; y < h; ++y )
-            for ( int x = 0; x < w; ++x )
-            {
-               size_type idx = ( y * w + x ) * 4;
-               uint8 v = uint8( Range( image( x, y, 0 ), 0.0, 1.0 ) * 255 );
-               rgba[idx + 0] = v;
-               rgba[idx + 1] = v;
-               rgba[idx + 2] = v;
-               rgba[idx + 3] = 255;
-            }
+         m_tileCache.Add( tile.key, tile.rgba, tile.width, tile.height );
+         if ( tile.key.viewId == viewId && tile.key.revision == m_tileCache.Revision( viewId )
+           && tile.key.parameters == m_parametersSerial )
+            SendTileToWebView( tile.key, tile.rgba, tile.width, tile.height );
       }
+}
+
+// ----------------------------------------------------------------------------
 
-      // Encode as base64
-      IsoString base64 = IsoString::ToBase64( rgba );
+void AstroStretchStudioInterface::SendTileToWebView( const PreviewTileKey& key, const ByteArray& rgba, int width, int height )
+{
+   IsoString script = IsoString().Format(
+      "window.postMessage({\"type\":\"setTile\",\"level\":%d,\"x\":%d,\"y\":%d,"
+      "\"width\":%d,\"height\":%d,\"revision\":%u,\"stretch\":%u,\"data\":\"",
+      key.level, key.x, key.y, width, height, key.revision, key.parameters );
+   script.Append( IsoString::ToBase64( rgba ) );
+   script.Append( "\"}, '*')" );
+
+   GUI->WebView_Control.EvaluateScript( String( script ) );
+}
 
-      // Send to WebView
-      String json = String().Format(
-         "{\"type\":\"setImage\",\"width\":%d,\"height\":%d,\"data\":\"%s\"}",
-         w, h, base64.c_str()
-      );
+// ----------------------------------------------------------------------------
 
-      GUI->WebView_Control.EvaluateScript(
-         String().Format( "window.postMessage(%s, '*')", json.c_str() )
-      );
+// Updates the instance from the parameters of a WebView message.
+static void ImportWebViewParameters( AstroStretchStudioInstance& instance, const JSONValue& json )
+{
+   // Update instance from WebView parameters
+   String algo = json["algorithm"].ToString();
+   instance.p_algorithm = ( algo == "ots" ) ? ASSAlgorithm::OTS : ASSAlgorithm::SAS;
+
+   if ( json.HasMember( "ots" ) )
+   {
+      JSONValue ots = json["ots"];
+
+      String objType = ots["objectType"].ToString();
+      if ( objType == "nebula" )       instance.p_otsObjectType = ASSOTSObjectType::Nebula;
+      else if ( objType == "galaxy" )  instance.p_otsObjectType = ASSOTSObjectType::Galaxy;
+      else if ( objType == "starCluster" ) instance.p_otsObjectType = ASSOTSObjectType::StarCluster;
+      else if ( objType == "darkNebula" )  instance.p_otsObjectType = ASSOTSObjectType::DarkNebula;
+
+      instance.p_otsBackgroundTarget = ots["backgroundTarget"].ToDouble();
+      instance.p_otsStretchIntensity = ots["stretchIntensity"].ToDouble();
+      instance.p_otsProtectHighlights = ots["protectHighlights"].ToDouble();
+      instance.p_otsPreserveColor = ots["preserveColor"].ToBool();
    }
-   catch ( ... )
+
+   if ( json.HasMember( "sas" ) )
    {
-      // Silently ignore errors
+      JSONValue sas = json["sas"];
+
+      instance.p_sasNumScales = sas["numScales"].ToInt();
+      instance.p_sasBackgroundTarget = sas["backgroundTarget"].ToDouble();
+      instance.p_sasFineScaleGain = sas["fineScaleGain"].ToDouble();
+      instance.p_sasMidScaleGain = sas["midScaleGain"].ToDouble();
+      instance.p_sasCoarseScaleGain = sas["coarseScaleGain"].ToDouble();
+      instance.p_sasCompressionAlpha = sas["compressionAlpha"].ToDouble();
+      instance.p_sasHighlightProtection = sas["highlightProtection"].ToDouble();
+      instance.p_sasNoiseThreshold = sas["noiseThreshold"].ToDouble();
+      instance.p_sasFlattenBackground = sas["flattenBackground"].ToBool();
+      instance.p_sasPreserveColor = sas["preserveColor"].ToBool();
+      if ( sas.HasMember( "linkChannels" ) )
+         instance.p_sasLinkChannels = sas["linkChannels"].ToBool();
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Parses a sweep axis, {"parameter":id,"from":a,"to":b,"steps":n}, where id
+ * is the identifier of a real process parameter. The n values go from a to b
+ * evenly spaced, within the parameter's range; json receives the parameter
+ * and the values. Returns false if the parameter cannot be swept.
+ */
+static bool ParseSweepAxis( const JSONValue& axis, double StretchParameters::*& member, DVector& values,
+                            IsoString& json )
+{
+   const int MaxSweepSteps = 8;
+
+   const struct
+   {
+      const MetaFloat*            parameter;
+      double StretchParameters::* member;
    }
+   parameters[] =
+   {
+      { TheASSOTSBackgroundTargetParameter,    &StretchParameters::otsBackgroundTarget },
+      { TheASSOTSStretchIntensityParameter,    &StretchParameters::otsStretchIntensity },
+      { TheASSOTSProtectHighlightsParameter,   &StretchParameters::otsProtectHighlights },
+      { TheASSSASBackgroundTargetParameter,    &StretchParameters::sasBackgroundTarget },
+      { TheASSSASFineScaleGainParameter,       &StretchParameters::sasFineScaleGain },
+      { TheASSSASMidScaleGainParameter,        &StretchParameters::sasMidScaleGain },
+      { TheASSSASCoarseScaleGainParameter,     &StretchParameters::sasCoarseScaleGain },
+      { TheASSSASCompressionAlphaParameter,    &StretchParameters::sasCompressionAlpha },
+      { TheASSSASHighlightProtectionParameter, &StretchParameters::sasHighlightProtection },
+      { TheASSSASNoiseThresholdParameter,      &StretchParameters::sasNoiseThreshold }
+   };
+
+   if ( !axis.IsObject() )
+      return false;
+   const IsoString id = axis["parameter"].ToString().ToUTF8();
+   for ( const auto& p : parameters )
+      if ( p.parameter->Id() == id )
+      {
+         const double lo = p.parameter->MinimumValue();
+         const double hi = p.parameter->MaximumValue();
+         const double from = Range( axis["from"].ToDouble(), lo, hi );
+         const double to = Range( axis["to"].ToDouble(), lo, hi );
+         const int steps = Range( axis["steps"].ToInt(), 1, MaxSweepSteps );
+
+         member = p.member;
+         values = DVector( steps );
+         json = "{\"parameter\":\"" + id + "\",\"values\":[";
+         for ( int i = 0; i < steps; ++i )
+         {
+            values[i] = (steps > 1) ? from + (to - from)*i/(steps - 1) : from;
+            if ( i > 0 )
+               json += ",";
+            json.AppendFormat( "%.6g", values[i] );
+         }
+         json += "]}";
+         return true;
+      }
+   return false;
 }
 
 // ----------------------------------------------------------------------------
@@ -328,57 +1152,113 @@ void AstroStretchStudioInterface::OnWebViewMessage( WebView& sender, const Strin
 
       if ( type == "parametersChanged" )
       {
-         // Update instance from WebView parameters
-         String algo = json["algorithm"].ToString();
-         m_instance.p_algorithm = ( algo == "ots" ) ? ASSAlgorithm::OTS : ASSAlgorithm::SAS;
-
-         if ( json.HasMember( "ots" ) )
+         ImportWebViewParameters( m_instance, json );
+         ++m_parametersSerial;
+         UpdateRealTimePreview();
+         if ( m_histogramBins > 0 )
+            SendPredictedHistogramToWebView();
+         if ( m_nativePreview )
+            SchedulePreview();
+      }
+      else if ( type == "computePreview" )
+      {
+         // Parameters are optional; without them the current ones are used.
+         // With them, this is a parameter change as well.
+         if ( json.HasMember( "algorithm" ) )
          {
-            JSONValue ots = json["ots"];
-
-            String objType = ots["objectType"].ToString();
-            if ( objType == "nebula" )       m_instance.p_otsObjectType = ASSOTSObjectType::Nebula;
-            else if ( objType == "galaxy" )  m_instance.p_otsObjectType = ASSOTSObjectType::Galaxy;
-            else if ( objType == "starCluster" ) m_instance.p_otsObjectType = ASSOTSObjectType::StarCluster;
-            else if ( objType == "darkNebula" )  m_instance.p_otsObjectType = ASSOTSObjectType::DarkNebula;
-
-            m_instance.p_otsBackgroundTarget = ots["backgroundTarget"].ToDouble();
-            m_instance.p_otsStretchIntensity = ots["stretchIntensity"].ToDouble();
-            m_instance.p_otsProtectHighlights = ots["protectHighlights"].ToDouble();
-            m_instance.p_otsPreserveColor = ots["preserveColor"].ToBool();
+            ImportWebViewParameters( m_instance, json );
+            ++m_parametersSerial;
+            UpdateRealTimePreview();
+            if ( m_histogramBins > 0 )
+               SendPredictedHistogramToWebView();
          }
-
-         if ( json.HasMember( "sas" ) )
+         // From now on, parameter changes refresh the preview as well.
+         m_nativePreview = true;
+         SchedulePreview();
+      }
+      else if ( type == "autoTune" )
+      {
+         // {"background":b} sets the background level aimed at.
+         m_autoTuneObjective = AutoTuneObjective();
+         if ( json.HasMember( "background" ) )
+            m_autoTuneObjective.background = Range( json["background"].ToDouble(), 0.01, 0.5 );
+         m_autoTunePending = true;
+         m_nativePreview = true;
+         SchedulePreview();
+      }
+      else if ( type == "sweep" )
+      {
+         // {"x":axis,"y":axis}; see ParseSweepAxis(). Columns vary x, rows y.
+         double StretchParameters::* x;
+         double StretchParameters::* y;
+         DVector xValues, yValues;
+         IsoString xJSON, yJSON;
+         if ( ParseSweepAxis( json["x"], x, xValues, xJSON ) && ParseSweepAxis( json["y"], y, yValues, yJSON ) )
          {
-            JSONValue sas = json["sas"];
-
-            m_instance.p_sasNumScales = sas["numScales"].ToInt();
-            m_instance.p_sasBackgroundTarget = sas["backgroundTarget"].ToDouble();
-            m_instance.p_sasFineScaleGain = sas["fineScaleGain"].ToDouble();
-            m_instance.p_sasMidScaleGain = sas["midScaleGain"].ToDouble();
-            m_instance.p_sasCoarseScaleGain = sas["coarseScaleGain"].ToDouble();
-            m_instance.p_sasCompressionAlpha = sas["compressionAlpha"].ToDouble();
-            m_instance.p_sasHighlightProtection = sas["highlightProtection"].ToDouble();
-            m_instance.p_sasNoiseThreshold = sas["noiseThreshold"].ToDouble();
-            m_instance.p_sasFlattenBackground = sas["flattenBackground"].ToBool();
-            m_instance.p_sasPreserveColor = sas["preserveColor"].ToBool();
+            m_sweepSets = StretchEngine( m_instance.EngineParameters(), 1 ).SweepGrid( x, xValues, y, yValues );
+            m_sweepColumns = xValues.Length();
+            m_sweepAxes = "\"x\":" + xJSON + ",\"y\":" + yJSON;
+            m_nativePreview = true;
+            if ( !m_updateTimer.IsRunning() )
+               m_updateTimer.Start();
          }
       }
       else if ( type == "apply" )
       {
          ApplyInstance();
       }
+      else if ( type == "cancelApply" )
+      {
+         CancelApply();
+      }
       else if ( type == "reset" )
       {
          ResetInstance();
       }
       else if ( type == "requestImage" )
       {
+         // {"full":true} requests the image at full resolution.
+         bool full = json.HasMember( "full" ) && json["full"].ToBool();
          ImageWindow w = ImageWindow::ActiveWindow();
          if ( !w.IsNull() )
          {
             m_currentView = w.CurrentView();
-            SendImageToWebView( m_currentView );
+            ScheduleImage( full );
+         }
+      }
+      else if ( type == "requestTiles" )
+      {
+         // Tile index range [x0,x1) x [y0,y1) of a pyramid level
+         RequestTiles( json["level"].ToInt(), json["x0"].ToInt(), json["y0"].ToInt(), json["x1"].ToInt(), json["y1"].ToInt() );
+      }
+      else if ( type == "requestHistogram" )
+      {
+         // {"bins":n} selects the number of bins of this and later histograms.
+         int bins = json.HasMember( "bins" ) ? json["bins"].ToInt() : 256;
+         m_histogramBins = Range( bins, 16, 65536 );
+         m_histogramsPending = true;
+         if ( !m_updateTimer.IsRunning() )
+            m_updateTimer.Start();
+      }
+      else if ( type == "viewport" )
+      {
+         int vw = json["width"].ToInt();
+         int vh = json["height"].ToInt();
+         if ( vw > 0 && vh > 0 )
+         {
+            // Resend only if the proxy size changes.
+            bool resend = false;
+            if ( !m_currentView.IsNull() )
+            {
+               ImageVariant image = m_currentView.Image();
+               resend = m_viewportWidth <= 0
+                     || PreviewRenderer::FitReduction( image.Width(), image.Height(), vw, vh )
+                     != PreviewRenderer::FitReduction( image.Width(), image.Height(), m_viewportWidth, m_viewportHeight );
+            }
+            m_viewportWidth = vw;
+            m_viewportHeight = vh;
+            if ( resend )
+               ScheduleImage();
          }
       }
    }
@@ -394,7 +1274,11 @@ void AstroStretchStudioInterface::e_Click( Button& sender, bool checked )
 {
    if ( sender == GUI->Apply_Button )
    {
-      ApplyInstance();
+      // The button cancels the execution in flight, if any.
+      if ( m_applyRunning )
+         CancelApply();
+      else
+         ApplyInstance();
    }
    else if ( sender == GUI->Reset_Button )
    {
@@ -406,7 +1290,592 @@ void AstroStretchStudioInterface::e_Click( Button& sender, bool checked )
 
 void AstroStretchStudioInterface::e_Timer( Timer& sender )
 {
-   // Debounced update handling if needed
+   // A background execution reports its progress, or is committed once it
+   // finishes.
+   if ( m_applyRunning )
+   {
+      if ( m_applyThread->IsActive() )
+         SendApplyStatusToWebView();
+      else
+         FinishApply();
+   }
+
+   if ( m_previewThread != nullptr && m_previewThread->IsActive() )
+      return;
+
+   // Deliver what the finished run has computed, the image first, so that
+   // its previews, histograms and tiles follow it. An image outdated by a
+   // newer request is dropped. Cancelled runs have no preview. A coarse
+   // level is refined next, unless something else was requested meanwhile.
+   int refineLevel = -1;
+   if ( m_previewRunning )
+   {
+      m_previewRunning = false;
+      PreviewThread* t = m_previewThread;
+      if ( !t->encoded.IsEmpty() && !m_imagePending )
+      {
+         m_proxy = t->proxy;
+         m_proxyView = t->view;
+         m_proxyReduction = t->reduction;
+         SendImageToWebView();
+      }
+      if ( t->render )
+      {
+         if ( t->autoTune )
+            FinishAutoTune();
+         if ( !t->sweep.IsEmpty() )
+         {
+            // A sweep resumes the refinement it has interrupted.
+            SendSweepToWebView();
+            refineLevel = m_sweepRefineLevel;
+         }
+         else if ( !t->cancelled )
+         {
+            if ( t->error.IsEmpty() && !t->rgba.IsEmpty() )
+            {
+               // Tuning time says nothing about render times.
+               if ( !t->autoTune )
+                  m_latency.AddMeasurement( t->level, size_type( t->width )*t->height, t->renderTime );
+               if ( t->level > 0 )
+                  refineLevel = t->level - 1;
+            }
+            SendPreviewToWebView();
+            m_previewAge.Reset();
+         }
+      }
+      SendHistogramsToWebView();
+      SendTilesToWebView();
+   }
+
+   // Then the latest image, preview, tiles and histograms requested
+   // meanwhile, in a single run.
+   if ( m_imagePending )
+      refineLevel = -1;
+   if ( m_previewPending )
+   {
+      m_previewPending = false;
+      StartPreview();
+   }
+   else if ( !m_sweepSets.IsEmpty() )
+   {
+      m_sweepRefineLevel = refineLevel;
+      StartPreview( -1, true );
+   }
+   else if ( refineLevel >= 0 )
+      StartPreview( refineLevel );
+   else if ( m_imagePending || m_histogramsPending || !m_tileRequests.IsEmpty() )
+      StartPreview( -1, false, false/*render*/ );
+
+   if ( !m_previewRunning && !m_applyRunning )
+      m_updateTimer.Stop();
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Requests a native preview with the current parameters. It starts on the
+ * next timer tick, so a burst of parameter messages yields a single run.
+ *
+ * A run in flight is computing outdated parameters and is cancelled, unless
+ * the page's preview has been outdated for MaxPreviewLatency seconds: while
+ * a slider keeps moving faster than the engine, the running preview is then
+ * allowed to finish, so that the page never goes without updates.
+ */
+void AstroStretchStudioInterface::SchedulePreview()
+{
+   const double MaxPreviewLatency = 0.5;
+
+   if ( !m_previewRunning && !m_previewPending )
+      m_previewAge.Reset();
+   m_previewPending = true;
+   if ( m_previewRunning && m_previewAge() < MaxPreviewLatency )
+      CancelPreview();
+   if ( !m_updateTimer.IsRunning() )
+      m_updateTimer.Start();
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Requests sending the current view's image on the next timer tick. A
+ * preview in flight belongs to the previous image, so it is cancelled and,
+ * if the page uses native previews, a new one is requested.
+ */
+void AstroStretchStudioInterface::ScheduleImage( bool fullResolution )
+{
+   m_imagePending = true;
+   if ( fullResolution )
+      m_fullImagePending = true;
+   CancelPreview();
+   if ( m_nativePreview )
+      m_previewPending = true;
+   if ( !m_updateTimer.IsRunning() )
+      m_updateTimer.Start();
+}
+
+// ----------------------------------------------------------------------------
+
+void AstroStretchStudioInterface::CancelPreview( bool wait ) const
+{
+   if ( m_previewThread != nullptr && m_previewThread->IsActive() )
+   {
+      m_previewThread->cancel = true;
+      if ( wait )
+         m_previewThread->Wait();
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Starts a run of the preview thread with whatever is pending: the image of
+ * the current view, whose proxy is then built first, requested tiles and
+ * histograms, and a preview if render is set.
+ */
+void AstroStretchStudioInterface::StartPreview( int level, bool sweep, bool render )
+{
+   if ( m_previewThread != nullptr && m_previewThread->IsActive() )
+   {
+      if ( render )
+         m_previewPending = true;
+      return;
+   }
+
+   const bool buildProxy = m_imagePending;
+   View view = buildProxy ? m_currentView : m_proxyView;
+   m_imagePending = false;
+   if ( view.IsNull() || !buildProxy && m_proxy.IsEmpty() )
+      return;
+   ImageVariant image = view.Image();
+   if ( image.IsComplexSample() )
+      return;
+
+   if ( m_previewThread == nullptr )
+      m_previewThread = new PreviewThread;
+   PreviewThread* t = m_previewThread;
+
+   const IsoString viewId = view.FullId();
+   t->params = m_instance.EngineParameters();
+   t->parametersSerial = m_parametersSerial;
+   t->view = view;
+   t->viewRevision = IsoString().Format( "%s:%u", viewId.c_str(), m_tileCache.Revision( viewId ) );
+   t->source = image;
+   t->buildProxy = buildProxy;
+   t->fullResolution = buildProxy && m_fullImagePending;
+   if ( buildProxy )
+   {
+      t->reduction = ProxyReduction( image.Width(), image.Height() );
+      m_fullImagePending = false;
+   }
+   else
+   {
+      t->proxy = m_proxy;
+      t->reduction = m_proxyReduction;
+   }
+   t->sourceId = IsoString().Format( "%s:%d", t->viewRevision.c_str(), t->reduction );
+
+   // A new image resends the source histograms, and a preview the result's.
+   t->histogramBins = m_histogramBins;
+   t->histogramsOfSource = buildProxy || m_histogramsPending;
+   t->histogramsOfResult = render || m_histogramsPending;
+   m_histogramsPending = false;
+
+   // Tiles requested for another view, revision or set of parameters are
+   // dropped.
+   t->tiles.Clear();
+   for ( const PreviewTileKey& key : m_tileRequests )
+      if ( key.viewId == viewId && key.revision == m_tileCache.Revision( viewId )
+        && key.parameters == m_parametersSerial )
+         t->tiles.Add( key );
+   m_tileRequests.Clear();
+   m_tilesInFlight = t->tiles;
+
+   t->render = render;
+   if ( render )
+   {
+      const int proxyWidth = PreviewRenderer::ProxySize( image.Width(), t->reduction );
+      const int proxyHeight = PreviewRenderer::ProxySize( image.Height(), t->reduction );
+      t->level = (level < 0) ? m_latency.StartLevel( proxyWidth, proxyHeight ) : level;
+      t->autoTune = m_autoTunePending;
+      t->sweep.Clear();
+      if ( m_autoTunePending )
+      {
+         t->objective = m_autoTuneObjective;
+         t->level = PreviewLatencyController::NumberOfLevels( proxyWidth, proxyHeight ) - 1;
+         m_autoTunePending = false;
+      }
+      else if ( sweep )
+      {
+         // Cells reduced by the smallest power of two not below the number
+         // of rows and columns, so the sheet is at most the size of the proxy.
+         const int rows = int( m_sweepSets.Length() )/m_sweepColumns;
+         int sweepLevel = 0;
+         while ( (1 << sweepLevel) < Max( rows, m_sweepColumns ) )
+            ++sweepLevel;
+         t->level = Min( sweepLevel, PreviewLatencyController::NumberOfLevels( proxyWidth, proxyHeight ) - 1 );
+         t->sweep = m_sweepSets;
+         t->sweepColumns = m_sweepColumns;
+         t->sweepAxes = m_sweepAxes;
+         m_sweepSets.Clear();
+      }
+   }
+   t->cancel = false;
+   t->Start();
+   m_previewRunning = true;
+
+   if ( !m_updateTimer.IsRunning() )
+      m_updateTimer.Start();
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Starts stretching the current view in the background. The image is copied
+ * and the view is locked for writing until the result is committed, so
+ * other processes cannot change it meanwhile; it can still be read, and
+ * other views previewed. One execution runs at a time.
+ */
+void AstroStretchStudioInterface::StartApply()
+{
+   Console console;
+   if ( m_applyRunning )
+   {
+      console.WarningLn( "<end><cbr>** AstroStretchStudio: An execution is already running on " + m_applyThread->viewId );
+      return;
+   }
+
+   // Without a view that can be stretched now, the core reports why.
+   ImageWindow window = ImageWindow::ActiveWindow();
+   View view = window.IsNull() ? View::Null() : window.CurrentView();
+   String whyNot;
+   if ( view.IsNull() || !view.CanWrite() || !m_instance.CanExecuteOn( view, whyNot ) )
+   {
+      m_instance.LaunchOnCurrentView();
+      return;
+   }
+
+   if ( m_applyThread == nullptr )
+      m_applyThread = new ApplyThread;
+   ApplyThread* t = m_applyThread;
+
+   // The copy being stretched counts against the memory budget.
+   ImageVariant source = view.Image();
+   t->threads = AstroStretchStudioModule::NumberOfThreads();
+   StretchEngine engine( m_instance.EngineParameters(), t->threads );
+   size_type budget = AstroStretchStudioInstance::ExecutionBudget( engine );
+   budget -= Min( budget, source.ImageSize() );
+   t->plan = engine.Plan( source.Width(), source.Height(), budget, source.NumberOfChannels() );
+   t->checkpoints = engine.Checkpoints( t->plan, source.Width(), source.Height(), source.NumberOfChannels() );
+
+   t->instance.Assign( m_instance );
+   t->view = view;
+   t->viewId = view.FullId();
+   t->image.CreateImageAs( source );
+   t->image.CopyImage( source );
+   t->progress = 0;
+   t->cancel = false;
+
+   console.WriteLn( String().Format( "<end><cbr>Applying %s to ",
+                                     (m_instance.p_algorithm == ASSAlgorithm::OTS) ? "Optimal Transport Stretch"
+                                                                                   : "Starlet Arctan Stretch" )
+                     + t->viewId + " in the background..." );
+   console.WriteLn( "Execution plan: " + String( t->plan.ToString() ) );
+   if ( !t->plan.fits )
+      console.WarningLn( "** Warning: The predicted memory exceeds the budget even with the smallest tiles." );
+
+   view.LockForWrite();
+   t->Start();
+   m_applyRunning = true;
+   m_applyProgress = -1;
+
+   if ( GUI != nullptr )
+      GUI->Apply_Button.SetText( "Cancel" );
+   SendApplyStatusToWebView();
+
+   if ( !m_updateTimer.IsRunning() )
+      m_updateTimer.Start();
+}
+
+// ----------------------------------------------------------------------------
+
+void AstroStretchStudioInterface::CancelApply( bool wait )
+{
+   if ( m_applyThread != nullptr && m_applyThread->IsActive() )
+   {
+      m_applyThread->cancel = true;
+      if ( wait )
+         m_applyThread->Wait();
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Commits a finished background execution to its view, unless it failed,
+ * was cancelled or the view has been closed meanwhile. The view is found by
+ * its handle, so it may have been renamed; messages use its current id.
+ */
+void AstroStretchStudioInterface::FinishApply()
+{
+   ApplyThread* t = m_applyThread;
+   m_applyRunning = false;
+
+   // A live view is always unlocked, whatever the outcome.
+   const bool exists = AstroStretchStudioInstance::IsOpenView( t->view );
+   if ( exists )
+   {
+      t->view.UnlockForWrite();
+      t->viewId = t->view.FullId();
+   }
+
+   Console console;
+   const char* state = "done";
+   if ( !t->error.IsEmpty() )
+   {
+      console.CriticalLn( "<end><cbr>*** Error: AstroStretchStudio: " + t->viewId + ": " + t->error );
+      state = "failed";
+   }
+   else if ( t->cancelled )
+   {
+      console.WarningLn( "<end><cbr>** AstroStretchStudio: Execution on " + t->viewId + " cancelled." );
+      state = "cancelled";
+   }
+   else if ( !exists )
+   {
+      console.WarningLn( "<end><cbr>** AstroStretchStudio: " + t->viewId + " was closed; the result is discarded." );
+      state = "cancelled";
+   }
+   else
+   {
+      // The preview thread may be reading the view's image; its result
+      // would be superseded by the image change anyway.
+      CancelPreview( true/*wait*/ );
+      if ( t->instance.CommitResult( t->view, t->image ) )
+         console.WriteLn( "<end><cbr>" + t->viewId + String().Format( ": stretched in %.3f s", t->elapsed ) );
+      else
+         state = "cancelled";
+   }
+
+   // Releases the copy
+   t->image = ImageVariant();
+   t->view = View::Null();
+
+   if ( GUI != nullptr )
+      GUI->Apply_Button.SetText( "Apply" );
+   SendApplyStatusToWebView( state );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Reports the state of the background execution to the page: running, with
+ * the fraction done, or how it ended. Progress is only sent when it changes
+ * by at least 0.1%.
+ */
+void AstroStretchStudioInterface::SendApplyStatusToWebView( const char* state )
+{
+   if ( GUI == nullptr || m_applyThread == nullptr )
+      return;
+
+   double progress = 1;
+   if ( state == nullptr )
+   {
+      state = "running";
+      progress = m_applyThread->Progress();
+      int permille = RoundInt( progress*1000 );
+      if ( permille == m_applyProgress )
+         return;
+      m_applyProgress = permille;
+   }
+
+   IsoString script = IsoString().Format(
+      "window.postMessage({\"type\":\"applyStatus\",\"state\":\"%s\",\"view\":\"%s\",\"progress\":%.3f}, '*')",
+      state, m_applyThread->viewId.c_str(), progress );
+   GUI->WebView_Control.EvaluateScript( String( script ) );
+}
+
+// ----------------------------------------------------------------------------
+
+void AstroStretchStudioInterface::SendPreviewToWebView()
+{
+   if ( GUI == nullptr || m_previewThread == nullptr )
+      return;
+
+   if ( !m_previewThread->error.IsEmpty() )
+   {
+      Console().CriticalLn( "<end><cbr>AstroStretchStudio: preview failed: " + m_previewThread->error );
+      return;
+   }
+   if ( m_previewThread->rgba.IsEmpty() )
+      return;
+
+   IsoString script = IsoString().Format(
+      "window.postMessage({\"type\":\"setPreview\",\"width\":%d,\"height\":%d,"
+      "\"reduction\":%d,\"level\":%d,\"elapsed\":%.1f,\"stretch\":%u,\"data\":\"",
+      m_previewThread->width, m_previewThread->height,
+      m_previewThread->reduction << m_previewThread->level, m_previewThread->level,
+      m_previewThread->elapsed*1000, m_previewThread->parametersSerial );
+   script.Append( IsoString::ToBase64( m_previewThread->rgba ) );
+   script.Append( "\"}, '*')" );
+
+   GUI->WebView_Control.EvaluateScript( String( script ) );
+}
+
+// ----------------------------------------------------------------------------
+
+void AstroStretchStudioInterface::SendSweepToWebView()
+{
+   if ( GUI == nullptr || m_previewThread == nullptr )
+      return;
+
+   if ( !m_previewThread->error.IsEmpty() )
+   {
+      Console().CriticalLn( "<end><cbr>AstroStretchStudio: parameter sweep failed: " + m_previewThread->error );
+      return;
+   }
+   if ( m_previewThread->rgba.IsEmpty() )
+      return;
+
+   const int columns = m_previewThread->sweepColumns;
+   const int rows = int( m_previewThread->sweep.Length() )/columns;
+   const int gap = PreviewThread::SweepGap;
+   IsoString script = IsoString().Format(
+      "window.postMessage({\"type\":\"setSweep\",\"columns\":%d,\"rows\":%d,"
+      "\"cellWidth\":%d,\"cellHeight\":%d,\"gap\":%d,\"width\":%d,\"height\":%d,"
+      "\"reduction\":%d,\"elapsed\":%.1f,",
+      columns, rows,
+      (m_previewThread->width - (columns - 1)*gap)/columns, (m_previewThread->height - (rows - 1)*gap)/rows, gap,
+      m_previewThread->width, m_previewThread->height,
+      m_previewThread->reduction << m_previewThread->level, m_previewThread->elapsed*1000 );
+   script.Append( m_previewThread->sweepAxes );
+   script.Append( ",\"data\":\"" );
+   script.Append( IsoString::ToBase64( m_previewThread->rgba ) );
+   script.Append( "\"}, '*')" );
+
+   GUI->WebView_Control.EvaluateScript( String( script ) );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Adopts the parameters found by a finished auto-tune run and reports the
+ * outcome to the page. A cancelled run leaves the parameters unchanged.
+ */
+void AstroStretchStudioInterface::FinishAutoTune()
+{
+   const char* state = "done";
+   if ( m_previewThread->cancelled )
+      state = "cancelled";
+   else if ( !m_previewThread->error.IsEmpty() )
+      state = "failed";
+   else
+   {
+      m_instance.SetEngineParameters( m_previewThread->params );
+      ++m_parametersSerial;
+      SendParametersToWebView();
+      UpdateRealTimePreview();
+   }
+
+   if ( GUI == nullptr )
+      return;
+
+   const StretchScore& s = m_previewThread->score;
+   IsoString script = IsoString().Format(
+      "window.postMessage({\"type\":\"autoTuneResult\",\"state\":\"%s\",\"candidates\":%d,\"elapsed\":%.1f,"
+      "\"background\":%.4f,\"noiseGain\":%.3f,\"clipped\":%.5f,\"cost\":%.4f}, '*')",
+      state, m_previewThread->candidates, m_previewThread->elapsed*1000,
+      s.background, s.noiseGain, s.clipped, s.cost );
+   GUI->WebView_Control.EvaluateScript( String( script ) );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * JSON object with the histograms of an image: the number of channels and
+ * their bin counts, channel after channel, as base64-encoded little-endian
+ * 32-bit integers. Counts beyond 2^32-1 are saturated.
+ */
+static IsoString HistogramsJSON( const Array<UI64Vector>& hists )
+{
+   const int bins = hists.IsEmpty() ? 0 : hists[0].Length();
+   ByteArray data( size_type( bins )*hists.Length()*4 );
+   uint8* p = data.Begin();
+   for ( const UI64Vector& hist : hists )
+      for ( int i = 0; i < bins; ++i )
+      {
+         uint32 count = uint32( Min( hist[i], uint64( uint32_max ) ) );
+         *p++ = uint8( count );
+         *p++ = uint8( count >> 8 );
+         *p++ = uint8( count >> 16 );
+         *p++ = uint8( count >> 24 );
+      }
+
+   IsoString json = IsoString().Format( "{\"channels\":%d,\"data\":\"", int( hists.Length() ) );
+   json.Append( IsoString::ToBase64( data ) );
+   json.Append( "\"}" );
+   return json;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Sends the source and/or result histograms computed by the last run of the
+ * preview thread. Parts it has not computed are omitted.
+ */
+void AstroStretchStudioInterface::SendHistogramsToWebView()
+{
+   if ( GUI == nullptr || m_previewThread == nullptr )
+      return;
+
+   const PreviewThread* t = m_previewThread;
+   if ( t->sourceHistograms.IsEmpty() && t->resultHistograms.IsEmpty() )
+      return;
+
+   IsoString script = IsoString().Format( "window.postMessage({\"type\":\"setHistogram\",\"bins\":%d", t->histogramBins );
+   if ( !t->sourceHistograms.IsEmpty() )
+   {
+      script.Append( ",\"source\":" );
+      script.Append( HistogramsJSON( t->sourceHistograms ) );
+   }
+   if ( !t->resultHistograms.IsEmpty() )
+   {
+      script.Append( ",\"result\":" );
+      script.Append( HistogramsJSON( t->resultHistograms ) );
+   }
+   script.Append( "}, '*')" );
+   GUI->WebView_Control.EvaluateScript( String( script ) );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * While parameters change, the result histogram is predicted from the last
+ * native preview instead of waiting for a new one: it is sent as a single
+ * luminance (or first channel) histogram flagged as predicted.
+ */
+void AstroStretchStudioInterface::SendPredictedHistogramToWebView()
+{
+   if ( GUI == nullptr || m_histogramBins <= 0 || m_previewThread == nullptr )
+      return;
+
+   try
+   {
+      Array<UI64Vector> hists;
+      hists.Add( UI64Vector( m_histogramBins ) );
+      if ( !m_previewThread->PredictHistogram( hists[0], m_instance ) )
+         return;
+
+      IsoString script = IsoString().Format(
+         "window.postMessage({\"type\":\"setHistogram\",\"bins\":%d,\"predicted\":true,\"result\":", m_histogramBins );
+      script.Append( HistogramsJSON( hists ) );
+      script.Append( "}, '*')" );
+
+      GUI->WebView_Control.EvaluateScript( String( script ) );
+   }
+   catch ( ... )
+   {
+      // Silently ignore errors
+   }
 }
 
 // ----------------------------------------------------------------------------
@@ -439,6 +1908,10 @@ AstroStretchStudioInterface::GUIData::GUIData( AstroStretchStudioInterface& w )
 
    w.SetSizer( Global_Sizer );
 
+   w.m_updateTimer.SetInterval( 0.025 );
+   w.m_updateTimer.SetPeriodic( true );
+   w.m_updateTimer.OnTimer( (Timer::timer_event_handler)&AstroStretchStudioInterface::e_Timer, w );
+
    w.EnsureLayoutUpdated();
    w.AdjustToContents();
 }
@@ -5,6 +5,7 @@
 #ifndef __AstroStretchStudioInterface_h
 #define __AstroStretchStudioInterface_h
 
+#include <pcl/ElapsedTime.h>
 #include <pcl/ProcessInterface.h>
 #include <pcl/Sizer.h>
 #include <pcl/WebView.h>
@@ -12,12 +13,18 @@
 #include <pcl/Timer.h>
 
 #include "AstroStretchStudioInstance.h"
+#include "AstroStretchStudioPreview.h"
 
 namespace pcl
 {
 
 // ----------------------------------------------------------------------------
 
+class PreviewThread;
+class ApplyThread;
+
+// ----------------------------------------------------------------------------
+
 class AstroStretchStudioInterface : public ProcessInterface
 {
 public:
@@ -39,6 +46,9 @@ public:
    bool WantsImageNotifications() const override;
    void ImageUpdated( const View& ) override;
    void ImageFocused( const View& ) override;
+   void RealTimePreviewUpdated( bool active ) override;
+   bool RequiresRealTimePreviewUpdate( const UInt16Image&, const View&, const Rect&, int zoomLevel ) const override;
+   bool GenerateRealTimePreview( UInt16Image&, const View&, const Rect&, int zoomLevel, String& info ) const override;
 
 private:
 
@@ -61,19 +71,120 @@ private:
    // WebView communication
    void InitializeWebView();
    void SendParametersToWebView();
-   void SendImageToWebView( const View& view );
+   void ViewportSize( int& width, int& height ) const;
+   int ProxyReduction( int width, int height ) const;
+   void SendImageToWebView();
+   void RequestTiles( int level, int x0, int y0, int x1, int y1 );
+   void SendTilesToWebView();
+   void SendTileToWebView( const PreviewTileKey& key, const ByteArray& rgba, int width, int height );
    void OnWebViewMessage( WebView& sender, const String& message );
 
    // Button handlers
    void e_Click( Button& sender, bool checked );
 
-   // Timer for debounced updates
+   // Preview scheduler tick: coalesces image and preview requests and polls
+   // the preview thread. Runs only while work is pending or in flight.
    Timer m_updateTimer;
    void e_Timer( Timer& sender );
 
    // Current view tracking
    View m_currentView;
 
+   // Size in device pixels of the WebView's image viewport, as reported by
+   // the page. Zero until known; the control's size is used meanwhile.
+   int m_viewportWidth = 0;
+   int m_viewportHeight = 0;
+
+   // Rendered tiles of the deep zoom pyramid, those requested but not
+   // rendered yet, and those being rendered by the preview thread. Tiles
+   // are stretched with the parameters identified by m_parametersSerial,
+   // which is bumped whenever the parameters change.
+   PreviewTileCache      m_tileCache;
+   Array<PreviewTileKey> m_tileRequests;
+   Array<PreviewTileKey> m_tilesInFlight;
+   uint32                m_parametersSerial = 0;
+
+   // Counts images sent to the WebView, to match image chunks to headers.
+   uint32 m_imageSerial = 0;
+
+   // Proxy last sent to the WebView, and the native preview computed on it
+   // in the background. The preview thread does all pixel work for the
+   // page: it also builds and encodes the proxy, renders tiles and computes
+   // histograms. Requests are coalesced: any number of them made
+   // between two timer ticks start a single run with the latest parameters.
+   // A request made while a preview is running cancels it if it is stale
+   // (see SchedulePreview()); otherwise it is deferred until it finishes.
+   // Image changes are coalesced the same way. Previews are progressive:
+   // they start at the level chosen by m_latency and are refined down to
+   // the proxy while nothing else is requested.
+   Image          m_proxy;
+   View           m_proxyView;
+   int            m_proxyReduction = 1;
+   PreviewThread* m_previewThread = nullptr;
+   bool           m_previewRunning = false;
+   bool           m_previewPending = false;
+   bool           m_imagePending = false;
+   bool           m_fullImagePending = false; // send the image at full resolution
+   bool           m_nativePreview = false; // the page has requested native previews
+   ElapsedTime    m_previewAge;            // since the page's preview became outdated
+   PreviewLatencyController m_latency;
+
+   void SchedulePreview();
+   void ScheduleImage( bool fullResolution = false );
+   void CancelPreview( bool wait = false ) const;
+   void StartPreview( int level = -1, bool sweep = false, bool render = true ); // -1: start level of m_latency
+   void SendPreviewToWebView();
+
+   // Automatic tuning runs as a preview at the coarsest level: candidates
+   // are scored there, and the best one is rendered, adopted and refined.
+   bool              m_autoTunePending = false;
+   AutoTuneObjective m_autoTuneObjective;
+
+   void FinishAutoTune();
+
+   // Parameter sweeps run as a preview too, once no other preview is
+   // requested: the cells of a contact sheet are rendered on one level and
+   // share its cache. The sheet is sent apart from the preview, and the
+   // refinement that a sweep interrupts is resumed afterwards.
+   Array<StretchParameters> m_sweepSets;       // pending sweep, row by row
+   int                      m_sweepColumns = 0;
+   IsoString                m_sweepAxes;       // see ParseSweepAxis()
+   int                      m_sweepRefineLevel = -1;
+
+   void SendSweepToWebView();
+
+   // Background execution (see StartApply()). The timer reports progress to
+   // the page and commits the result; the Apply button cancels meanwhile.
+   ApplyThread* m_applyThread = nullptr;
+   bool         m_applyRunning = false;
+   int          m_applyProgress = -1; // last progress sent, per mille
+
+   void StartApply();
+   void CancelApply( bool wait = false );
+   void FinishApply();
+   void SendApplyStatusToWebView( const char* state = nullptr ); // nullptr: running
+
+   // Histograms requested by the page, with their number of bins (zero until
+   // requested). The preview thread computes source histograms at full
+   // resolution with each new image, and keeps them until the view, its
+   // image or the number of bins changes; result histograms are computed
+   // with each native preview.
+   int                m_histogramBins = 0;
+   bool               m_histogramsPending = false;
+
+   void SendHistogramsToWebView();
+   void SendPredictedHistogramToWebView();
+
+   // Full-resolution statistics of the view being previewed in real time,
+   // and the intermediate products of the last preview. The revision counts
+   // statistics updates, i.e. changes of the previewed image.
+   mutable StretchStatistics m_previewStatistics;
+   mutable View              m_previewStatisticsView;
+   mutable uint32            m_previewRevision = 0;
+   mutable StretchCache      m_previewCache;
+
+   void UpdateRealTimePreview();
+
    friend struct GUIData;
 };
 
@@ -8,11 +8,16 @@
 // ----------------------------------------------------------------------------
 
 #include "AstroStretchStudioModule.h"
+#include "AstroStretchStudioEngine.h"
+#include "AstroStretchStudioInstance.h"
+#include "AstroStretchStudioParallel.h"
 #include "AstroStretchStudioProcess.h"
 #include "AstroStretchStudioInterface.h"
 
 #include <pcl/Console.h>
 #include <pcl/MetaModule.h>
+#include <pcl/Settings.h>
+#include <pcl/Thread.h>
 
 namespace pcl
 {
@@ -102,6 +107,33 @@ void AstroStretchStudioModule::GetReleaseDate( int& year, int& month, int& day )
 
 // ----------------------------------------------------------------------------
 
+void AstroStretchStudioModule::OnLoad()
+{
+   // Memory cap of the engine's scratch arena, in MiB.
+   int maxMiB;
+   if ( Settings::ReadI( "ScratchArenaMaxMiB", maxMiB ) && maxMiB >= 0 )
+      ScratchArena::Default().SetMaxBytes( size_type( maxMiB )*1024*1024 );
+
+   // Memory budget of full-resolution executions, in MiB; zero or absent
+   // for the available physical memory.
+   int budgetMiB;
+   if ( Settings::ReadI( "MemoryBudgetMiB", budgetMiB ) && budgetMiB >= 0 )
+      AstroStretchStudioInstance::SetMemoryBudget( size_type( budgetMiB )*1024*1024 );
+
+   NumberOfThreads();
+}
+
+// ----------------------------------------------------------------------------
+
+int AstroStretchStudioModule::NumberOfThreads()
+{
+   const int n = Thread::NumberOfThreads( PCL_MAX_PROCESSORS, 1 );
+   TaskScheduler::Default().SetMaxThreads( n );
+   return n;
+}
+
+// ----------------------------------------------------------------------------
+
 } // namespace pcl
 
 // ----------------------------------------------------------------------------
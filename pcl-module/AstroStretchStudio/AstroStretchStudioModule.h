@@ -27,6 +27,14 @@ public:
    String TradeMarks() const override;
    String OriginalFileName() const override;
    void GetReleaseDate( int& year, int& month, int& day ) const override;
+   void OnLoad() override;
+
+   /*
+    * The maximum number of processors configured in PixInsight. Also applies
+    * it to the module's task scheduler, so that the setting is followed as
+    * soon as it changes.
+    */
+   static int NumberOfThreads();
 };
 
 // ----------------------------------------------------------------------------
@@ -0,0 +1,454 @@
+// ----------------------------------------------------------------------------
+// AstroStretchStudio Parallel Helpers
+// ----------------------------------------------------------------------------
+
+#ifndef __AstroStretchStudioParallel_h
+#define __AstroStretchStudioParallel_h
+
+#include <pcl/Defs.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pcl
+{
+
+// ----------------------------------------------------------------------------
+
+/*
+ * A set of tasks that are waited for together; see TaskScheduler. The first
+ * exception thrown by a task of the group is rethrown by Wait(). A group must
+ * not be destroyed while it has pending tasks, so the destructor waits for
+ * them.
+ */
+class TaskGroup
+{
+public:
+
+   TaskGroup() = default;
+   TaskGroup( const TaskGroup& ) = delete;
+   TaskGroup& operator =( const TaskGroup& ) = delete;
+
+   ~TaskGroup();
+
+   bool IsDone() const
+   {
+      return m_pending.load( std::memory_order_acquire ) == 0;
+   }
+
+private:
+
+   std::atomic<int>   m_pending{ 0 };
+   std::mutex         m_mutex;
+   std::exception_ptr m_error;
+
+   friend class TaskScheduler;
+};
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Module-wide work-stealing task scheduler.
+ *
+ * Worker threads are created on first use and persist until the module is
+ * unloaded. Each worker has its own queue: it runs its latest tasks first and,
+ * when idle, steals the oldest tasks of the others and of the shared queue
+ * that receives tasks from non-worker threads. A thread that waits for a
+ * group runs queued tasks meanwhile, so tasks may spawn and wait for nested
+ * tasks without blocking a worker.
+ *
+ * A task may depend on earlier ones: it is queued once all of them have
+ * finished, and skipped (as if it had failed) if any of them failed, so later
+ * stages can be queued before earlier ones are done.
+ *
+ * MaxThreads() - 1 workers run tasks. Each thread that waits for a group in
+ * Wait() also runs tasks meanwhile, so the cap applies to the workers plus
+ * every waiting thread: with a preview and an execution waiting at the same
+ * time, up to MaxThreads() + 1 threads may run tasks. In PixInsight
+ * MaxThreads() is kept at the configured maximum number of processors;
+ * standalone tools get the number of hardware threads.
+ *
+ * The scheduler uses plain standard threads instead of pcl::Thread so that
+ * the kernels can run outside a PixInsight session (benchmarks, command-line
+ * tools).
+ */
+class TaskScheduler
+{
+public:
+
+   struct Task
+   {
+      std::function<void()>             function;
+      TaskGroup*                        group = nullptr;
+      std::atomic<int>                  blockers{ 1 };
+      std::atomic<bool>                 skip{ false };
+      std::mutex                        mutex;
+      std::vector<std::shared_ptr<Task>> successors;
+      bool                              done = false;
+      bool                              failed = false;
+   };
+
+   typedef std::shared_ptr<Task> TaskHandle;
+
+   enum { MaxWorkers = 255 };
+
+   static TaskScheduler& Default()
+   {
+      static TaskScheduler scheduler;
+      return scheduler;
+   }
+
+   ~TaskScheduler()
+   {
+      {
+         std::lock_guard<std::mutex> lock( m_mutex );
+         m_stop = true;
+      }
+      m_work.notify_all();
+      for ( int i = 1; i <= m_numberOfWorkers.load(); ++i )
+         if ( m_queues[i].thread.joinable() )
+            m_queues[i].thread.join();
+   }
+
+   int MaxThreads() const
+   {
+      return m_maxThreads.load( std::memory_order_relaxed );
+   }
+
+   void SetMaxThreads( int n )
+   {
+      m_maxThreads.store( std::min( std::max( n, 1 ), int( MaxWorkers+1 ) ) );
+      m_work.notify_all();
+   }
+
+   /*
+    * Queues f() in group, to run once the tasks in after have finished.
+    * Returns a handle that later tasks can depend on.
+    */
+   template <class F>
+   TaskHandle Spawn( TaskGroup& group, F f, const std::vector<TaskHandle>& after = std::vector<TaskHandle>() )
+   {
+      TaskHandle task = std::make_shared<Task>();
+      task->function = std::function<void()>( std::move( f ) );
+      task->group = &group;
+      group.m_pending.fetch_add( 1, std::memory_order_relaxed );
+      for ( const TaskHandle& t : after )
+         if ( t )
+         {
+            std::lock_guard<std::mutex> lock( t->mutex );
+            if ( !t->done )
+            {
+               t->successors.push_back( task );
+               task->blockers.fetch_add( 1 );
+            }
+            else if ( t->failed )
+               task->skip = true;
+         }
+      if ( task->blockers.fetch_sub( 1 ) == 1 )
+         Enqueue( task );
+      return task;
+   }
+
+   /*
+    * Waits for the tasks of group, running queued tasks meanwhile, and
+    * rethrows the first exception thrown by any of them.
+    */
+   void Wait( TaskGroup& group )
+   {
+      const int self = CurrentWorker();
+      while ( !group.IsDone() )
+         if ( !RunOne( self ) )
+         {
+            std::unique_lock<std::mutex> lock( m_mutex );
+            m_done.wait_for( lock, std::chrono::milliseconds( 1 ),
+                             [&]() { return group.IsDone() || m_queued.load() > 0; } );
+         }
+
+      std::exception_ptr error;
+      {
+         std::lock_guard<std::mutex> lock( group.m_mutex );
+         std::swap( error, group.m_error );
+      }
+      if ( error )
+         std::rethrow_exception( error );
+   }
+
+   /*
+    * Waits up to ms milliseconds for the tasks of group, for threads that
+    * must stay responsive. Returns whether the group is done; exceptions are
+    * left for Wait().
+    *
+    * No task is run while workers can run them. Without active workers (a
+    * single thread), nothing else would, so one queued task is run instead
+    * of waiting; the call then takes as long as that task.
+    */
+   bool Wait( TaskGroup& group, unsigned ms )
+   {
+      if ( m_numberOfWorkers.load( std::memory_order_acquire ) == 0 || MaxThreads() == 1 )
+         if ( RunOne( CurrentWorker() ) )
+            return group.IsDone();
+
+      std::unique_lock<std::mutex> lock( m_mutex );
+      return m_done.wait_for( lock, std::chrono::milliseconds( ms ), [&]() { return group.IsDone(); } );
+   }
+
+private:
+
+   struct Queue
+   {
+      std::thread            thread;
+      std::mutex             mutex;
+      std::deque<TaskHandle> tasks;
+   };
+
+   // m_queues[0] is the shared queue; m_queues[i] belongs to worker i.
+   std::unique_ptr<Queue[]> m_queues{ new Queue[ MaxWorkers+1 ] };
+   std::atomic<int>         m_numberOfWorkers{ 0 };
+   std::atomic<int>         m_maxThreads{ std::max( 1, int( std::thread::hardware_concurrency() ) ) };
+   std::atomic<int>         m_queued{ 0 };
+   std::mutex               m_mutex;
+   std::condition_variable  m_work;
+   std::condition_variable  m_done;
+   bool                     m_stop = false;
+
+   TaskScheduler() = default;
+
+   // Worker index of the calling thread; zero if it is not a worker.
+   static int& CurrentWorker()
+   {
+      static thread_local int index = 0;
+      return index;
+   }
+
+   bool IsActive( int worker ) const
+   {
+      return worker < MaxThreads();
+   }
+
+   void Enqueue( const TaskHandle& task )
+   {
+      StartWorkers();
+      const int self = CurrentWorker();
+      Queue& q = m_queues[( self > 0 && IsActive( self ) ) ? self : 0];
+      {
+         std::lock_guard<std::mutex> lock( q.mutex );
+         q.tasks.push_back( task );
+      }
+      m_queued.fetch_add( 1 );
+      {
+         std::lock_guard<std::mutex> lock( m_mutex );
+      }
+      // Workers beyond a lowered MaxThreads() still sleep on m_work and
+      // would swallow a single notification, so all of them are woken.
+      m_work.notify_all();
+      m_done.notify_all();
+   }
+
+   void StartWorkers()
+   {
+      const int n = MaxThreads() - 1;
+      if ( m_numberOfWorkers.load( std::memory_order_acquire ) >= n )
+         return;
+      std::lock_guard<std::mutex> lock( m_mutex );
+      for ( int i = m_numberOfWorkers.load() + 1; i <= n; ++i )
+      {
+         m_queues[i].thread = std::thread( [this, i]() { WorkerLoop( i ); } );
+         m_numberOfWorkers.store( i, std::memory_order_release );
+      }
+   }
+
+   void WorkerLoop( int index )
+   {
+      CurrentWorker() = index;
+      for ( ;; )
+      {
+         if ( IsActive( index ) && RunOne( index ) )
+            continue;
+         std::unique_lock<std::mutex> lock( m_mutex );
+         m_work.wait( lock, [&]() { return m_stop || (IsActive( index ) && m_queued.load() > 0); } );
+         if ( m_stop )
+            return;
+      }
+   }
+
+   // Own queue from the back, then the other queues from the front.
+   TaskHandle Take( int self )
+   {
+      if ( self > 0 )
+      {
+         Queue& q = m_queues[self];
+         std::lock_guard<std::mutex> lock( q.mutex );
+         if ( !q.tasks.empty() )
+         {
+            TaskHandle task = q.tasks.back();
+            q.tasks.pop_back();
+            return task;
+         }
+      }
+
+      const int n = m_numberOfWorkers.load( std::memory_order_acquire ) + 1;
+      for ( int k = 1; k <= n; ++k )
+      {
+         const int i = (self + k)%n;
+         if ( i == self && self > 0 )
+            continue;
+         Queue& q = m_queues[i];
+         std::lock_guard<std::mutex> lock( q.mutex );
+         if ( !q.tasks.empty() )
+         {
+            TaskHandle task = q.tasks.front();
+            q.tasks.pop_front();
+            return task;
+         }
+      }
+      return TaskHandle();
+   }
+
+   bool RunOne( int self )
+   {
+      if ( m_queued.load() == 0 )
+         return false;
+      TaskHandle task = Take( self );
+      if ( !task )
+         return false;
+      m_queued.fetch_sub( 1 );
+      Run( task );
+      return true;
+   }
+
+   void Run( const TaskHandle& task )
+   {
+      bool failed = task->skip.load();
+      if ( !failed )
+         try
+         {
+            task->function();
+         }
+         catch ( ... )
+         {
+            failed = true;
+            std::lock_guard<std::mutex> lock( task->group->m_mutex );
+            if ( !task->group->m_error )
+               task->group->m_error = std::current_exception();
+         }
+      task->function = nullptr;
+
+      std::vector<TaskHandle> successors;
+      {
+         std::lock_guard<std::mutex> lock( task->mutex );
+         task->done = true;
+         task->failed = failed;
+         std::swap( successors, task->successors );
+      }
+      for ( const TaskHandle& s : successors )
+      {
+         if ( failed )
+            s->skip = true;
+         if ( s->blockers.fetch_sub( 1 ) == 1 )
+            Enqueue( s );
+      }
+
+      if ( task->group->m_pending.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+      {
+         {
+            std::lock_guard<std::mutex> lock( m_mutex );
+         }
+         m_done.notify_all();
+      }
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+inline TaskGroup::~TaskGroup()
+{
+   if ( !IsDone() )
+      try
+      {
+         TaskScheduler::Default().Wait( *this );
+      }
+      catch ( ... )
+      {
+      }
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Splits the half-open range [0,count) into contiguous bands and runs
+ * f( begin, end ) for each band as a task of the module's TaskScheduler. The
+ * calling thread processes the first band, then helps with the others.
+ * Exceptions thrown by any band are rethrown on the calling thread once all
+ * bands have finished.
+ *
+ * The bands depend only on count and numberOfThreads, never on how many
+ * threads the scheduler has, so results do not either.
+ */
+template <class F>
+void ParallelBands( int count, int numberOfThreads, F f )
+{
+   if ( count <= 0 )
+      return;
+
+   int n = numberOfThreads;
+   if ( n > count )
+      n = count;
+   if ( n <= 1 )
+   {
+      f( 0, count );
+      return;
+   }
+
+   TaskScheduler& scheduler = TaskScheduler::Default();
+   TaskGroup group;
+
+   int bandSize = count/n;
+   int remainder = count%n;
+   int begin = bandSize + ((remainder > 0) ? 1 : 0);
+   for ( int i = 1; i < n; ++i )
+   {
+      int end = begin + bandSize + ((i < remainder) ? 1 : 0);
+      scheduler.Spawn( group, [&f, begin, end]() { f( begin, end ); } );
+      begin = end;
+   }
+
+   std::exception_ptr error;
+   try
+   {
+      f( 0, bandSize + ((remainder > 0) ? 1 : 0) );
+   }
+   catch ( ... )
+   {
+      error = std::current_exception();
+   }
+
+   try
+   {
+      scheduler.Wait( group );
+   }
+   catch ( ... )
+   {
+      if ( !error )
+         error = std::current_exception();
+   }
+
+   if ( error )
+      std::rethrow_exception( error );
+}
+
+// ----------------------------------------------------------------------------
+
+} // namespace pcl
+
+#endif // __AstroStretchStudioParallel_h
+
+// ----------------------------------------------------------------------------
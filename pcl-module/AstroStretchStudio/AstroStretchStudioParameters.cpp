@@ -25,6 +25,7 @@ ASSSASHighlightProtection* TheASSSASHighlightProtectionParameter = nullptr;
 ASSSASNoiseThreshold*      TheASSSASNoiseThresholdParameter = nullptr;
 ASSSASFlattenBackground*   TheASSSASFlattenBackgroundParameter = nullptr;
 ASSSASPreserveColor*       TheASSSASPreserveColorParameter = nullptr;
+ASSSASLinkChannels*        TheASSSASLinkChannelsParameter = nullptr;
 
 // ----------------------------------------------------------------------------
 // Algorithm Selection
@@ -509,6 +510,23 @@ bool ASSSASPreserveColor::DefaultValue() const
 
 // ----------------------------------------------------------------------------
 
+ASSSASLinkChannels::ASSSASLinkChannels( MetaProcess* P ) : MetaBoolean( P )
+{
+   TheASSSASLinkChannelsParameter = this;
+}
+
+IsoString ASSSASLinkChannels::Id() const
+{
+   return "sasLinkChannels";
+}
+
+bool ASSSASLinkChannels::DefaultValue() const
+{
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+
 } // namespace pcl
 
 // ----------------------------------------------------------------------------
@@ -281,6 +281,19 @@ extern ASSSASPreserveColor* TheASSSASPreserveColorParameter;
 
 // ----------------------------------------------------------------------------
 
+class ASSSASLinkChannels : public MetaBoolean
+{
+public:
+   ASSSASLinkChannels( MetaProcess* );
+
+   IsoString Id() const override;
+   bool DefaultValue() const override;
+};
+
+extern ASSSASLinkChannels* TheASSSASLinkChannelsParameter;
+
+// ----------------------------------------------------------------------------
+
 PCL_END_LOCAL
 
 // ----------------------------------------------------------------------------
@@ -0,0 +1,433 @@
+// ----------------------------------------------------------------------------
+// AstroStretchStudio Preview Implementation
+// ----------------------------------------------------------------------------
+
+#include "AstroStretchStudioPreview.h"
+#include "AstroStretchStudioParallel.h"
+
+#include <pcl/Math.h>
+
+#include <cstring>
+
+namespace pcl
+{
+
+// ----------------------------------------------------------------------------
+
+PreviewRenderer::PreviewRenderer( int numberOfThreads )
+   : m_numberOfThreads( Max( 1, numberOfThreads ) )
+{
+}
+
+// ----------------------------------------------------------------------------
+
+int PreviewRenderer::FitReduction( int width, int height, int maxWidth, int maxHeight )
+{
+   if ( maxWidth <= 0 || maxHeight <= 0 )
+      return 1;
+   int reduction = Max( 1, Max( (width + maxWidth - 1)/maxWidth, (height + maxHeight - 1)/maxHeight ) );
+   while ( ProxySize( width, reduction ) > maxWidth || ProxySize( height, reduction ) > maxHeight )
+      ++reduction;
+   return reduction;
+}
+
+// ----------------------------------------------------------------------------
+
+void PreviewRenderer::Downsample( Image& proxy, const ImageVariant& image, int reduction, const Rect& rect ) const
+{
+   if ( image.IsComplexSample() )
+      return;
+
+   if ( image.IsFloatSample() )
+      switch ( image.BitsPerSample() )
+      {
+      case 32: Downsample( proxy, static_cast<const Image&>( *image ), reduction, rect ); break;
+      case 64: Downsample( proxy, static_cast<const DImage&>( *image ), reduction, rect ); break;
+      }
+   else
+      switch ( image.BitsPerSample() )
+      {
+      case  8: Downsample( proxy, static_cast<const UInt8Image&>( *image ), reduction, rect ); break;
+      case 16: Downsample( proxy, static_cast<const UInt16Image&>( *image ), reduction, rect ); break;
+      case 32: Downsample( proxy, static_cast<const UInt32Image&>( *image ), reduction, rect ); break;
+      }
+}
+
+// ----------------------------------------------------------------------------
+
+template <class P>
+void PreviewRenderer::Downsample( Image& proxy, const GenericImage<P>& image, int reduction, const Rect& rect ) const
+{
+   typedef typename P::sample sample;
+
+   reduction = Max( 1, reduction );
+   const int w = image.Width();
+   const Rect r = rect.IsRect() ? rect.Intersection( Rect( image.Width(), image.Height() ) )
+                                : Rect( image.Width(), image.Height() );
+   const int rw = Max( 0, r.Width() );
+   const int rh = Max( 0, r.Height() );
+   const int nc = (image.NumberOfNominalChannels() >= 3) ? 3 : 1;
+   const int pw = ProxySize( rw, reduction );
+   const int ph = ProxySize( rh, reduction );
+
+   proxy.AllocateData( pw, ph, nc, (nc == 3) ? ColorSpace::RGB : ColorSpace::Gray );
+
+   for ( int c = 0; c < nc; ++c )
+   {
+      const sample* src = image.PixelData( c ) + size_type( r.y0 )*w + r.x0;
+      float* dst = proxy.PixelData( c );
+
+      // Each band of proxy rows reads its own block of source rows.
+      ParallelBands( ph, m_numberOfThreads,
+         [=]( int py0, int py1 )
+         {
+            Array<double> sums( size_type( pw ), 0.0 );
+            for ( int py = py0; py < py1; ++py )
+            {
+               const int y0 = py*reduction;
+               const int y1 = Min( y0 + reduction, rh );
+               for ( double& s : sums )
+                  s = 0;
+               for ( int y = y0; y < y1; ++y )
+               {
+                  const sample* row = src + size_type( y )*w;
+                  for ( int px = 0, x = 0; px < pw; ++px )
+                  {
+                     const int x1 = Min( x + reduction, rw );
+                     double s = 0;
+                     for ( ; x < x1; ++x )
+                        s += P::ToDouble( row[x] );
+                     sums[px] += s;
+                  }
+               }
+
+               float* out = dst + size_type( py )*pw;
+               const int rows = y1 - y0;
+               for ( int px = 0; px < pw; ++px )
+               {
+                  const int cols = Min( (px + 1)*reduction, rw ) - px*reduction;
+                  out[px] = float( sums[px]/(rows*cols) );
+               }
+            }
+         } );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+int PreviewRenderer::NumberOfLevels( int width, int height )
+{
+   int levels = 1;
+   for ( int reduction = 1; ProxySize( width, reduction ) > TileSize || ProxySize( height, reduction ) > TileSize; reduction <<= 1 )
+      ++levels;
+   return levels;
+}
+
+// ----------------------------------------------------------------------------
+
+Rect PreviewRenderer::TileRect( int width, int height, int level, int tileX, int tileY )
+{
+   const int span = TileSize << level;
+   return Rect( tileX*span, tileY*span, tileX*span + span, tileY*span + span ).Intersection( Rect( width, height ) );
+}
+
+// ----------------------------------------------------------------------------
+
+Rect PreviewRenderer::TileContextRect( int width, int height, int level, int tileX, int tileY, int margin )
+{
+   const int reduction = 1 << level;
+   margin = (Max( 0, margin ) + reduction - 1)/reduction*reduction;
+   Rect r = TileRect( width, height, level, tileX, tileY );
+   return Rect( r.x0 - margin, r.y0 - margin, r.x1 + margin, r.y1 + margin ).Intersection( Rect( width, height ) );
+}
+
+// ----------------------------------------------------------------------------
+
+void PreviewRenderer::ToRGBA( ByteArray& rgba, const Image& image ) const
+{
+   const int w = image.Width();
+   const int h = image.Height();
+   const bool color = image.NumberOfChannels() >= 3;
+   const float* R = image.PixelData( 0 );
+   const float* G = image.PixelData( color ? 1 : 0 );
+   const float* B = image.PixelData( color ? 2 : 0 );
+
+   // The buffer of a previous image of the same size is reused.
+   if ( rgba.Length() != size_type( w )*h*4 )
+      rgba = ByteArray( size_type( w )*h*4 );
+   uint8* out = rgba.Begin();
+
+   ParallelBands( h, m_numberOfThreads,
+      [=]( int y0, int y1 )
+      {
+         for ( size_type i = size_type( y0 )*w, end = size_type( y1 )*w; i < end; ++i )
+         {
+            uint8* p = out + 4*i;
+            p[0] = uint8( Range( R[i], 0.0f, 1.0f )*255 );
+            p[1] = uint8( Range( G[i], 0.0f, 1.0f )*255 );
+            p[2] = uint8( Range( B[i], 0.0f, 1.0f )*255 );
+            p[3] = 255;
+         }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+void PreviewRenderer::ContactSheet( Image& sheet, const Array<Image>& cells, int columns, int gap ) const
+{
+   if ( cells.IsEmpty() )
+   {
+      sheet.FreeData();
+      return;
+   }
+
+   const int n = int( cells.Length() );
+   const int cw = cells[0].Width();
+   const int ch = cells[0].Height();
+   const int rows = (n + columns - 1)/columns;
+   int nc = 1;
+   for ( const Image& cell : cells )
+      if ( cell.NumberOfChannels() >= 3 )
+         nc = 3;
+
+   sheet.AllocateData( columns*cw + (columns - 1)*gap, rows*ch + (rows - 1)*gap, nc,
+                       (nc == 3) ? ColorSpace::RGB : ColorSpace::Gray );
+   sheet.Zero();
+   const int W = sheet.Width();
+
+   ParallelBands( n, m_numberOfThreads,
+      [&]( int i0, int i1 )
+      {
+         for ( int i = i0; i < i1; ++i )
+         {
+            const Image& cell = cells[i];
+            const size_type origin = size_type( (i/columns)*(ch + gap) )*W + (i%columns)*(cw + gap);
+            for ( int c = 0; c < nc; ++c )
+            {
+               const float* src = cell.PixelData( (cell.NumberOfChannels() >= 3) ? c : 0 );
+               float* dst = sheet.PixelData( c ) + origin;
+               for ( int y = 0; y < ch; ++y )
+                  std::memcpy( dst + size_type( y )*W, src + size_type( y )*cw, cw*sizeof( float ) );
+            }
+         }
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+void PreviewRenderer::ToUInt16Deltas( ByteArray& data, const Image& image ) const
+{
+   const int w = image.Width();
+   const int h = image.Height();
+   const int nc = image.NumberOfChannels();
+
+   data = ByteArray( size_type( w )*h*nc*2 );
+
+   for ( int c = 0; c < nc; ++c )
+   {
+      const float* src = image.PixelData( c );
+      uint8* dst = data.Begin() + size_type( c )*h*w*2;
+
+      ParallelBands( h, m_numberOfThreads,
+         [=]( int y0, int y1 )
+         {
+            for ( int y = y0; y < y1; ++y )
+            {
+               const float* row = src + size_type( y )*w;
+               uint8* lo = dst + size_type( y )*w*2;
+               uint8* hi = lo + w;
+               uint16 prev = 0;
+               for ( int x = 0; x < w; ++x )
+               {
+                  uint16 q = uint16( RoundInt( Range( row[x], 0.0f, 1.0f )*65535 ) );
+                  uint16 d = uint16( q - prev );
+                  lo[x] = uint8( d );
+                  hi[x] = uint8( d >> 8 );
+                  prev = q;
+               }
+            }
+         } );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+PreviewLatencyController::PreviewLatencyController( double targetSeconds )
+   : m_target( targetSeconds )
+{
+   Reset();
+}
+
+// ----------------------------------------------------------------------------
+
+int PreviewLatencyController::NumberOfLevels( int width, int height )
+{
+   int levels = 1;
+   while ( levels <= MaxLevel
+        && Min( PreviewRenderer::ProxySize( width, 1 << levels ),
+                PreviewRenderer::ProxySize( height, 1 << levels ) ) >= MinLevelSize )
+      ++levels;
+   return levels;
+}
+
+// ----------------------------------------------------------------------------
+
+int PreviewLatencyController::StartLevel( int width, int height ) const
+{
+   const int levels = NumberOfLevels( width, height );
+   for ( int k = 0; k < levels; ++k )
+   {
+      double s = SecondsPerPixel( k );
+      if ( s >= 0 )
+      {
+         double pixels = double( PreviewRenderer::ProxySize( width, 1 << k ) )
+                               * PreviewRenderer::ProxySize( height, 1 << k );
+         if ( s*pixels <= m_target )
+            return k;
+      }
+   }
+   return levels - 1;
+}
+
+// ----------------------------------------------------------------------------
+
+void PreviewLatencyController::AddMeasurement( int level, size_type pixels, double seconds )
+{
+   if ( level < 0 || level > MaxLevel || pixels == 0 )
+      return;
+
+   // Render times vary with the stages the cache lets a run skip, so the
+   // average follows recent runs closely.
+   const double smoothing = 0.3;
+   double s = seconds/pixels;
+   double& m = m_secondsPerPixel[level];
+   m = (m < 0) ? s : m + smoothing*(s - m);
+}
+
+// ----------------------------------------------------------------------------
+
+void PreviewLatencyController::Reset()
+{
+   for ( double& s : m_secondsPerPixel )
+      s = -1;
+}
+
+// ----------------------------------------------------------------------------
+
+double PreviewLatencyController::SecondsPerPixel( int level ) const
+{
+   for ( int d = 0; d <= MaxLevel; ++d )
+   {
+      if ( level-d >= 0 && m_secondsPerPixel[level-d] >= 0 )
+         return m_secondsPerPixel[level-d];
+      if ( level+d <= MaxLevel && m_secondsPerPixel[level+d] >= 0 )
+         return m_secondsPerPixel[level+d];
+   }
+   return -1;
+}
+
+// ----------------------------------------------------------------------------
+
+PreviewTileCache::PreviewTileCache( size_type maxBytes )
+   : m_maxBytes( maxBytes )
+{
+}
+
+// ----------------------------------------------------------------------------
+
+uint32 PreviewTileCache::Revision( const IsoString& viewId ) const
+{
+   for ( const ViewRevision& r : m_revisions )
+      if ( r.viewId == viewId )
+         return r.revision;
+   return 0;
+}
+
+// ----------------------------------------------------------------------------
+
+void PreviewTileCache::ImageChanged( const IsoString& viewId )
+{
+   bool found = false;
+   for ( ViewRevision& r : m_revisions )
+      if ( r.viewId == viewId )
+      {
+         ++r.revision;
+         found = true;
+         break;
+      }
+   if ( !found )
+      m_revisions.Add( ViewRevision{ viewId, 1 } );
+
+   for ( size_type i = m_entries.Length(); i > 0; --i )
+      if ( m_entries[i-1].key.viewId == viewId )
+         Remove( i-1 );
+}
+
+// ----------------------------------------------------------------------------
+
+const ByteArray* PreviewTileCache::Find( const PreviewTileKey& key, int& width, int& height )
+{
+   for ( Entry& e : m_entries )
+      if ( e.key == key )
+      {
+         e.lastUse = ++m_useCount;
+         width = e.width;
+         height = e.height;
+         return &e.rgba;
+      }
+   return nullptr;
+}
+
+// ----------------------------------------------------------------------------
+
+void PreviewTileCache::Add( const PreviewTileKey& key, const ByteArray& rgba, int width, int height )
+{
+   int w, h;
+   if ( Find( key, w, h ) != nullptr )
+      return;
+
+   // Evict least recently used tiles until the new one fits.
+   while ( !m_entries.IsEmpty() && m_bytes + rgba.Length() > m_maxBytes )
+   {
+      size_type oldest = 0;
+      for ( size_type i = 1; i < m_entries.Length(); ++i )
+         if ( m_entries[i].lastUse < m_entries[oldest].lastUse )
+            oldest = i;
+      Remove( oldest );
+   }
+
+   m_entries.Add( Entry{ key, rgba, width, height, ++m_useCount } );
+   m_bytes += rgba.Length();
+}
+
+// ----------------------------------------------------------------------------
+
+void PreviewTileCache::Clear()
+{
+   m_entries.Clear();
+   m_bytes = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+void PreviewTileCache::Remove( size_type index )
+{
+   m_bytes -= m_entries[index].rgba.Length();
+   m_entries.Remove( m_entries.At( index ) );
+}
+
+// ----------------------------------------------------------------------------
+// Explicit instantiations
+// ----------------------------------------------------------------------------
+
+template void PreviewRenderer::Downsample( Image&, const Image&, int, const Rect& ) const;
+template void PreviewRenderer::Downsample( Image&, const DImage&, int, const Rect& ) const;
+template void PreviewRenderer::Downsample( Image&, const UInt8Image&, int, const Rect& ) const;
+template void PreviewRenderer::Downsample( Image&, const UInt16Image&, int, const Rect& ) const;
+template void PreviewRenderer::Downsample( Image&, const UInt32Image&, int, const Rect& ) const;
+
+// ----------------------------------------------------------------------------
+
+} // namespace pcl
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,232 @@
+// ----------------------------------------------------------------------------
+// AstroStretchStudio Preview Header
+// ----------------------------------------------------------------------------
+
+#ifndef __AstroStretchStudioPreview_h
+#define __AstroStretchStudioPreview_h
+
+#include <pcl/Array.h>
+#include <pcl/ByteArray.h>
+#include <pcl/Image.h>
+#include <pcl/ImageVariant.h>
+#include <pcl/Rectangle.h>
+#include <pcl/String.h>
+
+namespace pcl
+{
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Reduced renditions of an image for the WebView preview.
+ *
+ * Proxies are area averaged: each proxy pixel is the mean of a block of
+ * reduction x reduction source pixels (partial blocks at the right and
+ * bottom edges average the pixels they cover). Only the nominal channels are
+ * kept; alpha channels are ignored.
+ *
+ * For deep zoom, the image is also served as a pyramid of TileSize x TileSize
+ * tiles: level n is the image reduced by 2^n, and tile (x,y) of a level
+ * covers its pixels [x*TileSize,(x+1)*TileSize) x [y*TileSize,(y+1)*TileSize).
+ * The last level fits in one tile.
+ */
+class PreviewRenderer
+{
+public:
+
+   enum { TileSize = 256 };
+
+   PreviewRenderer( int numberOfThreads );
+
+   /*
+    * Smallest integer reduction for which a width x height image fits in
+    * maxWidth x maxHeight pixels.
+    */
+   static int FitReduction( int width, int height, int maxWidth, int maxHeight );
+
+   // Proxy width or height for a source dimension of size pixels.
+   static int ProxySize( int size, int reduction )
+   {
+      return (size + reduction - 1)/reduction;
+   }
+
+   /*
+    * Area-averaged proxy of the image, or of a rectangular region of it if
+    * rect is not empty. The region is clipped to the image, and blocks are
+    * aligned to its top left corner.
+    */
+   void Downsample( Image& proxy, const ImageVariant& image, int reduction, const Rect& rect = Rect( 0 ) ) const;
+
+   template <class P>
+   void Downsample( Image& proxy, const GenericImage<P>& image, int reduction, const Rect& rect = Rect( 0 ) ) const;
+
+   // Number of pyramid levels of a width x height image.
+   static int NumberOfLevels( int width, int height );
+
+   // Source image region covered by a tile.
+   static Rect TileRect( int width, int height, int level, int tileX, int tileY );
+
+   /*
+    * Source image region needed to render a tile with filters reaching
+    * margin source pixels: the tile's region extended by the margin, rounded
+    * up to whole tile pixels, and clipped to the image. Blocks of the level
+    * aligned to its top left corner are also aligned to the tile's.
+    */
+   static Rect TileContextRect( int width, int height, int level, int tileX, int tileY, int margin );
+
+   // 8-bit RGBA pixels, row by row; grayscale is replicated to R, G and B.
+   // The memory of rgba is reused if it has the right size.
+   void ToRGBA( ByteArray& rgba, const Image& image ) const;
+
+   /*
+    * Contact sheet of equally sized cells, placed row by row in the given
+    * number of columns and separated by gap black pixels. The sheet is RGB if
+    * any cell is; grayscale cells are then replicated to the three channels.
+    */
+   void ContactSheet( Image& sheet, const Array<Image>& cells, int columns, int gap ) const;
+
+   /*
+    * 16-bit samples prepared for lossless compression: values are quantized
+    * to [0,65535] and each row is delta encoded (every sample minus its left
+    * neighbor, modulo 2^16, the first one minus zero). The deltas of a row
+    * are stored as w low bytes followed by w high bytes. Rows are stored in
+    * order, channel by channel.
+    */
+   void ToUInt16Deltas( ByteArray& data, const Image& image ) const;
+
+private:
+
+   int m_numberOfThreads;
+};
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Chooses the level at which a progressive preview starts. Level k is the
+ * proxy reduced by 2^k; after the first level is shown, the preview is
+ * refined one level at a time down to level zero (the proxy itself) while
+ * the parameters stay unchanged.
+ *
+ * The controller keeps a moving average of the render time per pixel of
+ * each level, measured on actual renders, and starts at the finest level
+ * whose predicted render time meets the latency target. Levels that have not
+ * been measured yet borrow the estimate of the nearest measured one; with no
+ * measurements at all, previews start at the coarsest level.
+ */
+class PreviewLatencyController
+{
+public:
+
+   enum { MaxLevel = 3,       // 1/8 of the proxy
+          MinLevelSize = 32 }; // coarser levels are not worth rendering
+
+   PreviewLatencyController( double targetSeconds = 0.05 );
+
+   double Target() const
+   {
+      return m_target;
+   }
+
+   // Number of levels of a width x height proxy, at least one.
+   static int NumberOfLevels( int width, int height );
+
+   int StartLevel( int width, int height ) const;
+
+   // Records the render time of a level with the given number of pixels.
+   void AddMeasurement( int level, size_type pixels, double seconds );
+
+   void Reset();
+
+private:
+
+   double m_target;
+   double m_secondsPerPixel[ MaxLevel+1 ]; // negative if not measured
+
+   double SecondsPerPixel( int level ) const;
+};
+
+// ----------------------------------------------------------------------------
+
+struct PreviewTileKey
+{
+   IsoString viewId;
+   uint32    revision = 0;
+   uint32    parameters = 0; // serial of the stretch parameters
+   int       level = 0;
+   int       x = 0;
+   int       y = 0;
+
+   bool operator ==( const PreviewTileKey& k ) const
+   {
+      return x == k.x && y == k.y && level == k.level && parameters == k.parameters && revision == k.revision
+          && viewId == k.viewId;
+   }
+};
+
+/*
+ * Least recently used cache of rendered pyramid tiles, limited by the total
+ * size of their pixel data. Tiles are keyed by view, image revision, stretch
+ * parameters, level and position; starting a new revision of a view drops
+ * its older tiles. Parameters are identified by a serial number that the
+ * owner bumps whenever they change.
+ *
+ * A few hundred tiles at most are cached, so entries are kept in a plain
+ * array and looked up linearly.
+ */
+class PreviewTileCache
+{
+public:
+
+   PreviewTileCache( size_type maxBytes = 256*1024*1024 );
+
+   // Current image revision of a view; zero until the view changes.
+   uint32 Revision( const IsoString& viewId ) const;
+
+   // Starts a new revision of a view's image.
+   void ImageChanged( const IsoString& viewId );
+
+   // The cached pixels of a tile, or nullptr. Marks the tile as used.
+   const ByteArray* Find( const PreviewTileKey& key, int& width, int& height );
+
+   void Add( const PreviewTileKey& key, const ByteArray& rgba, int width, int height );
+
+   void Clear();
+
+   size_type Bytes() const
+   {
+      return m_bytes;
+   }
+
+private:
+
+   struct Entry
+   {
+      PreviewTileKey key;
+      ByteArray      rgba;
+      int            width;
+      int            height;
+      uint64         lastUse;
+   };
+
+   struct ViewRevision
+   {
+      IsoString viewId;
+      uint32    revision;
+   };
+
+   Array<Entry>        m_entries;
+   Array<ViewRevision> m_revisions;
+   size_type           m_bytes = 0;
+   size_type           m_maxBytes;
+   uint64              m_useCount = 0;
+
+   void Remove( size_type index );
+};
+
+// ----------------------------------------------------------------------------
+
+} // namespace pcl
+
+#endif // __AstroStretchStudioPreview_h
+
+// ----------------------------------------------------------------------------
@@ -37,6 +37,7 @@ AstroStretchStudioProcess::AstroStretchStudioProcess()
    new ASSSASNoiseThreshold( this );
    new ASSSASFlattenBackground( this );
    new ASSSASPreserveColor( this );
+   new ASSSASLinkChannels( this );
 }
 
 // ----------------------------------------------------------------------------
@@ -137,7 +138,7 @@ bool AstroStretchStudioProcess::CanProcessViews() const
 
 bool AstroStretchStudioProcess::CanProcessGlobal() const
 {
-   return false;
+   return true;
 }
 
 // ----------------------------------------------------------------------------
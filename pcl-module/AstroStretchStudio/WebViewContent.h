@@ -691,33 +691,357 @@ Error generating stack: `+o.message+`
         }
     };
 
+    // Report the viewport size in device pixels, so that PCL can fit the
+    // image proxy to it. Resizes are reported once they settle.
+    function pclReportViewport() {
+        const ratio = window.devicePixelRatio || 1;
+        window.pclSendMessage(JSON.stringify({
+            type: 'viewport',
+            width: Math.round(window.innerWidth * ratio),
+            height: Math.round(window.innerHeight * ratio)
+        }));
+    }
+    let pclViewportTimer = 0;
+    window.addEventListener('resize', function() {
+        clearTimeout(pclViewportTimer);
+        pclViewportTimer = setTimeout(pclReportViewport, 250);
+    });
+    pclReportViewport();
+
+    // The image arrives as a reduced proxy; this fetches it at full resolution.
+    window.pclRequestFullImage = function() {
+        window.pclSendMessage(JSON.stringify({ type: 'requestImage', full: true }));
+    };
+
+    // Deep zoom tiles: level n is the image reduced by 2^n, cut into
+    // tileSize x tileSize tiles, and stretched with the current parameters.
+    // Tiles not yet received are requested, one message per run of missing
+    // tiles; the page requests those of the visible region whenever it
+    // changes, since the module only renders a viewport's worth of the
+    // latest requests. Tiles arrive as pclTile events.
+    let pclTileRevision = -1;
+    let pclTileStretch = -1;
+    const pclTiles = new Set();
+    window.pclRequestTiles = function(level, x0, y0, x1, y1) {
+        for (let y = y0; y < y1; y++) {
+            for (let x = x0; x < x1; ) {
+                if (pclTiles.has(level + ':' + x + ':' + y)) {
+                    x++;
+                    continue;
+                }
+                const start = x;
+                while (x < x1 && !pclTiles.has(level + ':' + x + ':' + y)) {
+                    x++;
+                }
+                window.pclSendMessage(JSON.stringify({
+                    type: 'requestTiles', level: level, x0: start, y0: y, x1: x, y1: y + 1
+                }));
+            }
+        }
+    };
+    // A new image or new parameters (a higher stretch serial) invalidate the
+    // tiles received so far; a pclTilesReset event tells the page to drop
+    // them and request the visible ones again.
+    function pclResetTiles(revision, stretch) {
+        pclTileRevision = revision;
+        pclTileStretch = Math.max(pclTileStretch, stretch);
+        pclTiles.clear();
+        window.dispatchEvent(new CustomEvent('pclTilesReset'));
+    }
+
+    // Stretches the proxy with the native engine in the background; the
+    // result arrives as pclPreview events. parameters is optional and has
+    // the same layout as a parametersChanged message, which this call then
+    // replaces: the page calls it on every parameter change. Previews are
+    // progressive: a coarse level comes first, then finer ones follow while
+    // the parameters stay unchanged, down to level 0 (the proxy itself).
+    window.pclComputePreview = function(parameters) {
+        window.pclSendMessage(JSON.stringify(Object.assign({ type: 'computePreview' }, parameters || {})));
+    };
+
+    // Requests the histograms of the image and of the native preview with
+    // the given number of bins (256 by default). They arrive as pclHistogram
+    // events, and are sent again whenever the image or the preview changes.
+    window.pclRequestHistogram = function(bins) {
+        window.pclSendMessage(JSON.stringify({ type: 'requestHistogram', bins: bins || 256 }));
+    };
+
+    // Apply runs in the background: pclApplyStatus events report its state
+    // ('running', then 'done', 'cancelled' or 'failed') and the fraction
+    // done. This cancels it; the view is left unchanged.
+    window.pclCancelApply = function() {
+        window.pclSendMessage(JSON.stringify({ type: 'cancelApply' }));
+    };
+
+    // Scores candidate parameter sets on a small rendition of the proxy and
+    // adopts the best one: it arrives as pclParameters and pclPreview events,
+    // and a pclAutoTuneResult event reports its score. background is the
+    // sky level aimed at (0.15 by default).
+    window.pclAutoTune = function(background) {
+        const msg = { type: 'autoTune' };
+        if (background !== undefined) {
+            msg.background = background;
+        }
+        window.pclSendMessage(JSON.stringify(msg));
+    };
+
+    // Renders a contact sheet of previews over two parameters, delivered as
+    // a pclSweep event. Each axis is { parameter: process parameter id,
+    // from: a, to: b, steps: n } with at most 8 steps; columns vary x and
+    // rows vary y. The parameters themselves are left unchanged.
+    window.pclSweep = function(x, y) {
+        window.pclSendMessage(JSON.stringify({ type: 'sweep', x: x, y: y }));
+    };
+
+    // Decode base64 little-endian bin counts, one Uint32Array per channel
+    function pclDecodeHistograms(histograms, bins) {
+        if (!histograms) {
+            return null;
+        }
+        const binaryString = atob(histograms.data);
+        const view = new DataView(new ArrayBuffer(binaryString.length));
+        for (let i = 0; i < binaryString.length; i++) {
+            view.setUint8(i, binaryString.charCodeAt(i));
+        }
+        const channels = [];
+        for (let c = 0; c < histograms.channels; c++) {
+            const counts = new Uint32Array(bins);
+            for (let i = 0; i < bins; i++) {
+                counts[i] = view.getUint32(4*(c*bins + i), true);
+            }
+            channels.push(counts);
+        }
+        return channels;
+    }
+
+    // Decode base64 data
+    function pclDecodeBase64(data) {
+        const binaryString = atob(data);
+        const bytes = new Uint8Array(binaryString.length);
+        for (let i = 0; i < binaryString.length; i++) {
+            bytes[i] = binaryString.charCodeAt(i);
+        }
+        return bytes;
+    }
+
+    // Decode base64 RGBA pixels
+    function pclDecodeImage(data, width, height) {
+        return new ImageData(new Uint8ClampedArray(pclDecodeBase64(data).buffer), width, height);
+    }
+
+    // Decode an LZ4 block of size bytes into dst from offset on. Returns
+    // false if the block is malformed: it reads past its input, refers to
+    // data before offset, or does not decode to exactly size bytes.
+    function pclDecodeLZ4(src, dst, offset, size) {
+        const end = offset + size;
+        if (end > dst.length) {
+            return false;
+        }
+        let i = 0;
+        let o = offset;
+        // Extended length: bytes added while they are 255
+        const extend = function(length) {
+            let b;
+            do {
+                if (i >= src.length) {
+                    return -1;
+                }
+                b = src[i++];
+                length += b;
+            } while (b === 255);
+            return length;
+        };
+        while (i < src.length) {
+            const token = src[i++];
+            let length = token >> 4;
+            if (length === 15 && (length = extend(length)) < 0) {
+                return false;
+            }
+            if (i + length > src.length || o + length > end) {
+                return false;
+            }
+            dst.set(src.subarray(i, i + length), o);
+            i += length;
+            o += length;
+            if (i >= src.length) {
+                break;
+            }
+            if (i + 2 > src.length) {
+                return false;
+            }
+            let match = o - (src[i] | (src[i + 1] << 8));
+            i += 2;
+            if (match < offset || match >= o) {
+                return false;
+            }
+            length = token & 15;
+            if (length === 15 && (length = extend(length)) < 0) {
+                return false;
+            }
+            length += 4;
+            if (o + length > end) {
+                return false;
+            }
+            // Matches may overlap their own output
+            while (length-- > 0) {
+                dst[o++] = dst[match++];
+            }
+        }
+        return o === end;
+    }
+
+    // The image proxy is announced by setImage and arrives in setImageChunk
+    // messages: 16-bit samples, row delta encoded as w low bytes followed by
+    // w high bytes per row, channel by channel, in raw or LZ4 chunks.
+    let pclImage = null;
+    function pclFinishImage(msg, bytes) {
+        const w = msg.width;
+        const h = msg.height;
+        const planes = [];
+        for (let c = 0; c < msg.channels; c++) {
+            const plane = new Uint16Array(w * h);
+            for (let y = 0; y < h; y++) {
+                const lo = (c * h + y) * w * 2;
+                const hi = lo + w;
+                let v = 0;
+                for (let x = 0; x < w; x++) {
+                    v = (v + (bytes[lo + x] | (bytes[hi + x] << 8))) & 65535;
+                    plane[y * w + x] = v;
+                }
+            }
+            planes.push(plane);
+        }
+
+        const R = planes[0];
+        const G = planes[(msg.channels >= 3) ? 1 : 0];
+        const B = planes[(msg.channels >= 3) ? 2 : 0];
+        const rgba = new Uint8ClampedArray(w * h * 4);
+        for (let i = 0; i < w * h; i++) {
+            rgba[4 * i] = (R[i] * 255 / 65535) | 0;
+            rgba[4 * i + 1] = (G[i] * 255 / 65535) | 0;
+            rgba[4 * i + 2] = (B[i] * 255 / 65535) | 0;
+            rgba[4 * i + 3] = 255;
+        }
+
+        // Dispatch custom events for React app. The proxy is
+        // fullWidth x fullHeight reduced by an integer factor.
+        window.dispatchEvent(new CustomEvent('pclImageInfo', { detail: {
+            width: w,
+            height: h,
+            channels: msg.channels,
+            bitsPerSample: 16,
+            fullWidth: msg.fullWidth,
+            fullHeight: msg.fullHeight,
+            reduction: msg.reduction,
+            tileSize: msg.tileSize,
+            levels: msg.levels,
+            revision: msg.revision
+        } }));
+        window.dispatchEvent(new CustomEvent('pclImageData', { detail: new ImageData(rgba, w, h) }));
+        window.dispatchEvent(new CustomEvent('pclImageData16', { detail: {
+            width: w,
+            height: h,
+            channels: planes
+        } }));
+    }
+
     // Listen for messages from PCL
     window.addEventListener('message', function(event) {
         if (event.data && event.data.type) {
             // Handle incoming messages from PCL
             const msg = event.data;
 
-            if (msg.type === 'setImage' && msg.data) {
-                // Decode base64 image data
-                const binaryString = atob(msg.data);
-                const bytes = new Uint8Array(binaryString.length);
-                for (let i = 0; i < binaryString.length; i++) {
-                    bytes[i] = binaryString.charCodeAt(i);
+            if (msg.type === 'setImage') {
+                pclResetTiles(msg.revision, pclTileStretch);
+                pclImage = { header: msg, bytes: new Uint8Array(msg.size), received: 0 };
+            }
+            else if (msg.type === 'setImageChunk' && pclImage && msg.serial === pclImage.header.serial) {
+                const data = pclDecodeBase64(msg.data);
+                let valid;
+                if (msg.compression === 'lz4') {
+                    valid = pclDecodeLZ4(data, pclImage.bytes, msg.offset, msg.size);
+                } else {
+                    valid = data.length === msg.size && msg.offset + msg.size <= pclImage.bytes.length;
+                    if (valid) {
+                        pclImage.bytes.set(data, msg.offset);
+                    }
                 }
-
-                // Create ImageData
-                const imageData = new ImageData(
-                    new Uint8ClampedArray(bytes.buffer),
-                    msg.width,
-                    msg.height
-                );
-
-                // Dispatch custom event for React app
-                window.dispatchEvent(new CustomEvent('pclImageData', { detail: imageData }));
+                // A corrupt chunk drops the whole image.
+                if (!valid) {
+                    console.error('AstroStretchStudio: corrupt image chunk at offset ' + msg.offset);
+                    pclImage = null;
+                }
+                else if (++pclImage.received === pclImage.header.chunks) {
+                    pclFinishImage(pclImage.header, pclImage.bytes);
+                    pclImage = null;
+                }
+            }
+            else if (msg.type === 'setTile' && msg.data) {
+                // Tiles of an older image or older parameters are dropped.
+                if (msg.revision !== pclTileRevision || msg.stretch < pclTileStretch) {
+                    return;
+                }
+                if (msg.stretch > pclTileStretch) {
+                    pclResetTiles(msg.revision, msg.stretch);
+                }
+                pclTiles.add(msg.level + ':' + msg.x + ':' + msg.y);
+                window.dispatchEvent(new CustomEvent('pclTile', { detail: {
+                    level: msg.level,
+                    x: msg.x,
+                    y: msg.y,
+                    revision: msg.revision,
+                    image: pclDecodeImage(msg.data, msg.width, msg.height)
+                } }));
+            }
+            else if (msg.type === 'setPreview' && msg.data) {
+                if (msg.stretch > pclTileStretch) {
+                    pclResetTiles(pclTileRevision, msg.stretch);
+                }
+                window.dispatchEvent(new CustomEvent('pclPreview', { detail: {
+                    reduction: msg.reduction,
+                    level: msg.level || 0,
+                    elapsed: msg.elapsed,
+                    image: pclDecodeImage(msg.data, msg.width, msg.height)
+                } }));
+            }
+            else if (msg.type === 'setHistogram') {
+                // source or result is null when that part was not sent. A
+                // predicted result has a single luminance channel.
+                window.dispatchEvent(new CustomEvent('pclHistogram', { detail: {
+                    bins: msg.bins,
+                    predicted: !!msg.predicted,
+                    source: pclDecodeHistograms(msg.source, msg.bins),
+                    result: pclDecodeHistograms(msg.result, msg.bins)
+                } }));
             }
             else if (msg.type === 'setParameters') {
                 window.dispatchEvent(new CustomEvent('pclParameters', { detail: msg }));
             }
+            else if (msg.type === 'applyStatus') {
+                window.dispatchEvent(new CustomEvent('pclApplyStatus', { detail: {
+                    state: msg.state,
+                    view: msg.view,
+                    progress: msg.progress
+                } }));
+            }
+            else if (msg.type === 'autoTuneResult') {
+                window.dispatchEvent(new CustomEvent('pclAutoTuneResult', { detail: msg }));
+            }
+            else if (msg.type === 'setSweep' && msg.data) {
+                // x.values[c] and y.values[r] are the values of cell (c,r).
+                window.dispatchEvent(new CustomEvent('pclSweep', { detail: {
+                    columns: msg.columns,
+                    rows: msg.rows,
+                    cellWidth: msg.cellWidth,
+                    cellHeight: msg.cellHeight,
+                    gap: msg.gap,
+                    reduction: msg.reduction,
+                    elapsed: msg.elapsed,
+                    x: msg.x,
+                    y: msg.y,
+                    image: pclDecodeImage(msg.data, msg.width, msg.height)
+                } }));
+            }
         }
     });
     </script>
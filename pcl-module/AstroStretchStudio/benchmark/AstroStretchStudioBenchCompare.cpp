@@ -0,0 +1,231 @@
+// ----------------------------------------------------------------------------
+// AstroStretchStudio Benchmark Comparator
+//
+// Compares two microbenchmark sample files, kernel by kernel, and flags
+// statistically significant regressions.
+//
+// Usage: AstroStretchStudioBenchCompare <baseline.csv> <current.csv> [options]
+//
+//   --alpha=0.01                Significance level of the Mann-Whitney U test.
+//   --threshold=0.03            Minimum relative change of the median that is
+//                               reported as faster or slower.
+//
+// Both files are written by AstroStretchStudioMicroBenchmark --csv=<file>.
+// The exit code is 2 if any kernel is significantly slower, 0 otherwise.
+// ----------------------------------------------------------------------------
+
+#include <pcl/Array.h>
+#include <pcl/Exception.h>
+#include <pcl/File.h>
+#include <pcl/Math.h>
+#include <pcl/Sort.h>
+#include <pcl/String.h>
+
+#include <cmath>
+#include <cstdio>
+
+using namespace pcl;
+
+// ----------------------------------------------------------------------------
+
+struct KernelSamples
+{
+   IsoString     kernel;
+   IsoString     configuration; // width x height @ threads
+   Array<double> samples;
+};
+
+// ----------------------------------------------------------------------------
+
+static Array<KernelSamples> ReadSamples( const IsoString& filePath )
+{
+   IsoString text = File::ReadTextFile( String( filePath ) );
+   IsoStringList lines;
+   text.Break( lines, '\n', true/*trim*/ );
+
+   Array<KernelSamples> result;
+   for ( size_type i = 1; i < lines.Length(); ++i ) // skip the header row
+   {
+      if ( lines[i].IsEmpty() )
+         continue;
+      IsoStringList fields;
+      lines[i].Break( fields, ',', true/*trim*/ );
+      if ( fields.Length() != 5 )
+         throw Error( "Malformed sample row in " + filePath );
+
+      KernelSamples k;
+      k.kernel = fields[0];
+      k.configuration = IsoString().Format( "%sx%s@%s", fields[1].c_str(), fields[2].c_str(), fields[3].c_str() );
+      IsoStringList values;
+      fields[4].Break( values, ';', true/*trim*/ );
+      for ( const IsoString& v : values )
+         if ( !v.IsEmpty() )
+            k.samples << v.ToDouble();
+      if ( k.samples.Length() < 3 )
+         throw Error( "Too few samples for kernel " + k.kernel + " in " + filePath );
+      result << k;
+   }
+   return result;
+}
+
+// ----------------------------------------------------------------------------
+
+static double Median( Array<double> x )
+{
+   Sort( x.Begin(), x.End() );
+   size_type n = x.Length();
+   return (n & 1) ? x[n >> 1] : (x[(n >> 1) - 1] + x[n >> 1])/2;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Two-sided Mann-Whitney U test. Returns the p-value under the normal
+ * approximation with tie and continuity corrections, which is adequate for
+ * the sample sizes used by the microbenchmarks (n >= 8 per side).
+ */
+static double MannWhitneyPValue( const Array<double>& a, const Array<double>& b )
+{
+   struct Ranked
+   {
+      double value;
+      int    group;
+
+      bool operator <( const Ranked& x ) const
+      {
+         return value < x.value;
+      }
+   };
+
+   const double n1 = double( a.Length() );
+   const double n2 = double( b.Length() );
+   const double n = n1 + n2;
+
+   Array<Ranked> all;
+   for ( double v : a )
+      all << Ranked{ v, 0 };
+   for ( double v : b )
+      all << Ranked{ v, 1 };
+   Sort( all.Begin(), all.End() );
+
+   // Rank sum of the first group, with average ranks for ties
+   double R1 = 0, tieSum = 0;
+   for ( size_type i = 0; i < all.Length(); )
+   {
+      size_type j = i;
+      while ( j < all.Length() && all[j].value == all[i].value )
+         ++j;
+      double t = double( j - i );
+      double rank = (double( i + 1 ) + double( j ))/2;
+      for ( size_type k = i; k < j; ++k )
+         if ( all[k].group == 0 )
+            R1 += rank;
+      tieSum += t*t*t - t;
+      i = j;
+   }
+
+   double U = R1 - n1*(n1 + 1)/2;
+   double mu = n1*n2/2;
+   double sigma = Sqrt( n1*n2/12 * ((n + 1) - tieSum/(n*(n - 1))) );
+   if ( sigma <= 0 )
+      return 1;
+   double z = (Abs( U - mu ) - 0.5)/sigma;
+   if ( z <= 0 )
+      return 1;
+   return std::erfc( z/Sqrt( 2.0 ) );
+}
+
+// ----------------------------------------------------------------------------
+
+int main( int argc, const char** argv )
+{
+   try
+   {
+      IsoStringList files;
+      double alpha = 0.01;
+      double threshold = 0.03;
+
+      for ( int i = 1; i < argc; ++i )
+      {
+         IsoString arg( argv[i] );
+         if ( arg.StartsWith( "--alpha=" ) )
+            alpha = Range( arg.Substring( 8 ).ToDouble(), 1.0e-6, 0.5 );
+         else if ( arg.StartsWith( "--threshold=" ) )
+            threshold = Max( 0.0, arg.Substring( 12 ).ToDouble() );
+         else if ( arg.StartsWith( "--" ) )
+            throw Error( "Unknown option: " + arg );
+         else
+            files << arg;
+      }
+      if ( files.Length() != 2 )
+         throw Error( "Usage: AstroStretchStudioBenchCompare <baseline.csv> <current.csv> [--alpha=a] [--threshold=t]" );
+
+      Array<KernelSamples> baseline = ReadSamples( files[0] );
+      Array<KernelSamples> current = ReadSamples( files[1] );
+
+      std::printf( "%-22s %12s %12s %8s %10s  %s\n",
+                   "kernel", "base (ms)", "curr (ms)", "ratio", "p-value", "verdict" );
+
+      int slower = 0, faster = 0;
+      for ( const KernelSamples& c : current )
+      {
+         const KernelSamples* b = nullptr;
+         for ( const KernelSamples& k : baseline )
+            if ( k.kernel == c.kernel )
+            {
+               b = &k;
+               break;
+            }
+         if ( b == nullptr )
+         {
+            std::printf( "%-22s %12s %12.3f %8s %10s  new\n",
+                         c.kernel.c_str(), "-", Median( c.samples )*1000, "-", "-" );
+            continue;
+         }
+         if ( b->configuration != c.configuration )
+            throw Error( "Kernel " + c.kernel + " was measured with different configurations: "
+                       + b->configuration + " vs " + c.configuration );
+
+         double mb = Median( b->samples );
+         double mc = Median( c.samples );
+         double ratio = mc/mb;
+         double p = MannWhitneyPValue( b->samples, c.samples );
+
+         const char* verdict = "unchanged";
+         if ( p < alpha )
+         {
+            if ( ratio > 1 + threshold )
+            {
+               verdict = "SLOWER";
+               ++slower;
+            }
+            else if ( ratio < 1 - threshold )
+            {
+               verdict = "faster";
+               ++faster;
+            }
+         }
+
+         std::printf( "%-22s %12.3f %12.3f %8.3f %10.2e  %s\n",
+                      c.kernel.c_str(), mb*1000, mc*1000, ratio, p, verdict );
+      }
+
+      std::printf( "\n%d faster, %d slower (alpha=%g, threshold=%g%%)\n", faster, slower, alpha, threshold*100 );
+      return (slower > 0) ? 2 : 0;
+   }
+   catch ( const Exception& x )
+   {
+      std::fprintf( stderr, "*** Error: %s\n", x.Message().ToUTF8().c_str() );
+   }
+   catch ( const std::exception& x )
+   {
+      std::fprintf( stderr, "*** Error: %s\n", x.what() );
+   }
+   catch ( ... )
+   {
+      std::fprintf( stderr, "*** Unknown error\n" );
+   }
+   return 1;
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,440 @@
+// ----------------------------------------------------------------------------
+// AstroStretchStudio Benchmark
+//
+// Standalone throughput and thread-scaling benchmark for the OTS and SAS
+// stretch kernels, running on synthetic star-field and nebula images.
+//
+// Usage: AstroStretchStudioBenchmark [options]
+//
+//   --scenes=starfield,nebula   Synthetic scenes.
+//   --types=u8,u16,u32,f32      Sample types (also f64).
+//   --sizes=4,16,64,400         Image sizes in megapixels.
+//   --channels=3                Number of channels (1 or 3).
+//   --algorithms=ots,sas        Algorithms to run.
+//   --scales=4,5,6,7,8          SAS scale counts (OTS ignores this option).
+//   --threads=1,2,4,...,N       Thread counts. Default: powers of two up to N.
+//   --repeat=3                  Timed runs per configuration.
+//   --warmup=1                  Untimed runs per configuration.
+//   --seed=1                    Random seed for the synthetic images.
+//   --label=<text>              Free-form run label (e.g. version or commit).
+//   --json=<file>               Write results as JSON.
+//   --csv=<file>                Write results as CSV.
+//
+// Each result includes a checksum of the stretched image. Results must not
+// depend on the number of threads, so the exit code is 2 if the checksums of
+// a configuration differ between thread counts, 0 otherwise.
+// ----------------------------------------------------------------------------
+
+#include "../AstroStretchStudioEngine.h"
+#include "SyntheticImages.h"
+
+#include <pcl/ElapsedTime.h>
+#include <pcl/File.h>
+
+#include <cstdio>
+#include <ctime>
+#include <thread>
+
+using namespace pcl;
+
+// ----------------------------------------------------------------------------
+
+struct BenchmarkOptions
+{
+   Array<int>     scenes;
+   IsoStringList  types;
+   Array<double>  sizes;
+   Array<int>     channels;
+   Array<int>     algorithms;
+   Array<int>     scales;
+   Array<int>     threads;
+   int            repeat = 3;
+   int            warmup = 1;
+   uint64         seed = 1;
+   IsoString      label;
+   IsoString      jsonFile;
+   IsoString      csvFile;
+};
+
+struct BenchmarkResult
+{
+   IsoString scene;
+   IsoString algorithm;
+   IsoString sampleType;
+   int       width;
+   int       height;
+   int       channels;
+   int       numScales;   // zero for OTS
+   int       threads;
+   int       runs;
+   double    best;        // seconds
+   double    median;      // seconds
+   double    mean;        // seconds
+   double    throughput;  // megapixels per second, from the median
+   double    speedup;     // relative to the smallest thread count measured
+   double    efficiency;  // speedup / (threads / smallest thread count)
+   uint64    checksum;    // of the output samples
+};
+
+// ----------------------------------------------------------------------------
+
+static IsoStringList SplitList( const IsoString& s )
+{
+   IsoStringList list;
+   s.Break( list, ',', true/*trim*/ );
+   IsoStringList items;
+   for ( const IsoString& item : list )
+      if ( !item.IsEmpty() )
+         items.Add( item );
+   return items;
+}
+
+// ----------------------------------------------------------------------------
+
+static void ParseArguments( int argc, const char** argv, BenchmarkOptions& options )
+{
+   const int maxThreads = Max( 1, int( std::thread::hardware_concurrency() ) );
+
+   options.scenes << SyntheticScene::StarField << SyntheticScene::Nebula;
+   options.types << "u8" << "u16" << "u32" << "f32";
+   options.sizes << 4 << 16 << 64 << 400;
+   options.channels << 3;
+   options.algorithms << ASSAlgorithm::OTS << ASSAlgorithm::SAS;
+   for ( int n = 4; n <= 8; ++n )
+      options.scales << n;
+   for ( int n = 1; n < maxThreads; n <<= 1 )
+      options.threads << n;
+   options.threads << maxThreads;
+
+   for ( int i = 1; i < argc; ++i )
+   {
+      IsoString arg( argv[i] );
+      size_type eq = arg.Find( '=' );
+      if ( !arg.StartsWith( "--" ) || eq == IsoString::notFound )
+         throw Error( "Invalid argument: " + arg );
+      IsoString key = arg.Substring( 2, eq-2 );
+      IsoString value = arg.Substring( eq+1 );
+
+      if ( key == "scenes" )
+      {
+         options.scenes.Clear();
+         for ( const IsoString& item : SplitList( value ) )
+            if ( item == "starfield" )
+               options.scenes << SyntheticScene::StarField;
+            else if ( item == "nebula" )
+               options.scenes << SyntheticScene::Nebula;
+            else
+               throw Error( "Unknown scene: " + item );
+      }
+      else if ( key == "types" )
+      {
+         options.types = SplitList( value );
+         for ( const IsoString& item : options.types )
+            if ( item != "u8" && item != "u16" && item != "u32" && item != "f32" && item != "f64" )
+               throw Error( "Unknown sample type: " + item );
+      }
+      else if ( key == "sizes" )
+      {
+         options.sizes.Clear();
+         for ( const IsoString& item : SplitList( value ) )
+            options.sizes << item.ToDouble();
+      }
+      else if ( key == "channels" )
+      {
+         options.channels.Clear();
+         for ( const IsoString& item : SplitList( value ) )
+            options.channels << item.ToInt();
+      }
+      else if ( key == "algorithms" )
+      {
+         options.algorithms.Clear();
+         for ( const IsoString& item : SplitList( value ) )
+            if ( item == "ots" )
+               options.algorithms << ASSAlgorithm::OTS;
+            else if ( item == "sas" )
+               options.algorithms << ASSAlgorithm::SAS;
+            else
+               throw Error( "Unknown algorithm: " + item );
+      }
+      else if ( key == "scales" )
+      {
+         options.scales.Clear();
+         for ( const IsoString& item : SplitList( value ) )
+            options.scales << Range( item.ToInt(), 4, 8 );
+      }
+      else if ( key == "threads" )
+      {
+         options.threads.Clear();
+         for ( const IsoString& item : SplitList( value ) )
+            options.threads << Max( 1, item.ToInt() );
+      }
+      else if ( key == "repeat" )
+         options.repeat = Max( 1, value.ToInt() );
+      else if ( key == "warmup" )
+         options.warmup = Max( 0, value.ToInt() );
+      else if ( key == "seed" )
+         options.seed = value.ToUInt64();
+      else if ( key == "label" )
+         options.label = value;
+      else if ( key == "json" )
+         options.jsonFile = value;
+      else if ( key == "csv" )
+         options.csvFile = value;
+      else
+         throw Error( "Unknown option: --" + key );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+// FNV-1a hash of the sample bytes of an image.
+template <class P>
+static uint64 Checksum( const GenericImage<P>& image )
+{
+   uint64 hash = 14695981039346656037ull;
+   for ( int c = 0; c < image.NumberOfChannels(); ++c )
+   {
+      const uint8* p = reinterpret_cast<const uint8*>( image.PixelData( c ) );
+      const uint8* end = p + image.NumberOfPixels()*sizeof( typename P::sample );
+      for ( ; p < end; ++p )
+         hash = (hash ^ *p) * 1099511628211ull;
+   }
+   return hash;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Returns the number of scale counts and algorithms whose output differs
+ * between thread counts.
+ */
+template <class P>
+static int RunConfiguration( Array<BenchmarkResult>& results, const BenchmarkOptions& options,
+                             const Image& source, const IsoString& scene, const IsoString& sampleType )
+{
+   int mismatches = 0;
+
+   const int maxThreads = Max( 1, int( std::thread::hardware_concurrency() ) );
+
+   GenericImage<P> original;
+   ConvertSyntheticImage( original, source, maxThreads );
+
+   for ( int algorithm : options.algorithms )
+   {
+      Array<int> scaleCounts;
+      if ( algorithm == ASSAlgorithm::SAS )
+         scaleCounts = options.scales;
+      else
+         scaleCounts << 0;
+
+      for ( int numScales : scaleCounts )
+      {
+         double referenceTime = 0;
+         int referenceThreads = 0;
+         uint64 referenceChecksum = 0;
+         bool mismatch = false;
+
+         for ( int threads : options.threads )
+         {
+            StretchParameters params;
+            params.algorithm = algorithm;
+            if ( numScales > 0 )
+               params.sasNumScales = numScales;
+            StretchEngine engine( params, threads );
+
+            Array<double> times;
+            uint64 checksum = 0;
+            for ( int run = 0; run < options.warmup + options.repeat; ++run )
+            {
+               GenericImage<P> work( original );
+               work.EnsureUnique();
+
+               ElapsedTime T;
+               if ( algorithm == ASSAlgorithm::OTS )
+                  engine.ApplyOTS( work );
+               else
+                  engine.ApplySAS( work );
+               double t = T();
+
+               if ( run >= options.warmup )
+                  times << t;
+               if ( run == 0 )
+                  checksum = Checksum( work );
+            }
+
+            Sort( times.Begin(), times.End() );
+            double sum = 0;
+            for ( double t : times )
+               sum += t;
+
+            BenchmarkResult r;
+            r.scene = scene;
+            r.algorithm = (algorithm == ASSAlgorithm::OTS) ? "ots" : "sas";
+            r.sampleType = sampleType;
+            r.width = original.Width();
+            r.height = original.Height();
+            r.channels = original.NumberOfChannels();
+            r.numScales = numScales;
+            r.threads = threads;
+            r.runs = int( times.Length() );
+            r.best = times[0];
+            r.median = times[times.Length()/2];
+            r.mean = sum/times.Length();
+            r.throughput = double( original.NumberOfPixels() )/1.0e6/r.median;
+            r.checksum = checksum;
+
+            if ( referenceThreads == 0 )
+            {
+               referenceThreads = threads;
+               referenceTime = r.median;
+               referenceChecksum = checksum;
+            }
+            r.speedup = referenceTime/r.median;
+            r.efficiency = r.speedup/(double( threads )/referenceThreads);
+
+            std::printf( "%-9s %-3s %-3s %6.1f MP %dch scales=%d threads=%-3d median=%9.4f s  %8.2f MP/s  speedup=%5.2f  %016llx\n",
+                         r.scene.c_str(), r.algorithm.c_str(), r.sampleType.c_str(),
+                         original.NumberOfPixels()/1.0e6, r.channels, r.numScales, r.threads,
+                         r.median, r.throughput, r.speedup, (unsigned long long)r.checksum );
+            if ( checksum != referenceChecksum )
+            {
+               std::printf( "*** Output differs from %d thread(s)\n", referenceThreads );
+               mismatch = true;
+            }
+            std::fflush( stdout );
+
+            results << r;
+         }
+
+         if ( mismatch )
+            ++mismatches;
+      }
+   }
+
+   return mismatches;
+}
+
+// ----------------------------------------------------------------------------
+
+static IsoString Timestamp()
+{
+   char buffer[ 32 ];
+   std::time_t t = std::time( nullptr );
+   std::strftime( buffer, sizeof( buffer ), "%Y-%m-%dT%H:%M:%SZ", std::gmtime( &t ) );
+   return IsoString( buffer );
+}
+
+// ----------------------------------------------------------------------------
+
+static void WriteJSON( const IsoString& filePath, const BenchmarkOptions& options, const Array<BenchmarkResult>& results )
+{
+   IsoString text;
+   text << "{\n";
+   text.AppendFormat( "  \"label\": \"%s\",\n", options.label.c_str() );
+   text.AppendFormat( "  \"timestamp\": \"%s\",\n", Timestamp().c_str() );
+   text.AppendFormat( "  \"hardwareThreads\": %u,\n", std::thread::hardware_concurrency() );
+   text.AppendFormat( "  \"repeat\": %d,\n", options.repeat );
+   text.AppendFormat( "  \"seed\": %llu,\n", (unsigned long long)options.seed );
+   text << "  \"results\": [\n";
+   for ( size_type i = 0; i < results.Length(); ++i )
+   {
+      const BenchmarkResult& r = results[i];
+      text.AppendFormat( "    {\"scene\":\"%s\",\"algorithm\":\"%s\",\"sampleType\":\"%s\","
+                         "\"width\":%d,\"height\":%d,\"channels\":%d,\"numScales\":%d,\"threads\":%d,\"runs\":%d,"
+                         "\"best\":%.6f,\"median\":%.6f,\"mean\":%.6f,\"throughput\":%.4f,\"speedup\":%.4f,\"efficiency\":%.4f,"
+                         "\"checksum\":\"%016llx\"}%s\n",
+                         r.scene.c_str(), r.algorithm.c_str(), r.sampleType.c_str(),
+                         r.width, r.height, r.channels, r.numScales, r.threads, r.runs,
+                         r.best, r.median, r.mean, r.throughput, r.speedup, r.efficiency,
+                         (unsigned long long)r.checksum,
+                         (i < results.Length()-1) ? "," : "" );
+   }
+   text << "  ]\n}\n";
+   File::WriteTextFile( String( filePath ), text );
+}
+
+// ----------------------------------------------------------------------------
+
+static void WriteCSV( const IsoString& filePath, const BenchmarkOptions& options, const Array<BenchmarkResult>& results )
+{
+   IsoString text = "label,scene,algorithm,sampleType,width,height,channels,numScales,threads,runs,"
+                    "best,median,mean,throughput,speedup,efficiency,checksum\n";
+   for ( const BenchmarkResult& r : results )
+      text.AppendFormat( "%s,%s,%s,%s,%d,%d,%d,%d,%d,%d,%.6f,%.6f,%.6f,%.4f,%.4f,%.4f,%016llx\n",
+                         options.label.c_str(), r.scene.c_str(), r.algorithm.c_str(), r.sampleType.c_str(),
+                         r.width, r.height, r.channels, r.numScales, r.threads, r.runs,
+                         r.best, r.median, r.mean, r.throughput, r.speedup, r.efficiency,
+                         (unsigned long long)r.checksum );
+   File::WriteTextFile( String( filePath ), text );
+}
+
+// ----------------------------------------------------------------------------
+
+int main( int argc, const char** argv )
+{
+   try
+   {
+      BenchmarkOptions options;
+      ParseArguments( argc, argv, options );
+
+      const int maxThreads = Max( 1, int( std::thread::hardware_concurrency() ) );
+
+      Array<BenchmarkResult> results;
+      int mismatches = 0;
+
+      for ( int scene : options.scenes )
+         for ( double megapixels : options.sizes )
+            for ( int channels : options.channels )
+            {
+               // 3:2 aspect ratio, typical of camera sensors
+               int width = RoundInt( Sqrt( megapixels*1.0e6*1.5 ) );
+               int height = RoundInt( megapixels*1.0e6/width );
+
+               Image source;
+               GenerateSyntheticImage( source, SyntheticScene::value_type( scene ),
+                                       width, height, channels, options.seed, maxThreads );
+
+               IsoString sceneId = SyntheticScene::Id( SyntheticScene::value_type( scene ) );
+               for ( const IsoString& type : options.types )
+               {
+                  if ( type == "u8" )
+                     mismatches += RunConfiguration<UInt8PixelTraits>( results, options, source, sceneId, type );
+                  else if ( type == "u16" )
+                     mismatches += RunConfiguration<UInt16PixelTraits>( results, options, source, sceneId, type );
+                  else if ( type == "u32" )
+                     mismatches += RunConfiguration<UInt32PixelTraits>( results, options, source, sceneId, type );
+                  else if ( type == "f32" )
+                     mismatches += RunConfiguration<FloatPixelTraits>( results, options, source, sceneId, type );
+                  else if ( type == "f64" )
+                     mismatches += RunConfiguration<DoublePixelTraits>( results, options, source, sceneId, type );
+               }
+            }
+
+      if ( !options.jsonFile.IsEmpty() )
+         WriteJSON( options.jsonFile, options, results );
+      if ( !options.csvFile.IsEmpty() )
+         WriteCSV( options.csvFile, options, results );
+
+      if ( mismatches > 0 )
+      {
+         std::printf( "*** %d configuration(s) depend on the number of threads\n", mismatches );
+         return 2;
+      }
+      return 0;
+   }
+   catch ( const Exception& x )
+   {
+      std::fprintf( stderr, "*** Error: %s\n", x.Message().ToUTF8().c_str() );
+   }
+   catch ( const std::exception& x )
+   {
+      std::fprintf( stderr, "*** Error: %s\n", x.what() );
+   }
+   catch ( ... )
+   {
+      std::fprintf( stderr, "*** Unknown error\n" );
+   }
+   return 1;
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,351 @@
+// ----------------------------------------------------------------------------
+// AstroStretchStudio Microbenchmarks
+//
+// Measures each hot stretch kernel in isolation on a synthetic nebula image.
+// Every timed sample is recorded, so two runs can be compared statistically
+// with AstroStretchStudioBenchCompare.
+//
+// Usage: AstroStretchStudioMicroBenchmark [options]
+//
+//   --size=16                   Image size in megapixels.
+//   --threads=N                 Number of threads. Default: all cores.
+//   --samples=15                Timed samples per kernel.
+//   --warmup=2                  Untimed samples per kernel.
+//   --kernels=histogram,atrous  Only run kernels whose names start with one
+//                               of these prefixes.
+//   --seed=1                    Random seed for the synthetic image.
+//   --label=<text>              Free-form run label (e.g. version or commit).
+//   --json=<file>               Write summary statistics as JSON.
+//   --csv=<file>                Write all samples as CSV (comparator input).
+// ----------------------------------------------------------------------------
+
+#include "../AstroStretchStudioEngine.h"
+#include "SyntheticImages.h"
+
+#include <pcl/ElapsedTime.h>
+#include <pcl/File.h>
+
+#include <cstdio>
+#include <thread>
+
+using namespace pcl;
+
+// ----------------------------------------------------------------------------
+
+struct MicroBenchmarkOptions
+{
+   double        size = 16;
+   int           threads = 0;
+   int           samples = 15;
+   int           warmup = 2;
+   IsoStringList kernels;
+   uint64        seed = 1;
+   IsoString     label;
+   IsoString     jsonFile;
+   IsoString     csvFile;
+};
+
+struct KernelResult
+{
+   IsoString     kernel;
+   Array<double> samples;   // seconds, in measurement order
+   double        median;
+   double        best;
+   double        throughput; // megapixels per second, from the median
+};
+
+// ----------------------------------------------------------------------------
+
+static void ParseArguments( int argc, const char** argv, MicroBenchmarkOptions& options )
+{
+   options.threads = Max( 1, int( std::thread::hardware_concurrency() ) );
+
+   for ( int i = 1; i < argc; ++i )
+   {
+      IsoString arg( argv[i] );
+      size_type eq = arg.Find( '=' );
+      if ( !arg.StartsWith( "--" ) || eq == IsoString::notFound )
+         throw Error( "Invalid argument: " + arg );
+      IsoString key = arg.Substring( 2, eq-2 );
+      IsoString value = arg.Substring( eq+1 );
+
+      if ( key == "size" )
+         options.size = Max( 0.01, value.ToDouble() );
+      else if ( key == "threads" )
+         options.threads = Max( 1, value.ToInt() );
+      else if ( key == "samples" )
+         options.samples = Max( 3, value.ToInt() );
+      else if ( key == "warmup" )
+         options.warmup = Max( 0, value.ToInt() );
+      else if ( key == "kernels" )
+      {
+         options.kernels.Clear();
+         value.Break( options.kernels, ',', true/*trim*/ );
+      }
+      else if ( key == "seed" )
+         options.seed = value.ToUInt64();
+      else if ( key == "label" )
+         options.label = value;
+      else if ( key == "json" )
+         options.jsonFile = value;
+      else if ( key == "csv" )
+         options.csvFile = value;
+      else
+         throw Error( "Unknown option: --" + key );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+class MicroBenchmark
+{
+public:
+
+   MicroBenchmark( const MicroBenchmarkOptions& options, double megapixels )
+      : m_options( options )
+      , m_megapixels( megapixels )
+   {
+   }
+
+   /*
+    * Runs setup() untimed and body() timed, warmup + samples times.
+    */
+   template <class Setup, class Body>
+   void Measure( const IsoString& kernel, Setup setup, Body body )
+   {
+      if ( !IsSelected( kernel ) )
+         return;
+
+      KernelResult r;
+      r.kernel = kernel;
+      for ( int i = -m_options.warmup; i < m_options.samples; ++i )
+      {
+         setup();
+         ElapsedTime T;
+         body();
+         double t = T();
+         if ( i >= 0 )
+            r.samples << t;
+      }
+
+      Array<double> sorted = r.samples;
+      Sort( sorted.Begin(), sorted.End() );
+      r.best = sorted[0];
+      r.median = sorted[sorted.Length()/2];
+      r.throughput = m_megapixels/r.median;
+
+      std::printf( "%-22s median=%10.3f ms  best=%10.3f ms  %9.2f MP/s\n",
+                   kernel.c_str(), r.median*1000, r.best*1000, r.throughput );
+      std::fflush( stdout );
+
+      m_results << r;
+   }
+
+   const Array<KernelResult>& Results() const
+   {
+      return m_results;
+   }
+
+private:
+
+   const MicroBenchmarkOptions& m_options;
+   double                       m_megapixels;
+   Array<KernelResult>          m_results;
+
+   bool IsSelected( const IsoString& kernel ) const
+   {
+      if ( m_options.kernels.IsEmpty() )
+         return true;
+      for ( const IsoString& prefix : m_options.kernels )
+         if ( kernel.StartsWith( prefix ) )
+            return true;
+      return false;
+   }
+};
+
+// ----------------------------------------------------------------------------
+
+static void WriteJSON( const IsoString& filePath, const MicroBenchmarkOptions& options,
+                       int width, int height, const Array<KernelResult>& results )
+{
+   IsoString text;
+   text << "{\n";
+   text.AppendFormat( "  \"label\": \"%s\",\n", options.label.c_str() );
+   text.AppendFormat( "  \"width\": %d,\n", width );
+   text.AppendFormat( "  \"height\": %d,\n", height );
+   text.AppendFormat( "  \"threads\": %d,\n", options.threads );
+   text.AppendFormat( "  \"samples\": %d,\n", options.samples );
+   text << "  \"kernels\": [\n";
+   for ( size_type i = 0; i < results.Length(); ++i )
+   {
+      const KernelResult& r = results[i];
+      text.AppendFormat( "    {\"kernel\":\"%s\",\"median\":%.9f,\"best\":%.9f,\"throughput\":%.4f}%s\n",
+                         r.kernel.c_str(), r.median, r.best, r.throughput,
+                         (i < results.Length()-1) ? "," : "" );
+   }
+   text << "  ]\n}\n";
+   File::WriteTextFile( String( filePath ), text );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * One row per kernel: kernel,width,height,threads,samples, where samples is a
+ * semicolon-separated list of times in seconds.
+ */
+static void WriteCSV( const IsoString& filePath, const MicroBenchmarkOptions& options,
+                      int width, int height, const Array<KernelResult>& results )
+{
+   IsoString text = "kernel,width,height,threads,samples\n";
+   for ( const KernelResult& r : results )
+   {
+      text.AppendFormat( "%s,%d,%d,%d,", r.kernel.c_str(), width, height, options.threads );
+      for ( size_type i = 0; i < r.samples.Length(); ++i )
+         text.AppendFormat( (i > 0) ? ";%.9f" : "%.9f", r.samples[i] );
+      text << "\n";
+   }
+   File::WriteTextFile( String( filePath ), text );
+}
+
+// ----------------------------------------------------------------------------
+
+int main( int argc, const char** argv )
+{
+   try
+   {
+      MicroBenchmarkOptions options;
+      ParseArguments( argc, argv, options );
+
+      const int width = RoundInt( Sqrt( options.size*1.0e6*1.5 ) );
+      const int height = RoundInt( options.size*1.0e6/width );
+
+      Image rgb;
+      GenerateSyntheticImage( rgb, SyntheticScene::Nebula, width, height, 3, options.seed, options.threads );
+
+      StretchParameters params;
+      StretchEngine engine( params, options.threads );
+      MicroBenchmark bench( options, double( rgb.NumberOfPixels() )/1.0e6 );
+
+      std::printf( "%d x %d pixels, %d threads\n", width, height, options.threads );
+
+      const int resolution = 65536;
+
+      // Inputs shared by the kernels, computed once and untimed
+      Image L;
+      engine.ExtractLuminance( L, rgb, true );
+      UI64Vector hist( resolution );
+      engine.ComputeHistogram( L, hist );
+      FVector srcCDF( resolution );
+      StretchEngine::HistogramToCDF( srcCDF, hist );
+      FVector tgtCDF( resolution );
+      StretchEngine::GenerateTargetCDF( tgtCDF, params.otsObjectType, params.otsBackgroundTarget );
+      FVector transportMap( resolution );
+      StretchEngine::ComputeTransportMap( transportMap, srcCDF, tgtCDF );
+      Array<Image> scales;
+      engine.StarletDecompose( L, scales, 8 );
+      const double sigma = engine.EstimateNoise( scales[0] );
+      const float threshold = float( params.sasNoiseThreshold * sigma * 5 );
+
+      Image work, temp( width, height ), smooth( width, height ), wavelet( width, height );
+      Image rgbWork;
+      auto noSetup = [](){};
+
+      // Luminance and OTS kernels
+
+      bench.Measure( "luminance", noSetup,
+                     [&](){ engine.ExtractLuminance( work, rgb, true ); } );
+
+      bench.Measure( "histogram", noSetup,
+                     [&](){ engine.ComputeHistogram( L, hist ); } );
+
+      bench.Measure( "cdf", noSetup,
+                     [&](){ StretchEngine::HistogramToCDF( srcCDF, hist ); } );
+
+      bench.Measure( "target-cdf", noSetup,
+                     [&](){ StretchEngine::GenerateTargetCDF( tgtCDF, params.otsObjectType, params.otsBackgroundTarget ); } );
+
+      bench.Measure( "transport-map", noSetup,
+                     [&](){ StretchEngine::ComputeTransportMap( transportMap, srcCDF, tgtCDF ); } );
+
+      StretchCurve curve;
+      bench.Measure( "curve-compile", noSetup,
+                     [&](){ engine.CompileOTSCurve( curve, transportMap ); } );
+
+      bench.Measure( "lut-apply",
+                     [&](){ work = L; work.EnsureUnique(); },
+                     [&](){ engine.ApplyLUT( work, transportMap ); } );
+
+      // Starlet transform, one measurement per à trous spacing
+
+      Image current;
+      for ( int j = 0; j < 8; ++j )
+      {
+         int spacing = 1 << j;
+         // Input of scale j: the smooth plane of scale j-1
+         current = L;
+         for ( int k = 0; k < j; ++k )
+         {
+            engine.AtrousHorizontal( current, temp, 1 << k );
+            engine.AtrousVertical( temp, current, smooth, wavelet, 1 << k );
+            current = smooth;
+            current.EnsureUnique();
+         }
+
+         bench.Measure( IsoString().Format( "atrous-h/%d", spacing ), noSetup,
+                        [&](){ engine.AtrousHorizontal( current, temp, spacing ); } );
+
+         bench.Measure( IsoString().Format( "atrous-v/%d", spacing ), noSetup,
+                        [&](){ engine.AtrousVertical( temp, current, smooth, wavelet, spacing ); } );
+      }
+
+      bench.Measure( "reconstruct", noSetup,
+                     [&](){ engine.StarletReconstruct( work, scales ); } );
+
+      // Point-wise and statistical SAS kernels
+
+      bench.Measure( "soft-threshold",
+                     [&](){ work = scales[0]; work.EnsureUnique(); },
+                     [&](){ engine.SoftThreshold( work, threshold ); } );
+
+      bench.Measure( "mad", noSetup,
+                     [&](){ engine.EstimateNoise( scales[0] ); } );
+
+      bench.Measure( "percentile", noSetup,
+                     [&](){ engine.Percentile( L, 0.05 ); } );
+
+      for ( double s : { 2.0, 16.0 } )
+         bench.Measure( IsoString().Format( "gaussian/%d", int( s ) ),
+                        [&](){ work = L; work.EnsureUnique(); },
+                        [&](){ engine.GaussianSmooth( work, s ); } );
+
+      // Color reconstruction with a stretched luminance
+      Image Lstretched( L );
+      Lstretched.EnsureUnique();
+      engine.ApplyLUT( Lstretched, transportMap );
+      bench.Measure( "color-reconstruction",
+                     [&](){ rgbWork = rgb; rgbWork.EnsureUnique(); },
+                     [&](){ engine.ReconstructColor( rgbWork, L, Lstretched ); } );
+
+      if ( !options.jsonFile.IsEmpty() )
+         WriteJSON( options.jsonFile, options, width, height, bench.Results() );
+      if ( !options.csvFile.IsEmpty() )
+         WriteCSV( options.csvFile, options, width, height, bench.Results() );
+
+      return 0;
+   }
+   catch ( const Exception& x )
+   {
+      std::fprintf( stderr, "*** Error: %s\n", x.Message().ToUTF8().c_str() );
+   }
+   catch ( const std::exception& x )
+   {
+      std::fprintf( stderr, "*** Error: %s\n", x.what() );
+   }
+   catch ( ... )
+   {
+      std::fprintf( stderr, "*** Unknown error\n" );
+   }
+   return 1;
+}
+
+// ----------------------------------------------------------------------------
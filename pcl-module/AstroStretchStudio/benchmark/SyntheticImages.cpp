@@ -0,0 +1,188 @@
+// ----------------------------------------------------------------------------
+// AstroStretchStudio Benchmark - Synthetic Images Implementation
+// ----------------------------------------------------------------------------
+
+#include "SyntheticImages.h"
+
+#include <pcl/Array.h>
+#include <pcl/Math.h>
+
+namespace pcl
+{
+
+// ----------------------------------------------------------------------------
+
+const char* SyntheticScene::Id( value_type scene )
+{
+   switch ( scene )
+   {
+   case StarField: return "starfield";
+   case Nebula:    return "nebula";
+   default:        return "unknown";
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+// SplitMix64 finalizer: a cheap, stateless hash giving random access to a
+// reproducible random sequence.
+static inline uint64 Hash64( uint64 x )
+{
+   x += 0x9E3779B97F4A7C15ull;
+   x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+   x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+   return x ^ (x >> 31);
+}
+
+// Uniform deviate in [0,1)
+static inline double Uniform( uint64 key )
+{
+   return double( Hash64( key ) >> 11 ) * (1.0/9007199254740992.0);
+}
+
+static inline uint64 Key( uint64 seed, uint64 a, uint64 b, uint64 c = 0 )
+{
+   return Hash64( seed ^ Hash64( a ^ Hash64( b ^ Hash64( c ) ) ) );
+}
+
+// Standard normal deviate (Box-Muller)
+static inline double Normal( uint64 key )
+{
+   double u1 = Max( Uniform( key ), 1.0e-300 );
+   double u2 = Uniform( key ^ 0xA5A5A5A5A5A5A5A5ull );
+   return Sqrt( -2*Ln( u1 ) ) * Cos( 2*Pi()*u2 );
+}
+
+// ----------------------------------------------------------------------------
+
+// Smoothly interpolated value noise at the given cell size.
+static double ValueNoise( uint64 seed, int octave, double x, double y, double cell )
+{
+   double fx = x/cell;
+   double fy = y/cell;
+   int64 ix = int64( Floor( fx ) );
+   int64 iy = int64( Floor( fy ) );
+   double tx = fx - ix;
+   double ty = fy - iy;
+   tx = tx*tx*(3 - 2*tx);
+   ty = ty*ty*(3 - 2*ty);
+   double v00 = Uniform( Key( seed, octave, uint64( ix   ), uint64( iy   ) ) );
+   double v10 = Uniform( Key( seed, octave, uint64( ix+1 ), uint64( iy   ) ) );
+   double v01 = Uniform( Key( seed, octave, uint64( ix   ), uint64( iy+1 ) ) );
+   double v11 = Uniform( Key( seed, octave, uint64( ix+1 ), uint64( iy+1 ) ) );
+   return (1 - ty)*((1 - tx)*v00 + tx*v10) + ty*((1 - tx)*v01 + tx*v11);
+}
+
+// ----------------------------------------------------------------------------
+
+struct SyntheticStar
+{
+   double x, y;      // centroid
+   double sigma;     // Gaussian PSF standard deviation in pixels
+   double flux[ 3 ]; // peak value per channel
+   int    radius;    // rendering radius in pixels
+};
+
+// ----------------------------------------------------------------------------
+
+void GenerateSyntheticImage( Image& image, SyntheticScene::value_type scene,
+                             int width, int height, int numberOfChannels,
+                             uint64 seed, int numberOfThreads )
+{
+   const int w = width;
+   const int h = height;
+   const int nc = numberOfChannels;
+
+   image.AllocateData( w, h, nc, (nc >= 3) ? ColorSpace::RGB : ColorSpace::Gray );
+
+   // Star catalog. Star density is fixed per unit area, so every image size
+   // has the same structure statistics.
+   const double pixelsPerStar = (scene == SyntheticScene::StarField) ? 1500 : 6000;
+   const size_type numberOfStars = size_type( double( w )*h/pixelsPerStar );
+   Array<SyntheticStar> stars( numberOfStars );
+   for ( size_type i = 0; i < numberOfStars; ++i )
+   {
+      SyntheticStar& s = stars[i];
+      s.x = Uniform( Key( seed, 1, i, 0 ) ) * w;
+      s.y = Uniform( Key( seed, 1, i, 1 ) ) * h;
+      s.sigma = 1.0 + 1.5*Uniform( Key( seed, 1, i, 2 ) );
+      // Power-law brightness distribution: many faint stars, few bright ones
+      double peak = Min( 0.004 * Pow( Max( Uniform( Key( seed, 1, i, 3 ) ), 1.0e-6 ), -1.2 ), 1.0 );
+      double temperature = Uniform( Key( seed, 1, i, 4 ) ) - 0.5;
+      s.flux[0] = peak * (1 + 0.3*temperature);
+      s.flux[1] = peak;
+      s.flux[2] = peak * (1 - 0.3*temperature);
+      s.radius = int( Ceil( 4*s.sigma ) );
+   }
+
+   // Per-channel tint of the diffuse component (H-alpha dominated emission)
+   static const double nebulaTint[] = { 1.0, 0.55, 0.70 };
+   const double background = 0.02;
+   const double noiseSigma = 0.003;
+
+   Array<float*> channels;
+   for ( int c = 0; c < nc; ++c )
+      channels.Add( image.PixelData( c ) );
+
+   ParallelBands( h, numberOfThreads,
+      [=, &channels, &stars]( int y0, int y1 )
+      {
+         // Diffuse component and noise
+         for ( int y = y0; y < y1; ++y )
+            for ( int x = 0; x < w; ++x )
+            {
+               double diffuse = 0;
+               if ( scene == SyntheticScene::Nebula )
+               {
+                  // Fractional Brownian motion over five octaves
+                  double fbm = 0, amplitude = 0.5;
+                  double cell = Max( w, h )/4.0;
+                  for ( int o = 0; o < 5; ++o, amplitude *= 0.5, cell *= 0.5 )
+                     fbm += amplitude * ValueNoise( seed, o, x, y, Max( cell, 4.0 ) );
+                  diffuse = 0.25 * Pow( fbm, 3.0 );
+               }
+
+               double gradient = 0.004 * double( x )/w;
+               size_type i = size_type( y )*w + x;
+               for ( int c = 0; c < nc; ++c )
+               {
+                  double tint = (nc >= 3) ? nebulaTint[Min( c, 2 )] : 1.0;
+                  double v = background + gradient + tint*diffuse
+                           + noiseSigma*Normal( Key( seed, 2 + c, i ) );
+                  channels[c][i] = float( v );
+               }
+            }
+
+         // Stars overlapping this band
+         for ( const SyntheticStar& s : stars )
+         {
+            int sy0 = Max( y0, int( s.y ) - s.radius );
+            int sy1 = Min( y1 - 1, int( s.y ) + s.radius );
+            if ( sy0 > sy1 )
+               continue;
+            int sx0 = Max( 0, int( s.x ) - s.radius );
+            int sx1 = Min( w - 1, int( s.x ) + s.radius );
+            double k = -0.5/(s.sigma*s.sigma);
+            for ( int y = sy0; y <= sy1; ++y )
+               for ( int x = sx0; x <= sx1; ++x )
+               {
+                  double dx = x - s.x;
+                  double dy = y - s.y;
+                  double psf = Exp( k*(dx*dx + dy*dy) );
+                  size_type i = size_type( y )*w + x;
+                  for ( int c = 0; c < nc; ++c )
+                     channels[c][i] += float( psf*s.flux[(nc >= 3) ? Min( c, 2 ) : 1] );
+               }
+         }
+
+         for ( int c = 0; c < nc; ++c )
+            for ( size_type i = size_type( y0 )*w, end = size_type( y1 )*w; i < end; ++i )
+               channels[c][i] = Range( channels[c][i], 0.0f, 1.0f );
+      } );
+}
+
+// ----------------------------------------------------------------------------
+
+} // namespace pcl
+
+// ----------------------------------------------------------------------------
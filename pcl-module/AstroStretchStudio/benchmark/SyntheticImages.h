@@ -0,0 +1,75 @@
+// ----------------------------------------------------------------------------
+// AstroStretchStudio Benchmark - Synthetic Images Header
+// ----------------------------------------------------------------------------
+
+#ifndef __SyntheticImages_h
+#define __SyntheticImages_h
+
+#include <pcl/Image.h>
+
+#include "../AstroStretchStudioParallel.h"
+
+namespace pcl
+{
+
+// ----------------------------------------------------------------------------
+
+namespace SyntheticScene
+{
+   enum value_type
+   {
+      StarField,  // Dense stars over a flat, noisy background
+      Nebula,     // Diffuse multiscale nebulosity with a sparse star field
+      NumberOfItems
+   };
+
+   const char* Id( value_type );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Generates a linear (unstretched) synthetic image in the [0,1] range.
+ * The result depends only on the scene, the dimensions and the seed, never on
+ * the number of threads.
+ */
+void GenerateSyntheticImage( Image& image, SyntheticScene::value_type scene,
+                             int width, int height, int numberOfChannels,
+                             uint64 seed, int numberOfThreads );
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Converts a normalized 32-bit floating point image to any sample type.
+ */
+template <class P>
+void ConvertSyntheticImage( GenericImage<P>& dst, const Image& src, int numberOfThreads )
+{
+   typedef typename P::sample sample;
+
+   const int w = src.Width();
+   const int h = src.Height();
+   const int nc = src.NumberOfChannels();
+
+   dst.AllocateData( w, h, nc, (nc >= 3) ? ColorSpace::RGB : ColorSpace::Gray );
+
+   for ( int c = 0; c < nc; ++c )
+   {
+      const float* s = src.PixelData( c );
+      sample* d = dst.PixelData( c );
+      ParallelBands( h, numberOfThreads,
+         [=]( int y0, int y1 )
+         {
+            for ( size_type i = size_type( y0 )*w, end = size_type( y1 )*w; i < end; ++i )
+               d[i] = P::ToSample( s[i] );
+         } );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+} // namespace pcl
+
+#endif // __SyntheticImages_h
+
+// ----------------------------------------------------------------------------
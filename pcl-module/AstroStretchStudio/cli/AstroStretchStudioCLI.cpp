@@ -0,0 +1,345 @@
+// ----------------------------------------------------------------------------
+// AstroStretchStudio Command-Line Stretcher
+//
+// Applies the OTS or SAS stretch to XISF and FITS files without a PixInsight
+// session, using the same engine and parameter set as the process.
+//
+// Usage: AstroStretchStudioCLI [options] <input> [<input> ...]
+//
+//   --<parameter>=<value>    Any process parameter, by its identifier, e.g.
+//                            --algorithm=SAS --sasNumScales=7
+//                            --otsObjectType=Galaxy --otsPreserveColor=false
+//   --output=<file>          Output file (single input only). The format is
+//                            given by the suffix: .xisf, .fit, .fits, .fts.
+//   --output-dir=<dir>       Output directory. Default: the input directory.
+//   --suffix=_stretched      Appended to the input name when --output is
+//                            not given.
+//   --overwrite              Replace existing output files.
+//   --threads=N              Number of threads. Default: all cores.
+//   --scratch-mb=N           Memory kept for reuse between files, in MiB.
+//                            Default: 1024.
+//   --memory-mb=N            Memory budget of the stretch, in MiB. Larger
+//                            images are processed by scales or in tiles.
+//                            Default: the available physical memory.
+//   --half-scales            Store coarse SAS starlet scales as half floats.
+//   --quiet                  Only report errors.
+//   --help                   Show parameter identifiers and ranges.
+//
+// Exit status is 0 if every file was processed, 1 otherwise.
+// ----------------------------------------------------------------------------
+
+#include "../AstroStretchStudioEngine.h"
+#include "ImageFile.h"
+
+#include <pcl/ElapsedTime.h>
+#include <pcl/File.h>
+
+#include <cstdio>
+#include <thread>
+
+using namespace pcl;
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Identifiers and ranges of the numeric process parameters. They must match
+ * the corresponding MetaParameter classes, which cannot be instantiated
+ * without the PixInsight core application.
+ */
+struct RealParameter
+{
+   const char*               id;
+   double StretchParameters::*value;
+   double                    minValue;
+   double                    maxValue;
+};
+
+static const RealParameter s_realParameters[] =
+{
+   { "otsBackgroundTarget",    &StretchParameters::otsBackgroundTarget,    0.05, 0.30 },
+   { "otsStretchIntensity",    &StretchParameters::otsStretchIntensity,    0.0,  1.0  },
+   { "otsProtectHighlights",   &StretchParameters::otsProtectHighlights,   0.0,  1.0  },
+   { "sasBackgroundTarget",    &StretchParameters::sasBackgroundTarget,    0.05, 0.25 },
+   { "sasFineScaleGain",       &StretchParameters::sasFineScaleGain,       0.5,  2.0  },
+   { "sasMidScaleGain",        &StretchParameters::sasMidScaleGain,        1.0,  5.0  },
+   { "sasCoarseScaleGain",     &StretchParameters::sasCoarseScaleGain,     1.0,  8.0  },
+   { "sasCompressionAlpha",    &StretchParameters::sasCompressionAlpha,    1.0,  20.0 },
+   { "sasHighlightProtection", &StretchParameters::sasHighlightProtection, 0.0,  1.0  },
+   { "sasNoiseThreshold",      &StretchParameters::sasNoiseThreshold,      0.0,  0.01 }
+};
+
+struct BooleanParameter
+{
+   const char*             id;
+   bool StretchParameters::*value;
+};
+
+static const BooleanParameter s_booleanParameters[] =
+{
+   { "otsPreserveColor",     &StretchParameters::otsPreserveColor     },
+   { "sasFlattenBackground", &StretchParameters::sasFlattenBackground },
+   { "sasPreserveColor",     &StretchParameters::sasPreserveColor     },
+   { "sasLinkChannels",      &StretchParameters::sasLinkChannels      }
+};
+
+static const char* s_algorithmIds[] = { "OTS", "SAS" };
+static const char* s_objectTypeIds[] = { "Nebula", "Galaxy", "StarCluster", "DarkNebula", "Custom" };
+
+// ----------------------------------------------------------------------------
+
+struct CLIOptions
+{
+   StretchParameters params;
+   StringList        inputFiles;
+   String            outputFile;
+   String            outputDir;
+   String            suffix = "_stretched";
+   bool              overwrite = false;
+   int               threads = 0;
+   int               scratchMiB = -1; // default arena cap
+   int               memoryMiB = 0;   // available physical memory
+   bool              halfScales = false;
+   bool              quiet = false;
+};
+
+// ----------------------------------------------------------------------------
+
+static pcl_enum EnumerationValue( const IsoString& key, const IsoString& value, const char** ids, int count )
+{
+   for ( int i = 0; i < count; ++i )
+      if ( value.CompareIC( ids[i] ) == 0 )
+         return pcl_enum( i );
+   throw Error( "Invalid value for --" + key + ": " + value );
+}
+
+static bool BooleanValue( const IsoString& key, const IsoString& value )
+{
+   if ( value == "true" || value == "1" || value == "yes" )
+      return true;
+   if ( value == "false" || value == "0" || value == "no" )
+      return false;
+   throw Error( "Invalid value for --" + key + ": " + value );
+}
+
+// ----------------------------------------------------------------------------
+
+static void ShowHelp()
+{
+   std::printf( "Usage: AstroStretchStudioCLI [options] <input> [<input> ...]\n\n"
+                "Process parameters:\n"
+                "  --algorithm=OTS|SAS\n"
+                "  --otsObjectType=Nebula|Galaxy|StarCluster|DarkNebula|Custom\n" );
+   for ( const RealParameter& p : s_realParameters )
+      std::printf( "  --%s=<%g..%g>\n", p.id, p.minValue, p.maxValue );
+   std::printf( "  --sasNumScales=<4..8>\n" );
+   for ( const BooleanParameter& p : s_booleanParameters )
+      std::printf( "  --%s=true|false\n", p.id );
+   std::printf( "\nOptions:\n"
+                "  --output=<file>, --output-dir=<dir>, --suffix=<text>\n"
+                "  --overwrite, --threads=<n>, --scratch-mb=<n>, --memory-mb=<n>, --half-scales, --quiet\n" );
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns false if the program should exit without processing (--help).
+static bool ParseArguments( int argc, const char** argv, CLIOptions& options )
+{
+   options.threads = Max( 1, int( std::thread::hardware_concurrency() ) );
+
+   for ( int i = 1; i < argc; ++i )
+   {
+      IsoString arg( argv[i] );
+      if ( !arg.StartsWith( "--" ) )
+      {
+         options.inputFiles << String::UTF8ToUTF16( arg.c_str() );
+         continue;
+      }
+
+      if ( arg == "--help" )
+      {
+         ShowHelp();
+         return false;
+      }
+      if ( arg == "--overwrite" )
+      {
+         options.overwrite = true;
+         continue;
+      }
+      if ( arg == "--quiet" )
+      {
+         options.quiet = true;
+         continue;
+      }
+      if ( arg == "--half-scales" )
+      {
+         options.halfScales = true;
+         continue;
+      }
+
+      size_type eq = arg.Find( '=' );
+      if ( eq == IsoString::notFound )
+         throw Error( "Invalid argument: " + arg );
+      IsoString key = arg.Substring( 2, eq-2 );
+      IsoString value = arg.Substring( eq+1 );
+
+      if ( key == "output" )
+         options.outputFile = String::UTF8ToUTF16( value.c_str() );
+      else if ( key == "output-dir" )
+         options.outputDir = String::UTF8ToUTF16( value.c_str() );
+      else if ( key == "suffix" )
+         options.suffix = String::UTF8ToUTF16( value.c_str() );
+      else if ( key == "threads" )
+         options.threads = Max( 1, value.ToInt() );
+      else if ( key == "scratch-mb" )
+         options.scratchMiB = Max( 0, value.ToInt() );
+      else if ( key == "memory-mb" )
+         options.memoryMiB = Max( 0, value.ToInt() );
+      else if ( key == "algorithm" )
+         options.params.algorithm = EnumerationValue( key, value, s_algorithmIds, 2 );
+      else if ( key == "otsObjectType" )
+         options.params.otsObjectType = EnumerationValue( key, value, s_objectTypeIds, 5 );
+      else if ( key == "sasNumScales" )
+      {
+         int n = value.ToInt();
+         if ( n < 4 || n > 8 )
+            throw Error( "--sasNumScales out of range [4,8]: " + value );
+         options.params.sasNumScales = n;
+      }
+      else
+      {
+         bool found = false;
+         for ( const RealParameter& p : s_realParameters )
+            if ( key == p.id )
+            {
+               double v = value.ToDouble();
+               if ( v < p.minValue || v > p.maxValue )
+                  throw Error( IsoString().Format( "--%s out of range [%g,%g]: ", p.id, p.minValue, p.maxValue ) + value );
+               options.params.*p.value = v;
+               found = true;
+               break;
+            }
+         if ( !found )
+            for ( const BooleanParameter& p : s_booleanParameters )
+               if ( key == p.id )
+               {
+                  options.params.*p.value = BooleanValue( key, value );
+                  found = true;
+                  break;
+               }
+         if ( !found )
+            throw Error( "Unknown option: --" + key );
+      }
+   }
+
+   if ( options.inputFiles.IsEmpty() )
+      throw Error( "No input files. Use --help for usage." );
+   if ( !options.outputFile.IsEmpty() && options.inputFiles.Length() > 1 )
+      throw Error( "--output requires a single input file." );
+
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+
+static String OutputFilePath( const CLIOptions& options, const String& inputFile )
+{
+   if ( !options.outputFile.IsEmpty() )
+      return options.outputFile;
+   String dir = options.outputDir.IsEmpty() ? File::ExtractDrive( inputFile ) + File::ExtractDirectory( inputFile )
+                                            : options.outputDir;
+   if ( !dir.IsEmpty() && !dir.EndsWith( '/' ) )
+      dir += '/';
+   return dir + File::ExtractName( inputFile ) + options.suffix + File::ExtractExtension( inputFile );
+}
+
+// ----------------------------------------------------------------------------
+
+static IsoString HistoryText( const StretchParameters& p )
+{
+   if ( p.algorithm == ASSAlgorithm::OTS )
+      return IsoString().Format( "AstroStretchStudio OTS objectType=%s bg=%.3f intensity=%.3f highlights=%.3f color=%d",
+                                 s_objectTypeIds[p.otsObjectType], p.otsBackgroundTarget,
+                                 p.otsStretchIntensity, p.otsProtectHighlights, int( p.otsPreserveColor ) );
+   return IsoString().Format( "AstroStretchStudio SAS scales=%d bg=%.3f gains=%.2f,%.2f,%.2f alpha=%.2f"
+                              " highlights=%.2f noise=%.4f flatten=%d color=%d link=%d",
+                              p.sasNumScales, p.sasBackgroundTarget, p.sasFineScaleGain, p.sasMidScaleGain,
+                              p.sasCoarseScaleGain, p.sasCompressionAlpha, p.sasHighlightProtection,
+                              p.sasNoiseThreshold, int( p.sasFlattenBackground ), int( p.sasPreserveColor ),
+                              int( p.sasLinkChannels ) );
+}
+
+// ----------------------------------------------------------------------------
+
+int main( int argc, const char** argv )
+{
+   CLIOptions options;
+   try
+   {
+      if ( !ParseArguments( argc, argv, options ) )
+         return 0;
+   }
+   catch ( const Exception& x )
+   {
+      std::fprintf( stderr, "*** Error: %s\n", x.Message().ToUTF8().c_str() );
+      return 1;
+   }
+
+   if ( options.scratchMiB >= 0 )
+      ScratchArena::Default().SetMaxBytes( size_type( options.scratchMiB )*1024*1024 );
+
+   StretchEngine engine( options.params, options.threads );
+   if ( options.halfScales )
+      engine.SetScaleStorage( ScaleStorage::Float16 );
+   const IsoString history = HistoryText( options.params );
+   int failed = 0;
+
+   for ( const String& inputFile : options.inputFiles )
+   {
+      try
+      {
+         String outputFile = OutputFilePath( options, inputFile );
+         if ( ImageFileFormat::FromPath( outputFile ) == ImageFileFormat::Unknown )
+            throw Error( "Unsupported output file format: " + outputFile );
+
+         ElapsedTime T;
+         ImageFile file;
+         ImageVariant image;
+         file.Read( inputFile, image );
+         double tRead = T();
+
+         size_type budget = StretchEngine::AvailablePhysicalMemory();
+         budget = (budget > 0) ? budget + engine.Arena().PooledBytes() : ~size_type( 0 );
+         if ( options.memoryMiB > 0 )
+            budget = Min( budget, size_type( options.memoryMiB )*1024*1024 );
+         ExecutionPlan plan = engine.Plan( image.Width(), image.Height(), budget, image.NumberOfChannels() );
+         if ( !options.quiet )
+            std::printf( "%s: %s\n", inputFile.ToUTF8().c_str(), plan.ToString().c_str() );
+
+         engine.Apply( image, plan );
+         double tStretch = T() - tRead;
+
+         file.AddHistory( history );
+         file.Write( outputFile, image, options.overwrite );
+
+         if ( !options.quiet )
+            std::printf( "%s -> %s: %dx%dx%d, read %.3f s, stretch %.3f s, total %.3f s\n",
+                         inputFile.ToUTF8().c_str(), outputFile.ToUTF8().c_str(),
+                         image.Width(), image.Height(), image.NumberOfChannels(),
+                         tRead, tStretch, T() );
+      }
+      catch ( const Exception& x )
+      {
+         std::fprintf( stderr, "*** Error: %s: %s\n", inputFile.ToUTF8().c_str(), x.Message().ToUTF8().c_str() );
+         ++failed;
+      }
+      catch ( const std::exception& x )
+      {
+         std::fprintf( stderr, "*** Error: %s: %s\n", inputFile.ToUTF8().c_str(), x.what() );
+         ++failed;
+      }
+   }
+
+   return (failed > 0) ? 1 : 0;
+}
+
+// ----------------------------------------------------------------------------
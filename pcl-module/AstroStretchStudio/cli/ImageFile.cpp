@@ -0,0 +1,363 @@
+// ----------------------------------------------------------------------------
+// AstroStretchStudio CLI - Image File Implementation
+// ----------------------------------------------------------------------------
+
+#include "ImageFile.h"
+
+#include <pcl/File.h>
+#include <pcl/XISF.h>
+
+#include <cfitsio/fitsio.h>
+
+namespace pcl
+{
+
+// ----------------------------------------------------------------------------
+
+ImageFileFormat::value_type ImageFileFormat::FromPath( const String& path )
+{
+   String ext = File::ExtractExtension( path ).Lowercase();
+   if ( ext == ".xisf" )
+      return XISF;
+   if ( ext == ".fit" || ext == ".fits" || ext == ".fts" )
+      return FITS;
+   return Unknown;
+}
+
+// ----------------------------------------------------------------------------
+
+void ImageFile::Read( const String& path, ImageVariant& image )
+{
+   m_options = ImageOptions();
+   m_keywords.Clear();
+   m_properties.Clear();
+   m_iccProfile.Clear();
+
+   switch ( ImageFileFormat::FromPath( path ) )
+   {
+   case ImageFileFormat::XISF:
+      ReadXISF( path, image );
+      break;
+   case ImageFileFormat::FITS:
+      ReadFITS( path, image );
+      break;
+   default:
+      throw Error( "Unsupported file format: " + path );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void ImageFile::Write( const String& path, const ImageVariant& image, bool overwrite ) const
+{
+   switch ( ImageFileFormat::FromPath( path ) )
+   {
+   case ImageFileFormat::XISF:
+      if ( !overwrite && File::Exists( path ) )
+         throw Error( "File already exists: " + path );
+      WriteXISF( path, image );
+      break;
+   case ImageFileFormat::FITS:
+      WriteFITS( path, image, overwrite );
+      break;
+   default:
+      throw Error( "Unsupported file format: " + path );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void ImageFile::AddHistory( const IsoString& text )
+{
+   m_keywords << FITSHeaderKeyword( "HISTORY", IsoString(), text );
+}
+
+// ----------------------------------------------------------------------------
+// XISF
+// ----------------------------------------------------------------------------
+
+void ImageFile::ReadXISF( const String& path, ImageVariant& image )
+{
+   XISFReader reader;
+   reader.Open( path );
+   if ( reader.NumberOfImages() < 1 )
+      throw Error( "No image found: " + path );
+   reader.SelectImage( 0 );
+
+   m_options = reader.ImageOptions();
+   if ( m_options.complexSample )
+      throw Error( "Complex images are not supported: " + path );
+
+   m_keywords = reader.ReadFITSKeywords();
+   m_properties = reader.ReadImageProperties();
+   m_iccProfile = reader.ReadICCProfile();
+
+   if ( m_options.ieeefpSampleFormat )
+   {
+      image.CreateFloatImage( m_options.bitsPerSample );
+      if ( m_options.bitsPerSample == 64 )
+         reader.ReadImage( static_cast<DImage&>( *image ) );
+      else
+         reader.ReadImage( static_cast<Image&>( *image ) );
+   }
+   else
+   {
+      image.CreateUIntImage( m_options.bitsPerSample );
+      switch ( m_options.bitsPerSample )
+      {
+      case  8: reader.ReadImage( static_cast<UInt8Image&>( *image ) ); break;
+      case 16: reader.ReadImage( static_cast<UInt16Image&>( *image ) ); break;
+      case 32: reader.ReadImage( static_cast<UInt32Image&>( *image ) ); break;
+      default:
+         throw Error( String().Format( "Unsupported sample format (%d-bit integer): ", m_options.bitsPerSample ) + path );
+      }
+   }
+
+   reader.Close();
+}
+
+// ----------------------------------------------------------------------------
+
+void ImageFile::WriteXISF( const String& path, const ImageVariant& image ) const
+{
+   ImageOptions options = m_options;
+   options.bitsPerSample = image.BitsPerSample();
+   options.ieeefpSampleFormat = image.IsFloatSample();
+   options.complexSample = false;
+
+   XISFWriter writer;
+   writer.SetCreatorApplication( "AstroStretchStudioCLI" );
+   writer.Create( path, 1 );
+   writer.SetImageOptions( options );
+   writer.WriteFITSKeywords( m_keywords );
+   if ( !m_properties.IsEmpty() )
+      writer.WriteImageProperties( m_properties );
+   if ( !m_iccProfile.IsEmpty() )
+      writer.WriteICCProfile( m_iccProfile );
+
+   if ( image.IsFloatSample() )
+   {
+      if ( image.BitsPerSample() == 64 )
+         writer.WriteImage( static_cast<const DImage&>( *image ) );
+      else
+         writer.WriteImage( static_cast<const Image&>( *image ) );
+   }
+   else
+      switch ( image.BitsPerSample() )
+      {
+      case  8: writer.WriteImage( static_cast<const UInt8Image&>( *image ) ); break;
+      case 16: writer.WriteImage( static_cast<const UInt16Image&>( *image ) ); break;
+      case 32: writer.WriteImage( static_cast<const UInt32Image&>( *image ) ); break;
+      }
+
+   writer.Close();
+}
+
+// ----------------------------------------------------------------------------
+// FITS
+// ----------------------------------------------------------------------------
+
+static void ThrowFITSError( int status, const String& path )
+{
+   char text[ FLEN_STATUS ];
+   fits_get_errstatus( status, text );
+   throw Error( "FITS error: " + String( text ) + ": " + path );
+}
+
+// Keywords that describe the data layout; CFITSIO writes them itself.
+static bool IsStructuralKeyword( const IsoString& name )
+{
+   return name == "SIMPLE" || name == "BITPIX" || name == "EXTEND" || name == "END"
+       || name == "BZERO" || name == "BSCALE" || name.StartsWith( "NAXIS" );
+}
+
+// CFITSIO sample data type codes for the supported image types.
+static int FITSDataType( bool floatSample, int bitsPerSample )
+{
+   if ( floatSample )
+      return (bitsPerSample == 64) ? TDOUBLE : TFLOAT;
+   switch ( bitsPerSample )
+   {
+   case  8: return TBYTE;
+   case 16: return TUSHORT;
+   default: return TUINT;
+   }
+}
+
+static int FITSImageType( bool floatSample, int bitsPerSample )
+{
+   if ( floatSample )
+      return (bitsPerSample == 64) ? DOUBLE_IMG : FLOAT_IMG;
+   switch ( bitsPerSample )
+   {
+   case  8: return BYTE_IMG;
+   case 16: return USHORT_IMG;
+   default: return ULONG_IMG;
+   }
+}
+
+// Sample data of one channel in the image's own sample type.
+static const void* ChannelData( const ImageVariant& image, int channel )
+{
+   if ( image.IsFloatSample() )
+   {
+      if ( image.BitsPerSample() == 64 )
+         return static_cast<const DImage&>( *image ).PixelData( channel );
+      return static_cast<const Image&>( *image ).PixelData( channel );
+   }
+   switch ( image.BitsPerSample() )
+   {
+   case  8: return static_cast<const UInt8Image&>( *image ).PixelData( channel );
+   case 16: return static_cast<const UInt16Image&>( *image ).PixelData( channel );
+   default: return static_cast<const UInt32Image&>( *image ).PixelData( channel );
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void ImageFile::ReadFITS( const String& path, ImageVariant& image )
+{
+   IsoString path8 = path.ToUTF8();
+   fitsfile* f = nullptr;
+   int status = 0;
+
+   if ( fits_open_diskfile( &f, path8.c_str(), READONLY, &status ) )
+      ThrowFITSError( status, path );
+
+   try
+   {
+      int imageType, naxis;
+      long naxes[ 3 ] = { 0, 0, 1 };
+      if ( fits_get_img_equivtype( f, &imageType, &status ) ||
+           fits_get_img_dim( f, &naxis, &status ) ||
+           fits_get_img_size( f, 3, naxes, &status ) )
+         ThrowFITSError( status, path );
+
+      if ( naxis < 2 || naxis > 3 || naxis == 3 && naxes[2] != 1 && naxes[2] != 3 )
+         throw Error( "Unsupported FITS image geometry: " + path );
+
+      bool floatSample;
+      int bitsPerSample;
+      switch ( imageType )
+      {
+      case BYTE_IMG:   floatSample = false; bitsPerSample =  8; break;
+      case USHORT_IMG: floatSample = false; bitsPerSample = 16; break;
+      case ULONG_IMG:  floatSample = false; bitsPerSample = 32; break;
+      case FLOAT_IMG:  floatSample = true;  bitsPerSample = 32; break;
+      case DOUBLE_IMG: floatSample = true;  bitsPerSample = 64; break;
+      default:
+         throw Error( "Unsupported FITS sample format (signed integers): " + path );
+      }
+
+      m_options.bitsPerSample = bitsPerSample;
+      m_options.ieeefpSampleFormat = floatSample;
+
+      int numberOfKeywords;
+      if ( fits_get_hdrspace( f, &numberOfKeywords, nullptr, &status ) )
+         ThrowFITSError( status, path );
+      for ( int i = 1; i <= numberOfKeywords; ++i )
+      {
+         char name[ FLEN_KEYWORD ], value[ FLEN_VALUE ], comment[ FLEN_COMMENT ];
+         if ( fits_read_keyn( f, i, name, value, comment, &status ) )
+            ThrowFITSError( status, path );
+         if ( !IsStructuralKeyword( name ) )
+            m_keywords << FITSHeaderKeyword( name, value, comment );
+      }
+
+      const int w = int( naxes[0] );
+      const int h = int( naxes[1] );
+      const int nc = (naxis == 3) ? int( naxes[2] ) : 1;
+
+      if ( floatSample )
+         image.CreateFloatImage( bitsPerSample );
+      else
+         image.CreateUIntImage( bitsPerSample );
+      image.AllocateImage( w, h, nc, (nc == 3) ? ColorSpace::RGB : ColorSpace::Gray );
+
+      const int dataType = FITSDataType( floatSample, bitsPerSample );
+      for ( int c = 0; c < nc; ++c )
+      {
+         long first[ 3 ] = { 1, 1, c+1 };
+         int anyNull = 0;
+         if ( fits_read_pix( f, dataType, first, LONGLONG( w )*h, nullptr,
+                             const_cast<void*>( ChannelData( image, c ) ), &anyNull, &status ) )
+            ThrowFITSError( status, path );
+      }
+
+      fits_close_file( f, &status );
+   }
+   catch ( ... )
+   {
+      int dummy = 0;
+      fits_close_file( f, &dummy );
+      throw;
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+void ImageFile::WriteFITS( const String& path, const ImageVariant& image, bool overwrite ) const
+{
+   // A leading '!' tells CFITSIO to replace an existing file.
+   IsoString path8 = path.ToUTF8();
+   if ( overwrite )
+      path8.Prepend( '!' );
+   fitsfile* f = nullptr;
+   int status = 0;
+
+   if ( fits_create_diskfile( &f, path8.c_str(), &status ) )
+      ThrowFITSError( status, path );
+
+   try
+   {
+      const int nc = image.NumberOfChannels();
+      int naxis = (nc > 1) ? 3 : 2;
+      long naxes[ 3 ] = { long( image.Width() ), long( image.Height() ), long( nc ) };
+      if ( fits_create_img( f, FITSImageType( image.IsFloatSample(), image.BitsPerSample() ), naxis, naxes, &status ) )
+         ThrowFITSError( status, path );
+
+      for ( const FITSHeaderKeyword& k : m_keywords )
+      {
+         if ( IsStructuralKeyword( k.name ) )
+            continue;
+         if ( k.name == "HISTORY" )
+            fits_write_history( f, k.comment.c_str(), &status );
+         else if ( k.name == "COMMENT" )
+            fits_write_comment( f, k.comment.c_str(), &status );
+         else
+         {
+            // Values are stored verbatim (strings keep their quotes).
+            IsoString card = k.name.LeftJustified( 8 ) + "= " + k.value;
+            if ( !k.comment.IsEmpty() )
+               card += " / " + k.comment;
+            fits_write_record( f, card.Left( 80 ).c_str(), &status );
+         }
+         if ( status )
+            ThrowFITSError( status, path );
+      }
+
+      const int dataType = FITSDataType( image.IsFloatSample(), image.BitsPerSample() );
+      for ( int c = 0; c < nc; ++c )
+      {
+         long first[ 3 ] = { 1, 1, c+1 };
+         if ( fits_write_pix( f, dataType, first, LONGLONG( image.Width() )*image.Height(),
+                              const_cast<void*>( ChannelData( image, c ) ), &status ) )
+            ThrowFITSError( status, path );
+      }
+
+      if ( fits_close_file( f, &status ) )
+         ThrowFITSError( status, path );
+   }
+   catch ( ... )
+   {
+      int dummy = 0;
+      fits_close_file( f, &dummy );
+      throw;
+   }
+}
+
+// ----------------------------------------------------------------------------
+
+} // namespace pcl
+
+// ----------------------------------------------------------------------------
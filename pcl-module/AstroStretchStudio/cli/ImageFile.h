@@ -0,0 +1,78 @@
+// ----------------------------------------------------------------------------
+// AstroStretchStudio CLI - Image File Header
+// ----------------------------------------------------------------------------
+
+#ifndef __ImageFile_h
+#define __ImageFile_h
+
+#include <pcl/FITSHeaderKeyword.h>
+#include <pcl/ICCProfile.h>
+#include <pcl/ImageOptions.h>
+#include <pcl/ImageVariant.h>
+#include <pcl/Property.h>
+#include <pcl/String.h>
+
+namespace pcl
+{
+
+// ----------------------------------------------------------------------------
+
+namespace ImageFileFormat
+{
+   enum value_type
+   {
+      Unknown,
+      XISF,
+      FITS
+   };
+
+   // Format from the file name suffix (.xisf, .fit, .fits, .fts).
+   value_type FromPath( const String& path );
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Reads and writes single-image XISF and FITS files without the PixInsight
+ * core application. XISF goes through PCL's XISFReader/XISFWriter, FITS
+ * through CFITSIO, which is what PixInsight's FITS module uses.
+ *
+ * Metadata (FITS keywords, and for XISF also image properties and the ICC
+ * profile) is kept from the last read file and written back with the image,
+ * so the stretched file carries the original acquisition metadata. Sample
+ * data are read and written in the original sample type; floating point data
+ * are assumed to be in the normalized [0,1] range.
+ */
+class ImageFile
+{
+public:
+
+   ImageFile() = default;
+
+   void Read( const String& path, ImageVariant& image );
+
+   void Write( const String& path, const ImageVariant& image, bool overwrite ) const;
+
+   // Appends a HISTORY keyword to the metadata written by Write().
+   void AddHistory( const IsoString& text );
+
+private:
+
+   ImageOptions     m_options;
+   FITSKeywordArray m_keywords;
+   PropertyArray    m_properties;
+   ICCProfile       m_iccProfile;
+
+   void ReadXISF( const String& path, ImageVariant& image );
+   void ReadFITS( const String& path, ImageVariant& image );
+   void WriteXISF( const String& path, const ImageVariant& image ) const;
+   void WriteFITS( const String& path, const ImageVariant& image, bool overwrite ) const;
+};
+
+// ----------------------------------------------------------------------------
+
+} // namespace pcl
+
+#endif // __ImageFile_h
+
+// ----------------------------------------------------------------------------
@@ -6,6 +6,29 @@ import { Histogram } from './components/Histogram';
 import { ImageLoader } from './components/ImageLoader';
 import { OTSParams, DEFAULT_OTS_PARAMS, applyOTS, getHistogramData } from './engines/OptimalTransportStretch';
 import { SASParams, DEFAULT_SAS_PARAMS, applySAS } from './engines/StarletArctanStretch';
+import { pclBridge } from './utils/pclBridge';
+import type { PCLImageInfo } from './utils/pclBridge';
+
+// Mean of the channel histograms of the native engine, scaled to total
+// counts if given, so that histograms of images of different sizes compare
+function channelMean(channels: Uint32Array[], total?: number): Float32Array {
+  const bins = channels[0].length;
+  const mean = new Float32Array(bins);
+  for (const counts of channels) {
+    for (let i = 0; i < bins; i++) {
+      mean[i] += counts[i] / channels.length;
+    }
+  }
+  if (total !== undefined) {
+    const sum = mean.reduce((s, v) => s + v, 0);
+    if (sum > 0) {
+      for (let i = 0; i < bins; i++) {
+        mean[i] *= total / sum;
+      }
+    }
+  }
+  return mean;
+}
 
 export type AlgorithmType = 'ots' | 'sas';
 
@@ -34,19 +57,72 @@ export default function App() {
   const [isProcessing, setIsProcessing] = useState(false);
   const [showOriginal, setShowOriginal] = useState(false);
   const [zoom, setZoom] = useState(1);
-  const [histogramData, setHistogramData] = useState<{ source: Float32Array | null; result: Float32Array | null }>({
+  const [histogramData, setHistogramData] = useState<{
+    source: Float32Array | null;
+    result: Float32Array | null;
+    predicted?: boolean;
+  }>({
     source: null,
     result: null
   });
 
   const processingTimeoutRef = useRef<number | null>(null);
 
+  // Inside PixInsight the native engine stretches the active view: the page
+  // receives a proxy of its image and previews rendered from it. The
+  // JavaScript engines only serve the standalone (browser) build.
+  const [native, setNative] = useState(false);
+  const [pyramid, setPyramid] = useState<PCLImageInfo | null>(null);
+
+  useEffect(() => {
+    if (!pclBridge.connected) return;
+    setNative(true);
+
+    const offInfo = pclBridge.onImageInfo(setPyramid);
+    const offImage = pclBridge.onImageData(image => {
+      setImageState({ original: image, processed: null, fileName: 'Active view' });
+      setZoom(1);
+    });
+    const offPreview = pclBridge.onPreview(preview => {
+      setImageState(prev => ({ ...prev, processed: preview.image }));
+      setIsProcessing(false);
+    });
+
+    // Source histograms come from the full-resolution view, result ones
+    // from the previews; the latter are scaled to the source's counts.
+    const offHistogram = pclBridge.onHistogram(histogram => {
+      setHistogramData(prev => {
+        const source = histogram.source ? channelMean(histogram.source) : prev.source;
+        if (!histogram.result) {
+          return { ...prev, source };
+        }
+        const total = source ? source.reduce((s, v) => s + v, 0) : undefined;
+        return { source, result: channelMean(histogram.result, total), predicted: histogram.predicted };
+      });
+    });
+
+    pclBridge.requestHistogram(256);
+    pclBridge.requestImage();
+
+    return () => {
+      offInfo();
+      offImage();
+      offPreview();
+      offHistogram();
+    };
+  }, []);
+
   // Process image with current parameters
   const processImage = useCallback(() => {
     if (!imageState.original) return;
 
     setIsProcessing(true);
 
+    if (native) {
+      pclBridge.computePreview({ algorithm, ots: otsParams, sas: sasParams });
+      return;
+    }
+
     // Use requestAnimationFrame to allow UI to update
     requestAnimationFrame(() => {
       try {
@@ -73,9 +149,10 @@ export default function App() {
         setIsProcessing(false);
       }
     });
-  }, [imageState.original, algorithm, otsParams, sasParams]);
+  }, [imageState.original, algorithm, otsParams, sasParams, native]);
 
-  // Debounced processing on parameter change
+  // Debounced processing on parameter change. The native engine coalesces
+  // requests and cancels stale previews itself.
   useEffect(() => {
     if (!imageState.original) return;
 
@@ -85,14 +162,14 @@ export default function App() {
 
     processingTimeoutRef.current = window.setTimeout(() => {
       processImage();
-    }, 100);
+    }, native ? 0 : 100);
 
     return () => {
       if (processingTimeoutRef.current) {
         clearTimeout(processingTimeoutRef.current);
       }
     };
-  }, [otsParams, sasParams, algorithm, processImage]);
+  }, [otsParams, sasParams, algorithm, processImage, native]);
 
   // Handle image load
   const handleImageLoad = useCallback((imageData: ImageData, fileName: string) => {
@@ -102,12 +179,14 @@ export default function App() {
       fileName
     });
 
-    // Compute initial histogram
-    const sourceHist = getHistogramData(imageData);
-    setHistogramData({
-      source: sourceHist.source,
-      result: null
-    });
+    // Compute initial histogram; inside PixInsight it comes from the module
+    if (!pclBridge.connected) {
+      const sourceHist = getHistogramData(imageData);
+      setHistogramData({
+        source: sourceHist.source,
+        result: null
+      });
+    }
 
     setZoom(1);
   }, []);
@@ -172,6 +251,7 @@ export default function App() {
           <Histogram
             sourceData={histogramData.source}
             resultData={histogramData.result}
+            predicted={histogramData.predicted}
           />
         </aside>
 
@@ -181,6 +261,9 @@ export default function App() {
           ) : (
             <PreviewCanvas
               imageData={showOriginal ? imageState.original : imageState.processed || imageState.original}
+              displayWidth={imageState.original.width}
+              displayHeight={imageState.original.height}
+              pyramid={native ? pyramid : null}
               zoom={zoom}
               onZoomChange={setZoom}
               showOriginal={showOriginal}
@@ -3,9 +3,11 @@ import { useRef, useEffect } from 'react';
 interface HistogramProps {
   sourceData: Float32Array | null;
   resultData: Float32Array | null;
+  // The result was predicted from the last preview, not measured
+  predicted?: boolean;
 }
 
-export function Histogram({ sourceData, resultData }: HistogramProps) {
+export function Histogram({ sourceData, resultData, predicted }: HistogramProps) {
   const canvasRef = useRef<HTMLCanvasElement>(null);
 
   useEffect(() => {
@@ -107,6 +109,7 @@ export function Histogram({ sourceData, resultData }: HistogramProps) {
 
       ctx.strokeStyle = lineGradient;
       ctx.lineWidth = 1.5;
+      ctx.setLineDash(predicted ? [4, 3] : []);
       ctx.beginPath();
       for (let i = 0; i < bins; i++) {
         const h = logScale(resultData[i]) * chartHeight;
@@ -116,6 +119,7 @@ export function Histogram({ sourceData, resultData }: HistogramProps) {
         else ctx.lineTo(x, y);
       }
       ctx.stroke();
+      ctx.setLineDash([]);
     }
 
     // Draw axis labels
@@ -127,7 +131,7 @@ export function Histogram({ sourceData, resultData }: HistogramProps) {
     ctx.fillText('1', width - padding.right, height - 4);
     ctx.textAlign = 'center';
     ctx.fillText('0.5', width / 2, height - 4);
-  }, [sourceData, resultData]);
+  }, [sourceData, resultData, predicted]);
 
   return (
     <div className="histogram-panel">
@@ -154,7 +158,7 @@ export function Histogram({ sourceData, resultData }: HistogramProps) {
           </div>
           <div className="legend-item">
             <span className="legend-color result" />
-            <span className="legend-label">Result</span>
+            <span className="legend-label">{predicted ? 'Result (predicted)' : 'Result'}</span>
           </div>
         </div>
       </div>
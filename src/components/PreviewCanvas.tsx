@@ -1,7 +1,17 @@
-import React, { useRef, useEffect, useState, useCallback } from 'react';
+import React, { useRef, useEffect, useState, useCallback, useMemo } from 'react';
+import { pclBridge } from '../utils/pclBridge';
+import type { PCLImageInfo, PCLTile } from '../utils/pclBridge';
 
 interface PreviewCanvasProps {
   imageData: ImageData;
+  // Size the image is shown at, if not its own; coarse native previews are
+  // scaled up to the proxy they were rendered from
+  displayWidth?: number;
+  displayHeight?: number;
+  // Deep zoom pyramid of the image inside PixInsight. When zoomed in beyond
+  // the image's resolution, stretched tiles of the visible region are
+  // requested at a matching level and drawn over the image.
+  pyramid?: PCLImageInfo | null;
   zoom: number;
   onZoomChange: (zoom: number) => void;
   showOriginal: boolean;
@@ -10,8 +20,26 @@ interface PreviewCanvasProps {
   fileName: string;
 }
 
+// A pyramid tile, placed and scaled over the image it refines
+function TileCanvas({ tile, style }: { tile: PCLTile; style: React.CSSProperties }) {
+  const canvasRef = useRef<HTMLCanvasElement>(null);
+
+  useEffect(() => {
+    const canvas = canvasRef.current;
+    if (!canvas) return;
+    canvas.width = tile.image.width;
+    canvas.height = tile.image.height;
+    canvas.getContext('2d')?.putImageData(tile.image, 0, 0);
+  }, [tile]);
+
+  return <canvas ref={canvasRef} className="preview-tile" style={style} />;
+}
+
 export function PreviewCanvas({
   imageData,
+  displayWidth,
+  displayHeight,
+  pyramid,
   zoom,
   onZoomChange,
   showOriginal,
@@ -25,18 +53,98 @@ export function PreviewCanvas({
   const [isDragging, setIsDragging] = useState(false);
   const [dragStart, setDragStart] = useState({ x: 0, y: 0 });
   const [fitMode, setFitMode] = useState<'fit' | 'fill' | 'actual'>('fit');
+  const width = displayWidth ?? imageData.width;
+  const height = displayHeight ?? imageData.height;
+
+  // Tiles received for the current image and parameters, of all levels,
+  // keyed by "level:x:y". Bumping tileRequest requests the visible ones
+  // again after the bridge has dropped them.
+  const [tiles, setTiles] = useState<Map<string, PCLTile>>(() => new Map());
+  const [tileRequest, setTileRequest] = useState(0);
+
+  // Finest level whose pixels are not smaller than device pixels, or -1 if
+  // the image itself is as fine: tiles are only drawn where they add detail.
+  const tileLevel = useMemo(() => {
+    if (!pyramid) return -1;
+    const imagePixelsPerDevicePixel = pyramid.reduction / (zoom * window.devicePixelRatio);
+    const level = Math.min(Math.max(0, Math.floor(Math.log2(imagePixelsPerDevicePixel))), pyramid.levels - 1);
+    return (1 << level) < pyramid.reduction ? level : -1;
+  }, [pyramid, zoom]);
+
+  useEffect(() => {
+    setTiles(new Map());
+    if (!pyramid) return;
+    const offTile = pclBridge.onTile(tile => {
+      setTiles(prev => new Map(prev).set(`${tile.level}:${tile.x}:${tile.y}`, tile));
+    });
+    const offReset = pclBridge.onTilesReset(() => {
+      setTiles(new Map());
+      setTileRequest(n => n + 1);
+    });
+    return () => {
+      offTile();
+      offReset();
+    };
+  }, [pyramid]);
+
+  // Request the visible tiles once panning and zooming settle. The image's
+  // center sits at the container's center moved by pan, scaled by zoom.
+  useEffect(() => {
+    const container = containerRef.current;
+    if (!pyramid || tileLevel < 0 || showOriginal || !container) return;
+
+    const timer = setTimeout(() => {
+      const scale = pyramid.reduction / zoom; // image pixels per CSS pixel
+      const centerX = width * pyramid.reduction / 2;
+      const centerY = height * pyramid.reduction / 2;
+      const left = centerX - (container.clientWidth / 2 + pan.x) * scale;
+      const top = centerY - (container.clientHeight / 2 + pan.y) * scale;
+      const right = left + container.clientWidth * scale;
+      const bottom = top + container.clientHeight * scale;
+
+      const span = pyramid.tileSize << tileLevel;
+      const x0 = Math.max(0, Math.floor(left / span));
+      const y0 = Math.max(0, Math.floor(top / span));
+      const x1 = Math.min(Math.ceil(pyramid.fullWidth / span), Math.ceil(right / span));
+      const y1 = Math.min(Math.ceil(pyramid.fullHeight / span), Math.ceil(bottom / span));
+      if (x0 < x1 && y0 < y1) {
+        pclBridge.requestTiles(tileLevel, x0, y0, x1, y1);
+      }
+    }, 150);
+
+    return () => clearTimeout(timer);
+  }, [pyramid, tileLevel, showOriginal, zoom, pan, width, height, tileRequest]);
+
+  // Tiles of the current level, positioned in image (CSS) pixels
+  const visibleTiles = useMemo(() => {
+    if (!pyramid || tileLevel < 0 || showOriginal) return [];
+    const scale = (1 << tileLevel) / pyramid.reduction;
+    const span = pyramid.tileSize * scale;
+    return Array.from(tiles.values())
+      .filter(tile => tile.level === tileLevel)
+      .map(tile => ({
+        key: `${tile.level}:${tile.x}:${tile.y}`,
+        tile,
+        style: {
+          left: tile.x * span,
+          top: tile.y * span,
+          width: tile.image.width * scale,
+          height: tile.image.height * scale
+        }
+      }));
+  }, [pyramid, tileLevel, showOriginal, tiles]);
 
   // Calculate fit zoom
   const calculateFitZoom = useCallback(() => {
-    if (!containerRef.current || !imageData) return 1;
+    if (!containerRef.current) return 1;
     const container = containerRef.current;
     const padding = 40;
     const availWidth = container.clientWidth - padding;
     const availHeight = container.clientHeight - padding;
-    const scaleX = availWidth / imageData.width;
-    const scaleY = availHeight / imageData.height;
+    const scaleX = availWidth / width;
+    const scaleY = availHeight / height;
     return Math.min(scaleX, scaleY, 1);
-  }, [imageData]);
+  }, [width, height]);
 
   // Draw image to canvas
   useEffect(() => {
@@ -47,12 +155,20 @@ export function PreviewCanvas({
     if (!ctx) return;
 
     // Set canvas size
-    canvas.width = imageData.width;
-    canvas.height = imageData.height;
+    canvas.width = width;
+    canvas.height = height;
 
     // Draw image
-    ctx.putImageData(imageData, 0, 0);
-  }, [imageData]);
+    if (imageData.width === width && imageData.height === height) {
+      ctx.putImageData(imageData, 0, 0);
+    } else {
+      const source = document.createElement('canvas');
+      source.width = imageData.width;
+      source.height = imageData.height;
+      source.getContext('2d')!.putImageData(imageData, 0, 0);
+      ctx.drawImage(source, 0, 0, width, height);
+    }
+  }, [imageData, width, height]);
 
   // Handle fit mode change
   useEffect(() => {
@@ -125,7 +241,7 @@ export function PreviewCanvas({
         <div className="toolbar-left">
           <span className="file-name">{fileName}</span>
           <span className="image-info">
-            {imageData.width} x {imageData.height}
+            {width} x {height}
           </span>
         </div>
 
@@ -202,14 +318,18 @@ export function PreviewCanvas({
         {/* Checkerboard background */}
         <div className="canvas-background" />
 
-        <canvas
-          ref={canvasRef}
-          className="preview-canvas"
+        <div
+          className="preview-layer"
           style={{
             transform: `translate(${pan.x}px, ${pan.y}px) scale(${zoom})`,
             opacity: isProcessing ? 0.7 : 1
           }}
-        />
+        >
+          <canvas ref={canvasRef} className="preview-canvas" />
+          {visibleTiles.map(({ key, tile, style }) => (
+            <TileCanvas key={key} tile={tile} style={style} />
+          ))}
+        </div>
 
         {isProcessing && (
           <div className="processing-overlay">
@@ -351,13 +471,21 @@ export function PreviewCanvas({
           opacity: 0.5;
         }
 
-        .preview-canvas {
+        .preview-layer {
           position: relative;
-          image-rendering: pixelated;
           box-shadow: var(--shadow-lg);
           transition: opacity var(--transition-fast);
         }
 
+        .preview-canvas {
+          display: block;
+          image-rendering: pixelated;
+        }
+
+        .preview-tile {
+          position: absolute;
+        }
+
         .processing-overlay {
           position: absolute;
           inset: 0;
@@ -5,6 +5,9 @@
  * PCL framework through the WebView interface.
  */
 
+import type { OTSParams } from '../engines/OptimalTransportStretch';
+import type { SASParams } from '../engines/StarletArctanStretch';
+
 // Type definitions for PixInsight WebView communication
 declare global {
   interface Window {
@@ -15,6 +18,10 @@ declare global {
     pclSetImageData?: (data: ImageData) => void;
     pclGetActiveViewId?: () => string | null;
     pclExecuteScript?: (script: string) => Promise<unknown>;
+    // Defined by the bridge script of the bundled page (bundle-webview.sh)
+    pclComputePreview?: (parameters?: PCLStretchParameters) => void;
+    pclRequestHistogram?: (bins?: number) => void;
+    pclRequestTiles?: (level: number, x0: number, y0: number, x1: number, y1: number) => void;
   }
 }
 
@@ -24,6 +31,54 @@ export interface PCLMessage {
   id?: string;
 }
 
+export interface PCLStretchParameters {
+  algorithm: 'ots' | 'sas';
+  ots: OTSParams;
+  sas: SASParams;
+}
+
+// The image sent by PixInsight: a proxy of fullWidth x fullHeight pixels
+// reduced by an integer factor.
+export interface PCLImageInfo {
+  width: number;
+  height: number;
+  channels: number;
+  bitsPerSample: number;
+  fullWidth: number;
+  fullHeight: number;
+  reduction: number;
+  tileSize: number;
+  levels: number;
+  revision: number;
+}
+
+// A native preview of the proxy, reduced by 2^level (coarse levels first)
+export interface PCLPreview {
+  reduction: number;
+  level: number;
+  elapsed: number;
+  image: ImageData;
+}
+
+// A deep zoom tile: tile (x, y) of the image reduced by 2^level, stretched
+// with the current parameters. Edge tiles may be smaller than tileSize.
+export interface PCLTile {
+  level: number;
+  x: number;
+  y: number;
+  revision: number;
+  image: ImageData;
+}
+
+// Bin counts of each nominal channel; source or result is null when that
+// part was not sent. A predicted result has a single luminance channel.
+export interface PCLHistogram {
+  bins: number;
+  predicted: boolean;
+  source: Uint32Array[] | null;
+  result: Uint32Array[] | null;
+}
+
 export interface ImageInfo {
   id: string;
   width: number;
@@ -149,6 +204,10 @@ class PCLBridge {
    * Check if connected to PixInsight
    */
   get connected(): boolean {
+    // The bridge script of the bundled page may be defined after this module
+    if (!this.isConnected && typeof window.pclSendMessage === 'function') {
+      this.isConnected = true;
+    }
     return this.isConnected;
   }
 
@@ -246,6 +305,89 @@ class PCLBridge {
     await this.request('applyProcess', { processName, parameters });
   }
 
+  // ========== Native Engine Methods ==========
+
+  /**
+   * Subscribe to an event dispatched by the bridge script. Returns a
+   * function that removes the listener.
+   */
+  private onBridgeEvent<T>(type: string, handler: (detail: T) => void): () => void {
+    const listener = (event: Event) => handler((event as CustomEvent<T>).detail);
+    window.addEventListener(type, listener);
+    return () => window.removeEventListener(type, listener);
+  }
+
+  /**
+   * Request the active view's image; it arrives through onImageInfo and
+   * onImageData
+   */
+  requestImage(): void {
+    if (!this.connected) return;
+    window.pclSendMessage!(JSON.stringify({ type: 'requestImage' }));
+  }
+
+  onImageInfo(handler: (info: PCLImageInfo) => void): () => void {
+    return this.onBridgeEvent('pclImageInfo', handler);
+  }
+
+  onImageData(handler: (image: ImageData) => void): () => void {
+    return this.onBridgeEvent('pclImageData', handler);
+  }
+
+  /**
+   * Stretch the proxy with the native engine and the given parameters.
+   * Requests made in a burst are coalesced, and the previews arrive
+   * through onPreview, coarse levels first.
+   */
+  computePreview(parameters: PCLStretchParameters): void {
+    if (window.pclComputePreview) {
+      window.pclComputePreview(parameters);
+    }
+  }
+
+  onPreview(handler: (preview: PCLPreview) => void): () => void {
+    return this.onBridgeEvent('pclPreview', handler);
+  }
+
+  /**
+   * Request the histograms of the image and of the native previews. They
+   * arrive through onHistogram, and again whenever the image or the
+   * preview changes; predicted ones follow parameter changes.
+   */
+  requestHistogram(bins = 256): void {
+    if (window.pclRequestHistogram) {
+      window.pclRequestHistogram(bins);
+    }
+  }
+
+  onHistogram(handler: (histogram: PCLHistogram) => void): () => void {
+    return this.onBridgeEvent('pclHistogram', handler);
+  }
+
+  /**
+   * Request the tiles [x0,x1) x [y0,y1) of a pyramid level. Tiles already
+   * received are not requested again; the others arrive through onTile.
+   * Only the visible tiles should be requested: the module renders a
+   * viewport's worth of the latest requests.
+   */
+  requestTiles(level: number, x0: number, y0: number, x1: number, y1: number): void {
+    if (window.pclRequestTiles) {
+      window.pclRequestTiles(level, x0, y0, x1, y1);
+    }
+  }
+
+  onTile(handler: (tile: PCLTile) => void): () => void {
+    return this.onBridgeEvent('pclTile', handler);
+  }
+
+  /**
+   * Called when the tiles received so far are outdated by a new image or
+   * new parameters; the visible ones should be requested again.
+   */
+  onTilesReset(handler: () => void): () => void {
+    return this.onBridgeEvent('pclTilesReset', handler);
+  }
+
   /**
    * Log a message to PixInsight's console
    */